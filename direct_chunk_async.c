@@ -0,0 +1,488 @@
+/* direct_chunk_async.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version queues its HDF5 calls on event sets (H5ES) instead of
+ * making them directly. With the async VOL connector loaded, the calls
+ * return as soon as the operation is queued and the library's work runs
+ * in the connector's background thread. Meanwhile the main thread goes on
+ * generating and compressing the next batch of chunks.
+ *
+ * To build:
+ *      h5cc -O2 -o async direct_chunk_async.c -lm -lz
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library, unless you want the async
+ *   VOL connector (which does)
+ *
+ * - Event sets need HDF5 1.13.0 or later. With anything older, this
+ *   builds with the same batching but ordinary synchronous calls, so you
+ *   can compare the two.
+ *
+ * - UNVERIFIED: the event set code (everything under
+ *   H5_VERSION_GE(1, 13, 0)) has never been compiled or run. It was
+ *   written against the 1.14 API docs, and only the synchronous build
+ *   against 1.10 has been tested. Against 1.10 this program is just
+ *   synchronous batching, with no asynchrony at all.
+ *
+ * To run:
+ *      ./async [chunks_per_second]
+ *
+ *      - Generates 256 KiB chunks at chunks_per_second (default 100) in
+ *        batches of BATCH_SIZE
+ *      - ctrl-c stops the program
+ *
+ *      To actually go asynchronous, load the async VOL connector
+ *      (https://github.com/hpc-io/vol-async) with something like:
+ *
+ *          export HDF5_PLUGIN_PATH=<vol-async install>/lib
+ *          export HDF5_VOL_CONNECTOR="async under_vol=0;under_info={}"
+ *
+ *      Without it the event set calls still work but each one finishes
+ *      before it returns.
+ *
+ * How the batches work:
+ *
+ *      There are two batches, each with its own event set and its own
+ *      chunk buffers. A batch extends the dataset once for all its chunks,
+ *      writes them, and flushes the file so SWMR readers see them. While
+ *      one batch's operations are in flight, the other batch's buffers are
+ *      being filled. Before a batch's buffers are reused we H5ESwait() on
+ *      its event set, since the library holds on to the buffers until the
+ *      writes are done.
+ *
+ *      There's no H5Dwrite_chunk_async(). Event-set versions of the
+ *      native "optional" operations go through H5VLdataset_optional_op(),
+ *      which is what H5Dwrite_chunk() itself calls, with an event set.
+ *
+ *      At the end we print how long the main thread spent in HDF5 calls,
+ *      queuing operations or waiting for them. Synchronously that's all
+ *      of the library's work; with the async connector it should only be
+ *      the part that didn't overlap with generating and compressing.
+ */
+
+#include <hdf5.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if H5_VERSION_GE(1, 13, 0)
+#define USE_EVENT_SETS
+#endif
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_async.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+/* 256 KiB of ints */
+const hsize_t CHUNK_SIZE = 64 * 1024;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+/* Chunks per batch */
+#define BATCH_SIZE 16
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+/* One batch of chunks and the event set its operations go on */
+typedef struct {
+    hid_t    es_id;
+    void    *bufs[BATCH_SIZE];      /* Compressed chunks */
+    size_t   sizes[BATCH_SIZE];
+    uint32_t masks[BATCH_SIZE];
+    hsize_t  offsets[BATCH_SIZE];   /* Must outlive the writes, too */
+    hsize_t  extent[RANK];
+    int      n;
+} batch_t;
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**************/
+/* Event sets */
+/**************/
+
+/* Thin wrappers that queue on the batch's event set when there are event
+ * sets, and just make the call when there aren't
+ */
+
+herr_t
+batch_set_extent(hid_t did, batch_t *batch)
+{
+#ifdef USE_EVENT_SETS
+    return H5Dset_extent_async(did, batch->extent, batch->es_id);
+#else
+    return H5Dset_extent(did, batch->extent);
+#endif
+}
+
+herr_t
+batch_write_chunk(hid_t did, batch_t *batch, int i)
+{
+#ifdef USE_EVENT_SETS
+    H5VL_native_dataset_optional_args_t dset_args;
+    H5VL_optional_args_t                args;
+
+    dset_args.write_chunk.offset  = &batch->offsets[i];
+    dset_args.write_chunk.filters = batch->masks[i];
+    dset_args.write_chunk.size    = batch->sizes[i];
+    dset_args.write_chunk.buf     = batch->bufs[i];
+
+    args.op_type = H5VL_NATIVE_DATASET_CHUNK_WRITE;
+    args.args    = &dset_args;
+
+    return H5VLdataset_optional_op(did, &args, H5P_DEFAULT, batch->es_id);
+#else
+    return H5Dwrite_chunk(did, H5P_DEFAULT, batch->masks[i], &batch->offsets[i], batch->sizes[i], batch->bufs[i]);
+#endif
+}
+
+herr_t
+batch_flush(hid_t fid, batch_t *batch)
+{
+#ifdef USE_EVENT_SETS
+    return H5Fflush_async(fid, H5F_SCOPE_GLOBAL, batch->es_id);
+#else
+    (void)batch;
+
+    return H5Fflush(fid, H5F_SCOPE_GLOBAL);
+#endif
+}
+
+/* Waits for everything queued on the batch to finish */
+herr_t
+batch_wait(batch_t *batch)
+{
+#ifdef USE_EVENT_SETS
+    size_t  n_in_progress = 0;
+    hbool_t failed        = 0;
+
+    if (H5ESwait(batch->es_id, H5ES_WAIT_FOREVER, &n_in_progress, &failed) < 0)
+        return FAIL;
+    if (failed) {
+        size_t n_errors = 0;
+
+        H5ESget_err_count(batch->es_id, &n_errors);
+        fprintf(stderr, "%zu queued operation(s) failed\n", n_errors);
+        return FAIL;
+    }
+#else
+    (void)batch;
+#endif
+
+    return SUCCEED;
+}
+
+/********/
+/* HDF5 */
+/********/
+
+herr_t
+setup(void)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Generates and compresses one chunk into slot i of the batch */
+herr_t
+compress_chunk(batch_t *batch, int i, hsize_t offset, int *buf)
+{
+    size_t buf_size  = CHUNK_SIZE * sizeof(int);
+    uLongf z_destLen = compressBound((uLong)buf_size);
+
+    /* Synthetic data: a slow sine wave */
+    if (offset / CHUNK_SIZE > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+    for (hsize_t j = 0; j < CHUNK_SIZE; j++)
+        buf[j] = (int)(1000.0 * sin((double)(offset + j) / 10000.0));
+
+    /* Compress the data using zlib */
+    int z_ret = compress2((Bytef *)batch->bufs[i], &z_destLen, (const Bytef *)buf, (uLong)buf_size, COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    batch->offsets[i] = offset;
+    if (z_destLen >= buf_size) {
+        /* Incompressible, so store it raw, skipping deflate */
+        memcpy(batch->bufs[i], buf, buf_size);
+        batch->sizes[i] = buf_size;
+        batch->masks[i] = 0x1;
+    }
+    else {
+        batch->sizes[i] = (size_t)z_destLen;
+        batch->masks[i] = 0;
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/* Queues everything for a full batch: one extend, the writes, a flush */
+herr_t
+submit_batch(hid_t fid, hid_t did, batch_t *batch)
+{
+    batch->extent[0] = batch->offsets[batch->n - 1] + CHUNK_SIZE;
+
+    if (batch_set_extent(did, batch) < 0)
+        goto badness;
+    for (int i = 0; i < batch->n; i++)
+        if (batch_write_chunk(did, batch, i) < 0)
+            goto badness;
+    if (batch_flush(fid, batch) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    batch_t          batches[2];
+    hid_t            fid     = H5I_INVALID_HID;
+    hid_t            did     = H5I_INVALID_HID;
+    int             *buf     = NULL;
+    double           rate    = 100.0;
+    double           t_start;
+    double           t_hdf5  = 0.0;
+    double           t_next;
+
+    memset(batches, 0, sizeof(batches));
+    batches[0].es_id = batches[1].es_id = H5I_INVALID_HID;
+
+    if (argc > 1)
+        rate = atof(argv[1]);
+    if (rate <= 0.0) {
+        fprintf(stderr, "chunks_per_second must be positive\n");
+        goto badness;
+    }
+
+    if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+    for (int b = 0; b < 2; b++) {
+        for (int i = 0; i < BATCH_SIZE; i++)
+            if (NULL == (batches[b].bufs[i] = malloc((size_t)compressBound((uLong)(CHUNK_SIZE * sizeof(int))))))
+                goto badness;
+#ifdef USE_EVENT_SETS
+        if ((batches[b].es_id = H5EScreate()) == H5I_INVALID_HID)
+            goto badness;
+#endif
+    }
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Set up file and dataset */
+    if (setup() < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE\n");
+#ifdef USE_EVENT_SETS
+    printf("USING EVENT SETS\n");
+#else
+    printf("NO EVENT SETS IN HDF5 %d.%d.%d, WRITING SYNCHRONOUSLY\n", H5_VERS_MAJOR, H5_VERS_MINOR,
+           H5_VERS_RELEASE);
+#endif
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+    int      current  = 0;
+
+    t_start = t_next = now_seconds();
+    while (!stop) {
+        batch_t *batch = &batches[current];
+        double   t;
+
+        if ((t = t_next - now_seconds()) > 0.0)
+            usleep((useconds_t)(t * 1e6));
+        t_next += 1.0 / rate;
+
+        if (compress_chunk(batch, batch->n, n_chunks * CHUNK_SIZE, buf) < 0)
+            goto badness;
+        batch->n++;
+        n_chunks++;
+
+        if (BATCH_SIZE == batch->n) {
+            double t0 = now_seconds();
+
+            if (submit_batch(fid, did, batch) < 0)
+                goto badness;
+
+            /* Switch to the other batch, once it's done with its buffers */
+            current = !current;
+            if (batch_wait(&batches[current]) < 0)
+                goto badness;
+            t_hdf5 += now_seconds() - t0;
+            batches[current].n = 0;
+        }
+    }
+
+    /* Whatever's left */
+    if (batches[current].n > 0 && submit_batch(fid, did, &batches[current]) < 0)
+        goto badness;
+    for (int b = 0; b < 2; b++)
+        if (batch_wait(&batches[b]) < 0)
+            goto badness;
+
+    printf("WRITTEN: %llu chunks in %.3f s, %.3f s of it in HDF5 calls\n", (unsigned long long)n_chunks,
+           now_seconds() - t_start, t_hdf5);
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    for (int b = 0; b < 2; b++) {
+#ifdef USE_EVENT_SETS
+        if (H5ESclose(batches[b].es_id) < 0)
+            goto badness;
+#endif
+        for (int i = 0; i < BATCH_SIZE; i++)
+            free(batches[b].bufs[i]);
+    }
+    free(buf);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        /* Can't free buffers the library might still be writing from */
+        for (int b = 0; b < 2; b++)
+            batch_wait(&batches[b]);
+
+        H5Dclose(did);
+        H5Fclose(fid);
+#ifdef USE_EVENT_SETS
+        H5ESclose(batches[0].es_id);
+        H5ESclose(batches[1].es_id);
+#endif
+    }
+    H5E_END_TRY;
+
+    for (int b = 0; b < 2; b++)
+        for (int i = 0; i < BATCH_SIZE; i++)
+            free(batches[b].bufs[i]);
+    free(buf);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
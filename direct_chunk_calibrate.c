@@ -0,0 +1,546 @@
+/* direct_chunk_calibrate.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version doesn't hard-code a compression level. At startup it
+ * compresses a few sample chunks from the data source with every codec
+ * and level it knows about, times them, and picks the one with the best
+ * compression ratio that still keeps up with a throughput target on this
+ * machine.
+ *
+ * To build:
+ *      h5cc -O2 -o calibrate direct_chunk_calibrate.c -lm -lz
+ *
+ * - DOES require the deflate and shuffle filters
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ *
+ * To run:
+ *      ./calibrate [target_MiB_per_s] [calibration_ms]
+ *
+ *      - target_MiB_per_s (default 50) is the uncompressed data rate
+ *        one core has to be able to compress at
+ *      - calibration_ms (default 1000) is roughly how long calibration
+ *        takes, split evenly between the candidates
+ *      - It will generate one 256 KiB chunk per second with the codec it
+ *        picked, which is also recorded in a "codec" attribute on the
+ *        dataset
+ *      - ctrl-c stops the program
+ *
+ * Candidates:
+ *
+ *      The dataset's filter pipeline is always shuffle then deflate, and
+ *      the candidates are subsets of it:
+ *
+ *          none                    filter mask 0x3 (both skipped)
+ *          deflate-1 ... 9         filter mask 0x1 (shuffle skipped)
+ *          shuffle+deflate-1 ... 9 filter mask 0x0
+ *
+ *      Since readers use the filter mask stored with each chunk, any of
+ *      them can be picked without changing the file layout. "none" always
+ *      meets the target, so there is always an answer.
+ *
+ * The sample chunks come from the same source function as the real data,
+ * so the choice reflects what we'll actually be writing.
+ */
+
+#include <hdf5.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_calibrate.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+/* 256 KiB of ints */
+const hsize_t CHUNK_SIZE = 64 * 1024;
+
+/* The level recorded in the dcpl. It doesn't affect reading. */
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+/* Sample chunks compressed per candidate, per timing pass */
+#define N_SAMPLE_CHUNKS 4
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+/**********/
+/* Codecs */
+/**********/
+
+typedef struct {
+    int      shuffle;
+    unsigned level; /* 0 = no deflate */
+} codec_t;
+
+/* Filter pipeline is shuffle (bit 0), deflate (bit 1) */
+uint32_t
+codec_filter_mask(const codec_t *codec)
+{
+    return (codec->shuffle ? 0 : 0x1) | (codec->level ? 0 : 0x2);
+}
+
+void
+codec_name(const codec_t *codec, char *name, size_t size)
+{
+    if (!codec->level)
+        snprintf(name, size, "none");
+    else
+        snprintf(name, size, "%sdeflate-%u", codec->shuffle ? "shuffle+" : "", codec->level);
+}
+
+/* Byte 0 of every element, then byte 1 of every element, ... which is
+ * what the HDF5 shuffle filter does
+ */
+void
+shuffle_chunk(const int *in, uint8_t *out)
+{
+    const uint8_t *bytes = (const uint8_t *)in;
+
+    for (size_t b = 0; b < sizeof(int); b++)
+        for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+            out[b * CHUNK_SIZE + i] = bytes[i * sizeof(int) + b];
+}
+
+/* Encodes a chunk with a codec. out has to have room for
+ * compressBound() of the chunk, scratch for the chunk. *out_size is set
+ * to the number of bytes to write and *filter_mask to the mask to write
+ * them with.
+ */
+herr_t
+encode_chunk(const codec_t *codec, const int *buf, uint8_t *scratch, uint8_t *out, size_t *out_size,
+             uint32_t *filter_mask)
+{
+    size_t         buf_size = CHUNK_SIZE * sizeof(int);
+    const uint8_t *src      = (const uint8_t *)buf;
+    codec_t        used     = *codec;
+
+    if (codec->shuffle) {
+        shuffle_chunk(buf, scratch);
+        src = scratch;
+    }
+
+    if (codec->level) {
+        uLongf z_destLen = compressBound((uLong)buf_size);
+
+        /* Compress the data using zlib */
+        int z_ret = compress2((Bytef *)out, &z_destLen, (const Bytef *)src, (uLong)buf_size, (int)codec->level);
+        if (Z_OK != z_ret) {
+            fprintf(stderr, "deflate error: %d\n", z_ret);
+            return FAIL;
+        }
+
+        if (z_destLen < buf_size) {
+            *out_size    = (size_t)z_destLen;
+            *filter_mask = codec_filter_mask(&used);
+            return SUCCEED;
+        }
+
+        /* Incompressible, so store it without deflate */
+        used.level = 0;
+    }
+
+    memcpy(out, src, buf_size);
+    *out_size    = buf_size;
+    *filter_mask = codec_filter_mask(&used);
+
+    return SUCCEED;
+}
+
+/**********/
+/* Source */
+/**********/
+
+/* Synthetic data that looks a bit like a diagnostic signal: a slow sine
+ * wave with a little noise on it. Chunk n always gets the same data.
+ */
+void
+fill_chunk(uint64_t chunk, int *buf)
+{
+    uint64_t state = chunk * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++) {
+        double t = (double)(chunk * CHUNK_SIZE + i);
+
+        /* xorshift64 */
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        buf[i] = (int)(20000.0 * sin(t / 5000.0)) + (int)(state % 64) - 32;
+    }
+}
+
+/***************/
+/* Calibration */
+/***************/
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Times every candidate on the sample chunks and picks the best ratio
+ * that meets target_mibps
+ */
+herr_t
+calibrate(double target_mibps, double budget_s, codec_t *best)
+{
+    codec_t  candidates[1 + 2 * 9];
+    int      n_candidates = 0;
+    int     *samples      = NULL;
+    uint8_t *scratch      = NULL;
+    uint8_t *out          = NULL;
+    size_t   buf_size     = CHUNK_SIZE * sizeof(int);
+    double   best_ratio   = 0.0;
+
+    candidates[n_candidates++] = (codec_t){0, 0};
+    for (int shuffle = 0; shuffle < 2; shuffle++)
+        for (unsigned level = 1; level <= 9; level++)
+            candidates[n_candidates++] = (codec_t){shuffle, level};
+
+    /* Sample chunks from the real source */
+    if (NULL == (samples = malloc(N_SAMPLE_CHUNKS * buf_size)))
+        goto badness;
+    if (NULL == (scratch = malloc(buf_size)))
+        goto badness;
+    if (NULL == (out = malloc((size_t)compressBound((uLong)buf_size))))
+        goto badness;
+    for (int i = 0; i < N_SAMPLE_CHUNKS; i++)
+        fill_chunk((uint64_t)i, samples + (size_t)i * CHUNK_SIZE);
+
+    printf("CALIBRATING (target %.0f MiB/s)\n", target_mibps);
+    printf("  %-20s %10s %8s\n", "codec", "MiB/s", "ratio");
+
+    for (int c = 0; c < n_candidates; c++) {
+        double   t0       = now_seconds();
+        double   elapsed  = 0.0;
+        uint64_t n_in     = 0;
+        uint64_t n_out    = 0;
+        double   mibps;
+        double   ratio;
+        int      meets;
+        char     name[32];
+
+        /* Whole passes over the samples until this candidate's share of
+         * the time is up
+         */
+        do {
+            for (int i = 0; i < N_SAMPLE_CHUNKS; i++) {
+                size_t   out_size;
+                uint32_t filter_mask;
+
+                if (encode_chunk(&candidates[c], samples + (size_t)i * CHUNK_SIZE, scratch, out, &out_size,
+                                 &filter_mask) < 0)
+                    goto badness;
+
+                n_in += buf_size;
+                n_out += out_size;
+            }
+            elapsed = now_seconds() - t0;
+        } while (elapsed < budget_s / n_candidates);
+
+        mibps = (double)n_in / elapsed / (1024 * 1024);
+        ratio = (double)n_in / (double)n_out;
+        meets = mibps >= target_mibps;
+
+        codec_name(&candidates[c], name, sizeof(name));
+        printf("  %-20s %10.1f %8.2f%s\n", name, mibps, ratio, meets ? "" : "  (too slow)");
+
+        /* On a tie, the earlier (cheaper) candidate wins */
+        if (meets && ratio > best_ratio) {
+            best_ratio = ratio;
+            *best      = candidates[c];
+        }
+    }
+
+    free(samples);
+    free(scratch);
+    free(out);
+
+    return SUCCEED;
+
+badness:
+    free(samples);
+    free(scratch);
+    free(out);
+    return FAIL;
+}
+
+/********/
+/* HDF5 */
+/********/
+
+herr_t
+setup(const char *codec)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+    hid_t tid     = H5I_INVALID_HID;
+    hid_t asid    = H5I_INVALID_HID;
+    hid_t aid     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl - every candidate codec is a subset of this pipeline */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_shuffle(dcpl_id) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Record what calibration picked */
+    if ((tid = H5Tcopy(H5T_C_S1)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Tset_size(tid, strlen(codec) + 1) < 0)
+        goto badness;
+    if ((asid = H5Screate(H5S_SCALAR)) == H5I_INVALID_HID)
+        goto badness;
+    if ((aid = H5Acreate2(did, "codec", tid, asid, H5P_DEFAULT, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Awrite(aid, tid, codec) < 0)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Aclose(aid) < 0)
+        goto badness;
+    if (H5Sclose(asid) < 0)
+        goto badness;
+    if (H5Tclose(tid) < 0)
+        goto badness;
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Aclose(aid);
+        H5Sclose(asid);
+        H5Tclose(tid);
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+herr_t
+direct_write(hid_t did, hsize_t offset, const codec_t *codec, int *buf, uint8_t *scratch, uint8_t *out)
+{
+    size_t   out_size;
+    uint32_t filter_mask;
+
+    if (offset / CHUNK_SIZE > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+
+    fill_chunk(offset / CHUNK_SIZE, buf);
+
+    if (encode_chunk(codec, buf, scratch, out, &out_size, &filter_mask) < 0)
+        goto badness;
+
+    /* Write the encoded data to the chunk */
+    if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, out_size, out) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    codec_t          codec        = {0, 0};
+    double           target_mibps = 50.0;
+    double           budget_ms    = 1000.0;
+    char             name[32];
+    int             *buf          = NULL;
+    uint8_t         *scratch      = NULL;
+    uint8_t         *out          = NULL;
+
+    hid_t fid = H5I_INVALID_HID;
+    hid_t did = H5I_INVALID_HID;
+
+    if (argc > 1)
+        target_mibps = atof(argv[1]);
+    if (argc > 2)
+        budget_ms = atof(argv[2]);
+    if (target_mibps <= 0.0 || budget_ms <= 0.0) {
+        fprintf(stderr, "target and calibration time must be positive\n");
+        goto badness;
+    }
+
+    /* Pick a codec for this machine */
+    if (calibrate(target_mibps, budget_ms / 1000.0, &codec) < 0)
+        goto badness;
+
+    codec_name(&codec, name, sizeof(name));
+    printf("USING %s\n", name);
+
+    /* Buffers, allocated once */
+    if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+    if (NULL == (scratch = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+    if (NULL == (out = malloc((size_t)compressBound((uLong)(CHUNK_SIZE * sizeof(int))))))
+        goto badness;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Set up file and dataset */
+    if (setup(name) < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE\n");
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+
+    while (!stop) {
+
+        /* Extend by one chunk
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+
+        /* The write offset where we'll be scribbling our data */
+        hsize_t write_offset = n_chunks * CHUNK_SIZE;
+
+        /* The new size of the dataset after we extend */
+        hsize_t new_size = (n_chunks + 1) * CHUNK_SIZE;
+
+        if (extend_dataset(did, new_size) < 0)
+            goto badness;
+
+        if (direct_write(did, write_offset, &codec, buf, scratch, out) < 0)
+            goto badness;
+
+        n_chunks += 1;
+
+        sleep(1);
+    }
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    free(buf);
+    free(scratch);
+    free(out);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    free(buf);
+    free(scratch);
+    free(out);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
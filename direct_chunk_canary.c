@@ -0,0 +1,653 @@
+/* direct_chunk_canary.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version runs a background "canary" thread in the writer that
+ * reads back chunks written a little while ago with H5Dread_chunk(),
+ * decompresses them and compares them against a CRC-32 of the data the
+ * writer kept when it wrote them. Corruption on the storage then shows up
+ * during the run instead of days later. The canary is throttled so it
+ * only uses a small slice of CPU time and I/O bandwidth.
+ *
+ * To build:
+ *      h5cc -O2 -o canary direct_chunk_canary.c -lm -lz -lpthread
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./canary [duty_percent] [io_KiB_per_s]
+ *
+ *      - It will generate ten 4 KiB chunks per second
+ *      - duty_percent (default 5, 0 turns the canary off) is the share
+ *        of one core the canary may use
+ *      - io_KiB_per_s (default 256) caps how much it reads
+ *      - Mismatches are reported on stderr as they're found
+ *      - ctrl-c stops the program
+ *
+ * What gets checked:
+ *
+ *      The writer keeps the CRC-32 of the last RECENT_CHUNKS chunks in a
+ *      ring. The canary checks each of them once, oldest first, as soon as
+ *      it is VERIFY_AGE seconds old. If it can't keep up within its
+ *      budget it skips ahead, so what it checks is a sample. When it has
+ *      nothing new to do it re-checks a random chunk from the ring.
+ *
+ *      Before each read it flushes the file's dirty pages to the storage
+ *      (fdatasync()) and then asks the kernel to drop the file from the
+ *      page cache (posix_fadvise(POSIX_FADV_DONTNEED)), so the bytes come
+ *      from the storage rather than from memory. The flush matters: dirty
+ *      pages can't be dropped, and the kernel doesn't write them back on
+ *      its own for up to 30 s (vm.dirty_expire_centisecs), so without it
+ *      most reads would be served from memory. Both calls are on the file
+ *      descriptor, not HDF5, so they're made without holding h5_mutex and
+ *      don't stall the writer. The flush is counted against the canary's
+ *      budget, and it does make the writer's data durable sooner than it
+ *      otherwise would be.
+ *
+ *      The whole file is flushed and dropped, not just the chunk's byte
+ *      range, because finding a chunk's address in HDF5 1.10
+ *      (H5Dget_chunk_info_by_coord()) walks the chunk index, which gets
+ *      slower as the run goes on and would have to be done under
+ *      h5_mutex. The writer records each chunk's stored size instead, and
+ *      H5Dread_chunk() finds it with an ordinary index lookup. Only the
+ *      sec2 (default) driver has a file descriptor to do this with. With
+ *      any other driver the reads may come from the page cache.
+ *
+ * HDF5 calls from both threads are serialized by h5_mutex, as in
+ * direct_chunk_crc32c.c. Decompression and hashing happen outside it.
+ */
+
+#include <hdf5.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_canary.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+const hsize_t CHUNK_SIZE = 1024;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+/* Chunks whose hashes we keep */
+#define RECENT_CHUNKS 1024
+
+/* Seconds after a chunk is written before the canary first reads it. The
+ * canary flushes the file itself, so this isn't waiting for writeback,
+ * just keeping the canary off the chunks the writer is busy with.
+ */
+const double VERIFY_AGE = 2.0;
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void
+sleep_seconds(double s)
+{
+    struct timespec ts;
+
+    if (s <= 0.0)
+        return;
+
+    ts.tv_sec  = (time_t)s;
+    ts.tv_nsec = (long)((s - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+/**********/
+/* Canary */
+/**********/
+
+/* A chunk the writer has written */
+typedef struct {
+    uint64_t chunk;
+    uint32_t crc;       /* CRC-32 of the uncompressed data */
+    size_t   size;      /* Stored (compressed) size */
+    double   t_written;
+} recent_t;
+
+typedef struct {
+    pthread_mutex_t h5_mutex;
+    hid_t           fid;
+    hid_t           did;
+    int             fd;   /* Our own copy of the file's descriptor, or -1 */
+
+    /* The ring of recent chunks (under h5_mutex) */
+    recent_t ring[RECENT_CHUNKS];
+    uint64_t n_written;   /* Chunks added to the ring, ever */
+    uint64_t next_check;  /* Oldest chunk not checked yet */
+
+    /* Budget */
+    double duty;          /* 0-1 */
+    double io_bytes_per_s;
+
+    /* Results (under h5_mutex) */
+    uint64_t n_checked;
+    uint64_t n_rechecked;
+    uint64_t n_skipped;
+    uint64_t n_bad;
+    uint64_t n_bytes;
+
+    int stop;
+    int failed;
+} canary_t;
+
+/* Called by the writer after each chunk is written */
+void
+canary_add(canary_t *c, uint64_t chunk, uint32_t crc, size_t size)
+{
+    recent_t *r = &c->ring[c->n_written % RECENT_CHUNKS];
+
+    r->chunk     = chunk;
+    r->crc       = crc;
+    r->size      = size;
+    r->t_written = now_seconds();
+
+    c->n_written++;
+
+    /* The ring has lapped the canary */
+    if (c->n_written - c->next_check > RECENT_CHUNKS) {
+        c->n_skipped += c->n_written - RECENT_CHUNKS - c->next_check;
+        c->next_check = c->n_written - RECENT_CHUNKS;
+    }
+}
+
+/* Picks the next chunk to check (under h5_mutex). Returns 0 if there's
+ * nothing to do.
+ */
+int
+canary_pick(canary_t *c, recent_t *pick, int *recheck, unsigned *seed)
+{
+    if (c->next_check < c->n_written) {
+        recent_t *r = &c->ring[c->next_check % RECENT_CHUNKS];
+
+        if (now_seconds() - r->t_written >= VERIFY_AGE) {
+            *pick    = *r;
+            *recheck = 0;
+            c->next_check++;
+            return 1;
+        }
+    }
+
+    /* Nothing new that's old enough, so re-check something we've already
+     * checked
+     */
+    uint64_t oldest = c->n_written > RECENT_CHUNKS ? c->n_written - RECENT_CHUNKS : 0;
+
+    if (c->next_check > oldest) {
+        uint64_t i = oldest + (uint64_t)rand_r(seed) % (c->next_check - oldest);
+
+        *pick    = c->ring[i % RECENT_CHUNKS];
+        *recheck = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Returns a duplicate of the file's descriptor, if the file is using a
+ * driver that has one, or -1
+ */
+int
+dup_file_handle(hid_t fid)
+{
+    hid_t fapl_id = H5Fget_access_plist(fid);
+    int  *fd      = NULL;
+    int   ret     = -1;
+
+    if (fapl_id < 0)
+        return -1;
+
+    if (H5FD_SEC2 == H5Pget_driver(fapl_id) && H5Fget_vfd_handle(fid, H5P_DEFAULT, (void **)&fd) >= 0 && fd)
+        ret = dup(*fd);
+
+    H5Pclose(fapl_id);
+
+    return ret;
+}
+
+/* Writes the file's dirty pages to the storage and drops the file from
+ * the page cache, so the next read has to go to the storage
+ */
+void
+drop_cached(int fd)
+{
+    if (fd < 0)
+        return;
+
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+void *
+canary_thread(void *_c)
+{
+    canary_t *c       = (canary_t *)_c;
+    size_t    raw_len = CHUNK_SIZE * sizeof(int);
+    void     *stored  = NULL;
+    void     *raw     = NULL;
+    unsigned  seed    = 1;
+
+    if (NULL == (stored = malloc(raw_len)) || NULL == (raw = malloc(raw_len)))
+        goto badness;
+
+    while (1) {
+        recent_t pick;
+        int      recheck;
+        int      picked;
+        double   t0;
+        double   busy;
+        hsize_t  offset;
+        size_t   size;
+        uint32_t mask     = 0;
+        uint32_t crc;
+        herr_t   ret;
+
+        pthread_mutex_lock(&c->h5_mutex);
+        if (c->stop) {
+            pthread_mutex_unlock(&c->h5_mutex);
+            break;
+        }
+        picked = canary_pick(c, &pick, &recheck, &seed);
+        pthread_mutex_unlock(&c->h5_mutex);
+
+        if (!picked) {
+            sleep_seconds(0.1);
+            continue;
+        }
+
+        t0     = now_seconds();
+        offset = pick.chunk * CHUNK_SIZE;
+        size   = pick.size;
+
+        /* Read the stored bytes, making sure they come from the disk */
+        drop_cached(c->fd);
+        pthread_mutex_lock(&c->h5_mutex);
+        ret = H5Dread_chunk(c->did, H5P_DEFAULT, &offset, &mask, stored);
+        pthread_mutex_unlock(&c->h5_mutex);
+
+        if (ret < 0) {
+            fprintf(stderr, "CANARY: can't read chunk %llu\n", (unsigned long long)pick.chunk);
+            goto badness;
+        }
+
+        /* Decompress, unless deflate was skipped */
+        if (mask & 0x1) {
+            crc = size == raw_len ? (uint32_t)crc32(0L, (const Bytef *)stored, (uInt)raw_len) : ~pick.crc;
+        }
+        else {
+            uLongf destLen = (uLongf)raw_len;
+
+            if (Z_OK == uncompress((Bytef *)raw, &destLen, (const Bytef *)stored, (uLong)size) &&
+                destLen == raw_len)
+                crc = (uint32_t)crc32(0L, (const Bytef *)raw, (uInt)raw_len);
+            else
+                crc = ~pick.crc;
+        }
+
+        pthread_mutex_lock(&c->h5_mutex);
+        if (crc != pick.crc) {
+            c->n_bad++;
+            fprintf(stderr, "CANARY: chunk %llu doesn't match what was written\n",
+                    (unsigned long long)pick.chunk);
+        }
+        if (recheck)
+            c->n_rechecked++;
+        else
+            c->n_checked++;
+        c->n_bytes += size;
+        pthread_mutex_unlock(&c->h5_mutex);
+
+        /* Stay within the budget: busy for duty of the time, and no more
+         * than io_bytes_per_s on average
+         */
+        busy = now_seconds() - t0;
+        {
+            double cpu_wait = busy * (1.0 - c->duty) / c->duty;
+            double io_wait  = (double)size / c->io_bytes_per_s - busy;
+
+            sleep_seconds(cpu_wait > io_wait ? cpu_wait : io_wait);
+        }
+    }
+
+    free(stored);
+    free(raw);
+
+    return NULL;
+
+badness:
+    pthread_mutex_lock(&c->h5_mutex);
+    c->failed = 1;
+    pthread_mutex_unlock(&c->h5_mutex);
+
+    free(stored);
+    free(raw);
+
+    return NULL;
+}
+
+/********/
+/* HDF5 */
+/********/
+
+herr_t
+setup(void)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/* Compresses and writes one chunk, and hands its hash to the canary */
+herr_t
+direct_write(canary_t *c, hsize_t offset, int *buf, void *buf_out)
+{
+    size_t   buf_size = CHUNK_SIZE * sizeof(int);
+    uLongf   z_destLen = compressBound((uLong)buf_size);
+    uint32_t filter_mask = 0;
+    uint32_t crc;
+    herr_t   ret;
+
+    /* Synthetic data: a ramp, so every chunk is different */
+    if (offset / CHUNK_SIZE > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+        buf[i] = (int)((offset + i) % INT_MAX);
+
+    crc = (uint32_t)crc32(0L, (const Bytef *)buf, (uInt)buf_size);
+
+    /* Compress the data using zlib */
+    int z_ret = compress2((Bytef *)buf_out, &z_destLen, (const Bytef *)buf, (uLong)buf_size, COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+    if (z_destLen >= buf_size) {
+        /* Incompressible, so store it raw, skipping deflate */
+        memcpy(buf_out, buf, buf_size);
+        z_destLen   = (uLongf)buf_size;
+        filter_mask = 0x1;
+    }
+
+    pthread_mutex_lock(&c->h5_mutex);
+    ret = extend_dataset(c->did, offset + CHUNK_SIZE);
+    if (ret >= 0)
+        ret = H5Dwrite_chunk(c->did, H5P_DEFAULT, filter_mask, &offset, (size_t)z_destLen, buf_out);
+    if (ret >= 0)
+        canary_add(c, offset / CHUNK_SIZE, crc, (size_t)z_destLen);
+    pthread_mutex_unlock(&c->h5_mutex);
+
+    if (ret < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    canary_t        *c          = NULL;
+    pthread_t        thread;
+    int              running    = 0;
+    double           duty_pct   = 5.0;
+    double           io_kibps   = 256.0;
+    int             *buf        = NULL;
+    void            *buf_out    = NULL;
+
+    if (argc > 1)
+        duty_pct = atof(argv[1]);
+    if (argc > 2)
+        io_kibps = atof(argv[2]);
+    if (duty_pct < 0.0 || duty_pct > 100.0 || io_kibps <= 0.0) {
+        fprintf(stderr, "duty must be 0-100%% and the I/O budget positive\n");
+        goto badness;
+    }
+
+    if (NULL == (c = calloc(1, sizeof(canary_t))))
+        goto badness;
+    pthread_mutex_init(&c->h5_mutex, NULL);
+    c->fid            = H5I_INVALID_HID;
+    c->did            = H5I_INVALID_HID;
+    c->fd             = -1;
+    c->duty           = duty_pct / 100.0;
+    c->io_bytes_per_s = io_kibps * 1024.0;
+
+    if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+    if (NULL == (buf_out = malloc((size_t)compressBound((uLong)(CHUNK_SIZE * sizeof(int))))))
+        goto badness;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Set up file and dataset */
+    if (setup() < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE\n");
+    if (c->duty > 0.0)
+        printf("CANARY: %.1f%% OF A CORE, %.0f KiB/s\n", duty_pct, io_kibps);
+    else
+        printf("CANARY: OFF\n");
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    if ((c->fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((c->did = H5Dopen2(c->fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if (c->duty > 0.0 && (c->fd = dup_file_handle(c->fid)) < 0)
+        printf("CANARY: NO FILE DESCRIPTOR, READS MAY COME FROM THE PAGE CACHE\n");
+
+    if (c->duty > 0.0) {
+        if (pthread_create(&thread, NULL, canary_thread, c) != 0)
+            goto badness;
+        running = 1;
+    }
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+
+    while (!stop) {
+
+        /* Extend by one chunk and write it
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+        if (direct_write(c, n_chunks * CHUNK_SIZE, buf, buf_out) < 0)
+            goto badness;
+
+        n_chunks += 1;
+
+        pthread_mutex_lock(&c->h5_mutex);
+        int failed = c->failed;
+        pthread_mutex_unlock(&c->h5_mutex);
+        if (failed)
+            goto badness;
+
+        usleep(100000);
+    }
+
+    if (running) {
+        pthread_mutex_lock(&c->h5_mutex);
+        c->stop = 1;
+        pthread_mutex_unlock(&c->h5_mutex);
+        pthread_join(thread, NULL);
+        running = 0;
+    }
+
+    printf("WRITTEN: %llu  CHECKED: %llu  RECHECKED: %llu  SKIPPED: %llu  BAD: %llu  READ: %llu bytes\n",
+           (unsigned long long)c->n_written, (unsigned long long)c->n_checked,
+           (unsigned long long)c->n_rechecked, (unsigned long long)c->n_skipped,
+           (unsigned long long)c->n_bad, (unsigned long long)c->n_bytes);
+
+    if (c->fd >= 0)
+        close(c->fd);
+    c->fd = -1;
+    if (H5Dclose(c->did) < 0)
+        goto badness;
+    if (H5Fclose(c->fid) < 0)
+        goto badness;
+
+    if (c->n_bad)
+        goto badness;
+
+    pthread_mutex_destroy(&c->h5_mutex);
+    free(c);
+    free(buf);
+    free(buf_out);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    if (running) {
+        pthread_mutex_lock(&c->h5_mutex);
+        c->stop = 1;
+        pthread_mutex_unlock(&c->h5_mutex);
+        pthread_join(thread, NULL);
+    }
+    if (c) {
+        if (c->fd >= 0)
+            close(c->fd);
+        H5E_BEGIN_TRY
+        {
+            H5Dclose(c->did);
+            H5Fclose(c->fid);
+        }
+        H5E_END_TRY;
+        pthread_mutex_destroy(&c->h5_mutex);
+    }
+    free(c);
+    free(buf);
+    free(buf_out);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
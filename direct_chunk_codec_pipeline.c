@@ -0,0 +1,744 @@
+/* direct_chunk_codec_pipeline.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version describes the codec as a list of stages (shuffle,
+ * deflate, Fletcher-32). The same list is used both to set up the
+ * dataset's filter pipeline and to encode the chunks we write, so the
+ * two can't drift apart. Adjacent shuffle and deflate stages are fused
+ * into a single pass.
+ *
+ * To build:
+ *      h5cc -O2 -o codec_pipeline direct_chunk_codec_pipeline.c -lm -lz
+ *
+ * - DOES require the deflate, shuffle and Fletcher-32 filters
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ *
+ * To run:
+ *      ./codec_pipeline [stage,stage,...]
+ *
+ *      - Stages are shuffle, deflate[:level] and fletcher32, applied in
+ *        the order given. The default is shuffle,deflate:5,fletcher32.
+ *      - It will generate one 256 KiB chunk per second
+ *      - ctrl-c stops the program, which then reads the whole dataset
+ *        back through the HDF5 filter pipeline and checks every value
+ *
+ * Stages:
+ *
+ *      Each stage kind has a stage_ops_t with two halves: set_dcpl()
+ *      adds the matching HDF5 filter to the dcpl, and encode() does what
+ *      that filter does on write. A stage that doesn't help (deflate
+ *      making the data bigger) reports STAGE_SKIPPED and its bit is set
+ *      in the chunk's filter mask, exactly as the library itself would
+ *      do.
+ *
+ *      Only stages that have an HDF5 filter built into the library are
+ *      here. Delta coding has no built-in filter, and zstd and lz4 are
+ *      plugins, so adding them means adding a stage_ops_t whose encode()
+ *      produces that plugin's exact format and whose set_dcpl() calls
+ *      H5Pset_filter() with its registered filter ID.
+ *
+ * Fusion:
+ *
+ *      Shuffle followed by deflate doesn't write the shuffled chunk out
+ *      in full. Instead, each byte plane is gathered a small, cache-sized
+ *      slice at a time and fed straight to deflate, so the data goes
+ *      through the cache once.
+ */
+
+#include <hdf5.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_codec_pipeline.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+/* 256 KiB of ints */
+const hsize_t CHUNK_SIZE = 64 * 1024;
+
+const char *DEFAULT_PIPELINE = "shuffle,deflate:5,fletcher32";
+
+const int FILL_VALUE = -1;
+
+/* Bytes of a byte plane gathered at a time by the fused shuffle+deflate */
+#define STAGING_SIZE (16 * 1024)
+
+/* HDF5 filter pipelines hold at most 32 filters */
+#define MAX_STAGES 32
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+/* Returned by encode() when the stage was skipped */
+#define STAGE_SKIPPED 1
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+/**********/
+/* Stages */
+/**********/
+
+typedef enum {
+    STAGE_SHUFFLE,
+    STAGE_DEFLATE,
+    STAGE_FLETCHER32,
+    N_STAGE_KINDS
+} stage_kind_t;
+
+/* One stage of a pipeline */
+typedef struct {
+    stage_kind_t kind;
+    unsigned     level;     /* deflate only */
+    size_t       elem_size; /* shuffle only */
+} stage_t;
+
+/* What every stage kind provides */
+typedef struct {
+    const char *name;
+
+    /* Adds the matching filter to a dcpl */
+    herr_t (*set_dcpl)(hid_t dcpl_id, const stage_t *stage);
+
+    /* Largest output for in_size bytes of input */
+    size_t (*bound)(size_t in_size);
+
+    /* Encodes in_size bytes from in into out, which has room for
+     * bound(in_size) bytes. Returns SUCCEED, STAGE_SKIPPED (out is
+     * untouched) or FAIL.
+     */
+    int (*encode)(const stage_t *stage, const uint8_t *in, size_t in_size, uint8_t *out, size_t *out_size);
+} stage_ops_t;
+
+/* Shuffle: byte 0 of every element, then byte 1 of every element, ... */
+
+static herr_t
+shuffle_set_dcpl(hid_t dcpl_id, const stage_t *stage)
+{
+    (void)stage;
+
+    return H5Pset_shuffle(dcpl_id);
+}
+
+static size_t
+same_bound(size_t in_size)
+{
+    return in_size;
+}
+
+static int
+shuffle_encode(const stage_t *stage, const uint8_t *in, size_t in_size, uint8_t *out, size_t *out_size)
+{
+    size_t s = stage->elem_size;
+    size_t n = in_size / s;
+
+    /* Like the HDF5 filter, bytes left over after the last whole element
+     * are copied as-is
+     */
+    for (size_t b = 0; b < s; b++)
+        for (size_t i = 0; i < n; i++)
+            out[b * n + i] = in[i * s + b];
+    memcpy(out + n * s, in + n * s, in_size - n * s);
+
+    *out_size = in_size;
+
+    return SUCCEED;
+}
+
+/* Deflate (zlib format, as the HDF5 deflate filter expects) */
+
+static herr_t
+deflate_set_dcpl(hid_t dcpl_id, const stage_t *stage)
+{
+    return H5Pset_deflate(dcpl_id, stage->level);
+}
+
+static size_t
+deflate_bound(size_t in_size)
+{
+    return (size_t)compressBound((uLong)in_size);
+}
+
+static int
+deflate_encode(const stage_t *stage, const uint8_t *in, size_t in_size, uint8_t *out, size_t *out_size)
+{
+    uLongf z_destLen = compressBound((uLong)in_size);
+    int    z_ret     = compress2((Bytef *)out, &z_destLen, (const Bytef *)in, (uLong)in_size, (int)stage->level);
+
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        return FAIL;
+    }
+
+    /* Not worth it */
+    if (z_destLen >= in_size)
+        return STAGE_SKIPPED;
+
+    *out_size = (size_t)z_destLen;
+
+    return SUCCEED;
+}
+
+/* Fletcher-32: the data followed by its checksum */
+
+static herr_t
+fletcher32_set_dcpl(hid_t dcpl_id, const stage_t *stage)
+{
+    (void)stage;
+
+    return H5Pset_fletcher32(dcpl_id);
+}
+
+static size_t
+fletcher32_bound(size_t in_size)
+{
+    return in_size + 4;
+}
+
+/* The same checksum the HDF5 Fletcher-32 filter computes */
+uint32_t
+fletcher32(const uint8_t *data, size_t len)
+{
+    size_t   words = len / 2;
+    uint32_t sum1  = 0;
+    uint32_t sum2  = 0;
+
+    while (words) {
+        size_t block = words > 360 ? 360 : words;
+
+        words -= block;
+        do {
+            sum1 += (uint32_t)(((uint16_t)data[0]) << 8) | ((uint16_t)data[1]);
+            data += 2;
+            sum2 += sum1;
+        } while (--block);
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+
+    if (len % 2) {
+        sum1 += (uint32_t)(((uint16_t)*data) << 8);
+        sum2 += sum1;
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+
+    return (sum2 << 16) | sum1;
+}
+
+static int
+fletcher32_encode(const stage_t *stage, const uint8_t *in, size_t in_size, uint8_t *out, size_t *out_size)
+{
+    uint32_t sum = fletcher32(in, in_size);
+
+    (void)stage;
+
+    memcpy(out, in, in_size);
+
+    /* Stored little-endian */
+    out[in_size]     = (uint8_t)(sum & 0xff);
+    out[in_size + 1] = (uint8_t)((sum >> 8) & 0xff);
+    out[in_size + 2] = (uint8_t)((sum >> 16) & 0xff);
+    out[in_size + 3] = (uint8_t)((sum >> 24) & 0xff);
+
+    *out_size = in_size + 4;
+
+    return SUCCEED;
+}
+
+const stage_ops_t STAGE_OPS[N_STAGE_KINDS] = {
+    {"shuffle", shuffle_set_dcpl, same_bound, shuffle_encode},
+    {"deflate", deflate_set_dcpl, deflate_bound, deflate_encode},
+    {"fletcher32", fletcher32_set_dcpl, fletcher32_bound, fletcher32_encode},
+};
+
+/*********/
+/* Fused */
+/*********/
+
+/* Shuffle + deflate in one pass. Returns SUCCEED if both stages ran,
+ * STAGE_SKIPPED if deflate didn't help (nothing useful is in out), or
+ * FAIL.
+ */
+static int
+shuffle_deflate_encode(const stage_t *shuffle, const stage_t *defl, const uint8_t *in, size_t in_size,
+                       uint8_t *out, size_t *out_size)
+{
+    uint8_t  staging[STAGING_SIZE];
+    z_stream zs;
+    size_t   s = shuffle->elem_size;
+    size_t   n = in_size / s;
+    int      z_ret;
+
+    memset(&zs, 0, sizeof(zs));
+    if (Z_OK != deflateInit(&zs, (int)defl->level))
+        return FAIL;
+
+    /* Only give deflate as much room as the input: if it needs more, the
+     * stage isn't worth it
+     */
+    zs.next_out  = out;
+    zs.avail_out = (uInt)in_size;
+
+    for (size_t b = 0; b < s; b++)
+        for (size_t i = 0; i < n; i += STAGING_SIZE) {
+            size_t m = n - i < STAGING_SIZE ? n - i : STAGING_SIZE;
+
+            for (size_t j = 0; j < m; j++)
+                staging[j] = in[(i + j) * s + b];
+
+            zs.next_in  = staging;
+            zs.avail_in = (uInt)m;
+            while (zs.avail_in) {
+                if (Z_OK != deflate(&zs, Z_NO_FLUSH) || (zs.avail_in && 0 == zs.avail_out)) {
+                    deflateEnd(&zs);
+                    return 0 == zs.avail_out ? STAGE_SKIPPED : FAIL;
+                }
+            }
+        }
+
+    /* Trailing bytes that aren't a whole element go through unshuffled */
+    zs.next_in  = (Bytef *)(in + n * s);
+    zs.avail_in = (uInt)(in_size - n * s);
+
+    z_ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+
+    if (Z_STREAM_END == z_ret) {
+        *out_size = (size_t)zs.total_out;
+        return *out_size < in_size ? SUCCEED : STAGE_SKIPPED;
+    }
+    if (Z_OK == z_ret || Z_BUF_ERROR == z_ret)
+        return STAGE_SKIPPED;
+
+    return FAIL;
+}
+
+/************/
+/* Pipeline */
+/************/
+
+typedef struct {
+    stage_t stages[MAX_STAGES];
+    int     n_stages;
+} codec_pipeline_t;
+
+/* Parses "shuffle,deflate:6,fletcher32" */
+herr_t
+pipeline_parse(codec_pipeline_t *pl, const char *desc, size_t elem_size)
+{
+    char *copy = NULL;
+    char *save = NULL;
+
+    memset(pl, 0, sizeof(*pl));
+
+    if (NULL == (copy = strdup(desc)))
+        goto badness;
+
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char    *arg   = strchr(tok, ':');
+        stage_t *stage = &pl->stages[pl->n_stages];
+        int      found = 0;
+
+        if (pl->n_stages == MAX_STAGES) {
+            fprintf(stderr, "too many stages\n");
+            goto badness;
+        }
+        if (arg)
+            *arg++ = '\0';
+
+        for (int k = 0; k < N_STAGE_KINDS; k++)
+            if (!strcmp(tok, STAGE_OPS[k].name)) {
+                stage->kind = (stage_kind_t)k;
+                found       = 1;
+            }
+        if (!found) {
+            fprintf(stderr, "unknown stage: %s\n", tok);
+            goto badness;
+        }
+
+        stage->elem_size = elem_size;
+        stage->level     = 5;
+        if (STAGE_DEFLATE == stage->kind && arg)
+            stage->level = (unsigned)atoi(arg);
+        if (stage->level > 9) {
+            fprintf(stderr, "deflate level must be 0-9\n");
+            goto badness;
+        }
+
+        pl->n_stages++;
+    }
+
+    free(copy);
+
+    return SUCCEED;
+
+badness:
+    free(copy);
+    return FAIL;
+}
+
+/* Adds every stage's filter to the dcpl, in pipeline order */
+herr_t
+pipeline_set_dcpl(const codec_pipeline_t *pl, hid_t dcpl_id)
+{
+    for (int i = 0; i < pl->n_stages; i++)
+        if (STAGE_OPS[pl->stages[i].kind].set_dcpl(dcpl_id, &pl->stages[i]) < 0)
+            return FAIL;
+
+    return SUCCEED;
+}
+
+/* Largest output of the whole pipeline */
+size_t
+pipeline_bound(const codec_pipeline_t *pl, size_t in_size)
+{
+    size_t size = in_size;
+
+    for (int i = 0; i < pl->n_stages; i++) {
+        size_t bound = STAGE_OPS[pl->stages[i].kind].bound(size);
+
+        /* A skipped stage leaves the size alone */
+        size = bound > size ? bound : size;
+    }
+
+    return size;
+}
+
+/* Runs the pipeline over a chunk
+ *
+ * bufs are two scratch buffers of pipeline_bound() bytes each. On
+ * success, *result points at the encoded data (in one of bufs, or in at
+ * if there are no stages) and *filter_mask has a bit set for every stage
+ * that was skipped.
+ */
+herr_t
+pipeline_encode(const codec_pipeline_t *pl, const uint8_t *in, size_t in_size, uint8_t *bufs[2],
+                const uint8_t **result, size_t *result_size, uint32_t *filter_mask)
+{
+    const uint8_t *cur      = in;
+    size_t         cur_size = in_size;
+    int            next     = 0;
+
+    *filter_mask = 0;
+
+    for (int i = 0; i < pl->n_stages; i++) {
+        const stage_t *stage    = &pl->stages[i];
+        size_t         out_size = 0;
+        int            ret;
+
+        /* Fuse shuffle + deflate */
+        if (STAGE_SHUFFLE == stage->kind && i + 1 < pl->n_stages && STAGE_DEFLATE == pl->stages[i + 1].kind) {
+            ret = shuffle_deflate_encode(stage, &pl->stages[i + 1], cur, cur_size, bufs[next], &out_size);
+            if (FAIL == ret)
+                return FAIL;
+            if (SUCCEED == ret) {
+                cur      = bufs[next];
+                cur_size = out_size;
+                next     = !next;
+                i++;
+                continue;
+            }
+
+            /* Deflate didn't help. Run the shuffle on its own below, and
+             * deflate will skip itself again.
+             */
+        }
+
+        ret = STAGE_OPS[stage->kind].encode(stage, cur, cur_size, bufs[next], &out_size);
+        if (FAIL == ret)
+            return FAIL;
+        if (STAGE_SKIPPED == ret) {
+            *filter_mask |= 1u << i;
+            continue;
+        }
+
+        cur      = bufs[next];
+        cur_size = out_size;
+        next     = !next;
+    }
+
+    *result      = cur;
+    *result_size = cur_size;
+
+    return SUCCEED;
+}
+
+/********/
+/* HDF5 */
+/********/
+
+herr_t
+setup(const codec_pipeline_t *pl)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl - the filters come from the same pipeline that encodes the
+     * chunks
+     */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (pipeline_set_dcpl(pl, dcpl_id) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/* Synthetic data: a ramp starting at chunk number * 1000, so neighbouring
+ * values differ only in their low bytes (which is what shuffle is good
+ * at) and screwups are easy to spot
+ */
+int
+expected_value(hsize_t index)
+{
+    return (int)((index / CHUNK_SIZE) * 1000 + index % CHUNK_SIZE);
+}
+
+herr_t
+direct_write(hid_t did, hsize_t offset, const codec_pipeline_t *pl, int *buf, uint8_t *bufs[2])
+{
+    const uint8_t *out;
+    size_t         out_size;
+    uint32_t       filter_mask;
+
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+        buf[i] = expected_value(offset + i);
+
+    if (pipeline_encode(pl, (const uint8_t *)buf, CHUNK_SIZE * sizeof(int), bufs, &out, &out_size, &filter_mask) <
+        0)
+        goto badness;
+
+    /* Write the encoded data to the chunk */
+    if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, out_size, out) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/* Reads everything back through the library's filter pipeline */
+herr_t
+check_dataset(hid_t did, uint64_t n_chunks)
+{
+    int    *buf = NULL;
+    hsize_t n   = n_chunks * CHUNK_SIZE;
+
+    if (0 == n)
+        return SUCCEED;
+
+    if (H5Drefresh(did) < 0)
+        goto badness;
+    if (NULL == (buf = malloc((size_t)n * sizeof(int))))
+        goto badness;
+    if (H5Dread(did, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf) < 0)
+        goto badness;
+
+    for (hsize_t i = 0; i < n; i++)
+        if (buf[i] != expected_value(i)) {
+            fprintf(stderr, "element %llu: expected %d, read %d\n", (unsigned long long)i, expected_value(i),
+                    buf[i]);
+            goto badness;
+        }
+
+    printf("READ BACK %llu CHUNKS OK\n", (unsigned long long)n_chunks);
+
+    free(buf);
+
+    return SUCCEED;
+
+badness:
+    free(buf);
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    codec_pipeline_t pl;
+    int             *buf     = NULL;
+    uint8_t         *bufs[2] = {NULL, NULL};
+    size_t           bound;
+
+    hid_t fid = H5I_INVALID_HID;
+    hid_t did = H5I_INVALID_HID;
+
+    if (pipeline_parse(&pl, argc > 1 ? argv[1] : DEFAULT_PIPELINE, sizeof(int)) < 0)
+        goto badness;
+
+    /* Buffers, allocated once */
+    bound = pipeline_bound(&pl, CHUNK_SIZE * sizeof(int));
+    if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+    for (int i = 0; i < 2; i++)
+        if (NULL == (bufs[i] = malloc(bound)))
+            goto badness;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Set up file and dataset */
+    if (setup(&pl) < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE\n");
+    printf("PIPELINE:");
+    for (int i = 0; i < pl.n_stages; i++)
+        printf(" %s", STAGE_OPS[pl.stages[i].kind].name);
+    printf("\n");
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+
+    while (!stop) {
+
+        /* Extend by one chunk
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+
+        /* The write offset where we'll be scribbling our data */
+        hsize_t write_offset = n_chunks * CHUNK_SIZE;
+
+        /* The new size of the dataset after we extend */
+        hsize_t new_size = (n_chunks + 1) * CHUNK_SIZE;
+
+        if (extend_dataset(did, new_size) < 0)
+            goto badness;
+
+        if (direct_write(did, write_offset, &pl, buf, bufs) < 0)
+            goto badness;
+
+        n_chunks += 1;
+
+        sleep(1);
+    }
+
+    if (check_dataset(did, n_chunks) < 0)
+        goto badness;
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    free(buf);
+    free(bufs[0]);
+    free(bufs[1]);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    free(buf);
+    free(bufs[0]);
+    free(bufs[1]);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,787 @@
+/* direct_chunk_cold.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version compresses live data at a fast deflate level and comes
+ * back for it later. The writer only has to keep up with the pulse, so
+ * it uses level 1 and splits the data into segment files. Once a segment
+ * is sealed, background worker processes recompress it at level 9 on
+ * otherwise idle cores and swap the result in for the original. Ingest
+ * stays quick and the archive still ends up well compressed, without
+ * having to pick one level at setup() time.
+ *
+ * To build:
+ *      h5cc -O2 -o cold direct_chunk_cold.c -lm -lz
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require HDF5 1.10 or later (virtual datasets)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./cold [n_workers] [chunks_per_segment] [chunks_per_second]
+ *
+ *      - n_workers defaults to one per core, less one for the writer
+ *        (at least one)
+ *      - Segments are direct_chunk_cold_<n>.h5, each holding
+ *        chunks_per_segment (default 60) 256 KiB chunks. Chunks are
+ *        generated at chunks_per_second (default 1).
+ *      - Read direct_chunk_cold.h5 to see the combined data
+ *      - ctrl-c stops the program. Sealed segments (including the partly
+ *        filled last one) are all recompressed before it exits.
+ *
+ * The workers:
+ *
+ *      They're forked before any HDF5 calls, like the writers in
+ *      direct_chunk_vds_writer.c, and run at the lowest CPU priority
+ *      (and idle I/O priority on Linux) so they only get what the writer
+ *      leaves. The writer hands out sealed segments over one pipe that
+ *      all of them read from; each message is smaller than PIPE_BUF, so
+ *      it goes to exactly one worker.
+ *
+ *      A worker recompresses a segment into <name>.tmp a chunk at a time,
+ *      using H5Dread_chunk() and H5Dwrite_chunk() so the HDF5 filter
+ *      pipeline is never involved. Chunks that were stored raw stay raw,
+ *      as do chunks level 9 can't make smaller. The new file is
+ *      fsync()ed and rename()d over the old one, so the swap is atomic:
+ *      a reader that already has the old file open keeps reading it, and
+ *      anything that opens it afterwards gets the new one.
+ *
+ *      The catalog maps segment files with a printf-style VDS source name
+ *      (direct_chunk_cold_%b.h5), so it's written once and never needs
+ *      updating as segments are added or swapped.
+ */
+
+#include <hdf5.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *CATALOG_FILE_NAME = "direct_chunk_cold.h5";
+const char *SEGMENT_FILE_FORMAT = "direct_chunk_cold_%d.h5";
+const char *SEGMENT_VDS_FORMAT = "direct_chunk_cold_%b.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+#define MAX_WORKERS 64
+
+#define NAME_LEN 64
+
+/* 256 KiB of ints */
+const hsize_t CHUNK_SIZE = 64 * 1024;
+
+/* Live and archival deflate levels */
+#define LIVE_LEVEL 1
+#define COLD_LEVEL 9
+
+const int FILL_VALUE = -1;
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* fsync()s a file or directory by name */
+herr_t
+fsync_path(const char *name)
+{
+    int fd;
+
+    if ((fd = open(name, O_RDONLY)) < 0) {
+        perror(name);
+        return FAIL;
+    }
+    if (fsync(fd) < 0) {
+        perror(name);
+        close(fd);
+        return FAIL;
+    }
+    close(fd);
+
+    return SUCCEED;
+}
+
+/**********/
+/* Source */
+/**********/
+
+/* A quiet baseline with a short oscillating burst every so often. The
+ * repeats in this are far apart, so level 9's longer searches find
+ * noticeably more of them than level 1 does.
+ */
+void
+fill_chunk(uint64_t chunk, int *buf)
+{
+    uint64_t state = chunk * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++) {
+        uint64_t t = chunk * CHUNK_SIZE + i;
+
+        /* xorshift64 */
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        if ((t / 2048) % 4)
+            buf[i] = 1000 + (int)(state % 4);
+        else
+            buf[i] = (int)(5000.0 * sin((double)t / 50.0));
+    }
+}
+
+/********/
+/* HDF5 */
+/********/
+
+/* Creates one segment file */
+herr_t
+setup_segment(const char *file_name, hsize_t chunks_per_segment)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t dims[RANK]       = {chunks_per_segment * CHUNK_SIZE};
+    hsize_t chunk_dims[RANK] = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(file_name, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset - segments have a fixed size */
+    if ((sid = H5Screate_simple(RANK, dims, NULL)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, LIVE_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Creates the catalog, whose virtual dataset maps segment n to block n
+ * for however many segment files there turn out to be
+ */
+herr_t
+setup_catalog(hsize_t chunks_per_segment)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t vsid    = H5I_INVALID_HID;
+    hid_t src_sid = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t segment_size       = chunks_per_segment * CHUNK_SIZE;
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t src_dims[RANK]     = {segment_size};
+    hsize_t start[RANK]        = {0};
+    hsize_t stride[RANK]       = {segment_size};
+    hsize_t count[RANK]        = {H5S_UNLIMITED};
+    hsize_t block[RANK]        = {segment_size};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    if ((fid = H5Fcreate(CATALOG_FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Virtual and source dataspaces */
+    if ((vsid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sselect_hyperslab(vsid, H5S_SELECT_SET, start, stride, count, block) < 0)
+        goto badness;
+    if ((src_sid = H5Screate_simple(RANK, src_dims, NULL)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+    if (H5Pset_virtual(dcpl_id, vsid, SEGMENT_VDS_FORMAT, DSET_NAME, src_sid) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, vsid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(vsid) < 0)
+        goto badness;
+    if (H5Sclose(src_sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(vsid);
+        H5Sclose(src_sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Writes chunk n of the whole at offset in a segment, at the live
+ * level. buf and buf_out are reused; buf_out has room for compressBound()
+ * of a chunk.
+ */
+herr_t
+direct_write(hid_t did, hsize_t offset, uint64_t n, int *buf, uint8_t *buf_out)
+{
+    size_t buf_size  = CHUNK_SIZE * sizeof(int);
+    uLongf z_destLen = compressBound((uLong)buf_size);
+
+    if (n > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+
+    fill_chunk(n, buf);
+
+    /* Compress the data using zlib */
+    int z_ret = compress2((Bytef *)buf_out, &z_destLen, (const Bytef *)buf, (uLong)buf_size, LIVE_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    /* Write the compressed data to the chunk, or the raw data if deflate
+     * didn't help
+     */
+    if (z_destLen < buf_size) {
+        if (H5Dwrite_chunk(did, H5P_DEFAULT, 0, &offset, (size_t)z_destLen, buf_out) < 0)
+            goto badness;
+    }
+    else if (H5Dwrite_chunk(did, H5P_DEFAULT, 0x1, &offset, buf_size, buf) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/***********/
+/* Workers */
+/***********/
+
+/* Recompresses every chunk of a sealed segment into a new file and swaps
+ * it in for the old one
+ */
+herr_t
+recompress_segment(int segment)
+{
+    char      file_name[NAME_LEN];
+    char      tmp_name[NAME_LEN + 4];
+    hid_t     in_fid   = H5I_INVALID_HID;
+    hid_t     in_did   = H5I_INVALID_HID;
+    hid_t     out_fid  = H5I_INVALID_HID;
+    hid_t     out_did  = H5I_INVALID_HID;
+    hid_t     fapl_id  = H5I_INVALID_HID;
+    hid_t     sid      = H5I_INVALID_HID;
+    hid_t     dcpl_id  = H5I_INVALID_HID;
+    size_t    buf_size = CHUNK_SIZE * sizeof(int);
+    size_t    max_size = (size_t)compressBound((uLong)(CHUNK_SIZE * sizeof(int)));
+    uint8_t  *in       = NULL;
+    uint8_t  *raw      = NULL;
+    uint8_t  *out      = NULL;
+    hsize_t   dims[RANK];
+    hsize_t   n_expected;
+    hsize_t   n_chunks = 0;
+    uint64_t  before   = 0;
+    uint64_t  after    = 0;
+    unsigned  flags;
+    unsigned  level    = COLD_LEVEL;
+    double    t_start  = now_seconds();
+
+    snprintf(file_name, sizeof(file_name), SEGMENT_FILE_FORMAT, segment);
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", file_name);
+
+    if (NULL == (in = malloc(max_size)) || NULL == (raw = malloc(buf_size)) || NULL == (out = malloc(max_size)))
+        goto badness;
+
+    /* The sealed segment */
+    if ((in_fid = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((in_did = H5Dopen2(in_fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((sid = H5Dget_space(in_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sget_simple_extent_dims(sid, dims, NULL) < 0)
+        goto badness;
+    if (H5Dget_num_chunks(in_did, sid, &n_expected) < 0)
+        goto badness;
+
+    /* The replacement, identical apart from the recorded level */
+    if ((dcpl_id = H5Dget_create_plist(in_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pget_filter_by_id2(dcpl_id, H5Z_FILTER_DEFLATE, &flags, NULL, NULL, 0, NULL, NULL) < 0)
+        goto badness;
+    if (H5Pmodify_filter(dcpl_id, H5Z_FILTER_DEFLATE, flags, 1, &level) < 0)
+        goto badness;
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+    if ((out_fid = H5Fcreate(tmp_name, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+    if ((out_did = H5Dcreate2(out_fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) ==
+        H5I_INVALID_HID)
+        goto badness;
+
+    for (hsize_t offset = 0; offset < dims[0]; offset += CHUNK_SIZE) {
+        hsize_t  size = 0;
+        uint32_t filter_mask;
+        herr_t   found;
+
+        /* Fails for chunks that were never written */
+        H5E_BEGIN_TRY
+        {
+            found = H5Dget_chunk_storage_size(in_did, &offset, &size);
+        }
+        H5E_END_TRY;
+
+        if (found < 0 || 0 == size)
+            continue;
+        if (size > max_size) {
+            fprintf(stderr, "chunk at %llu is too big\n", (unsigned long long)offset);
+            goto badness;
+        }
+
+        if (H5Dread_chunk(in_did, H5P_DEFAULT, &offset, &filter_mask, in) < 0)
+            goto badness;
+        before += size;
+
+        if (0 == filter_mask) {
+            uLongf raw_len = (uLongf)buf_size;
+            uLongf z_len   = (uLongf)max_size;
+
+            if (Z_OK != uncompress(raw, &raw_len, in, (uLong)size) || raw_len != buf_size) {
+                fprintf(stderr, "can't inflate chunk at %llu\n", (unsigned long long)offset);
+                goto badness;
+            }
+            if (Z_OK != compress2(out, &z_len, raw, (uLong)buf_size, COLD_LEVEL)) {
+                fprintf(stderr, "can't deflate chunk at %llu\n", (unsigned long long)offset);
+                goto badness;
+            }
+
+            /* Keep whichever is smaller */
+            if ((hsize_t)z_len < size) {
+                memcpy(in, out, (size_t)z_len);
+                size = (hsize_t)z_len;
+            }
+        }
+
+        if (H5Dwrite_chunk(out_did, H5P_DEFAULT, filter_mask, &offset, (size_t)size, in) < 0)
+            goto badness;
+        after += size;
+        n_chunks++;
+    }
+
+    if (n_chunks != n_expected) {
+        fprintf(stderr, "recompressed %llu chunks of segment %d but it has %llu\n",
+                (unsigned long long)n_chunks, segment, (unsigned long long)n_expected);
+        goto badness;
+    }
+
+    if (H5Dclose(out_did) < 0)
+        goto badness;
+    if (H5Fclose(out_fid) < 0)
+        goto badness;
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Dclose(in_did) < 0)
+        goto badness;
+    if (H5Fclose(in_fid) < 0)
+        goto badness;
+
+    /* Swap it in */
+    if (fsync_path(tmp_name) < 0)
+        goto badness;
+    if (rename(tmp_name, file_name) < 0) {
+        perror(file_name);
+        goto badness;
+    }
+    if (fsync_path(".") < 0)
+        goto badness;
+
+    printf("segment %d: %llu chunks, %.2f MiB -> %.2f MiB at level %d in %.2f s\n", segment,
+           (unsigned long long)n_chunks, (double)before / (1024.0 * 1024.0), (double)after / (1024.0 * 1024.0),
+           COLD_LEVEL, now_seconds() - t_start);
+    fflush(stdout);
+
+    free(in);
+    free(raw);
+    free(out);
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(out_did);
+        H5Fclose(out_fid);
+        H5Pclose(fapl_id);
+        H5Pclose(dcpl_id);
+        H5Sclose(sid);
+        H5Dclose(in_did);
+        H5Fclose(in_fid);
+    }
+    H5E_END_TRY;
+
+    unlink(tmp_name);
+
+    free(in);
+    free(raw);
+    free(out);
+
+    return FAIL;
+}
+
+/* Gets out of the writer's way as far as we can */
+void
+lower_priority(void)
+{
+    errno = 0;
+    if (nice(19) < 0 && errno)
+        perror("nice");
+
+#ifdef SYS_ioprio_set
+    /* ioprio_set(IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE) - there's no
+     * glibc wrapper
+     */
+    if (syscall(SYS_ioprio_set, 1, 0, 3 << 13) < 0)
+        perror("ioprio_set");
+#endif
+}
+
+/* A worker's main loop: recompress segments until the writer closes its
+ * end of the pipe
+ */
+herr_t
+run_worker(int segment_fd)
+{
+    for (;;) {
+        int     segment;
+        ssize_t n = read(segment_fd, &segment, sizeof(segment));
+
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (0 == n)
+            break;
+        if (n != (ssize_t)sizeof(segment)) {
+            fprintf(stderr, "bad segment message\n");
+            return FAIL;
+        }
+
+        if (recompress_segment(segment) < 0) {
+            fprintf(stderr, "can't recompress segment %d\n", segment);
+            return FAIL;
+        }
+    }
+
+    return SUCCEED;
+}
+
+/**********/
+/* Writer */
+/**********/
+
+/* Waits for every worker. Fails if any of them did. */
+herr_t
+wait_for_workers(const pid_t *pids, int n_workers)
+{
+    herr_t ret = SUCCEED;
+
+    for (int i = 0; i < n_workers; i++) {
+        int status = 0;
+
+        while (waitpid(pids[i], &status, 0) < 0)
+            if (EINTR != errno) {
+                status = -1;
+                break;
+            }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            ret = FAIL;
+    }
+
+    return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    pid_t            pids[MAX_WORKERS];
+    long             n_workers          = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    hsize_t          chunks_per_segment = 60;
+    long             chunks_per_second  = 1;
+    int              n_started          = 0;
+    int              fds[2]             = {-1, -1};
+    int              segment            = 0;
+    int             *buf                = NULL;
+    uint8_t         *buf_out            = NULL;
+
+    hid_t fid = H5I_INVALID_HID;
+    hid_t did = H5I_INVALID_HID;
+
+    if (argc > 1)
+        n_workers = atol(argv[1]);
+    else if (n_workers < 1)
+        n_workers = 1;
+    if (argc > 2)
+        chunks_per_segment = (hsize_t)strtoull(argv[2], NULL, 10);
+    if (argc > 3)
+        chunks_per_second = atol(argv[3]);
+    if (n_workers < 1 || n_workers > MAX_WORKERS || chunks_per_segment < 1 || chunks_per_second < 1 ||
+        chunks_per_second > 1000000) {
+        fprintf(stderr, "bad number of workers, chunks per segment or chunks per second\n");
+        goto badness;
+    }
+
+    /* Buffers, allocated once */
+    if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+    if (NULL == (buf_out = malloc((size_t)compressBound((uLong)(CHUNK_SIZE * sizeof(int))))))
+        goto badness;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* A worker that died shows up as a failed write, not a signal */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Start the workers before touching HDF5 in this process */
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        goto badness;
+    }
+    for (int i = 0; i < n_workers; i++) {
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            perror("fork");
+            goto badness;
+        }
+        if (0 == pid) {
+            /* The writer decides when to stop. We finish what it sealed. */
+            signal(SIGINT, SIG_IGN);
+            signal(SIGTERM, SIG_IGN);
+            close(fds[1]);
+
+            lower_priority();
+
+            if (run_worker(fds[0]) < 0) {
+                fflush(stdout);
+                _exit(EXIT_FAILURE);
+            }
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+
+        pids[n_started++] = pid;
+    }
+    close(fds[0]);
+    fds[0] = -1;
+
+    /* Set up the catalog */
+    if (setup_catalog(chunks_per_segment) < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE (%ld workers)\n", n_workers);
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+    fflush(stdout);
+
+    /* Number of chunks written, over all segments */
+    uint64_t n_chunks = 0;
+
+    while (!stop) {
+        char file_name[NAME_LEN];
+
+        snprintf(file_name, sizeof(file_name), SEGMENT_FILE_FORMAT, segment);
+
+        if (setup_segment(file_name, chunks_per_segment) < 0)
+            goto badness;
+        if ((fid = H5Fopen(file_name, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+        if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+
+        for (hsize_t chunk = 0; chunk < chunks_per_segment && !stop; chunk++) {
+            /* Chunks are numbered across segments, so the data runs on */
+            if (direct_write(did, chunk * CHUNK_SIZE, n_chunks, buf, buf_out) < 0)
+                goto badness;
+
+            n_chunks += 1;
+
+            usleep((useconds_t)(1000000 / chunks_per_second));
+        }
+
+        /* Seal it and hand it over */
+        if (H5Dclose(did) < 0)
+            goto badness;
+        did = H5I_INVALID_HID;
+        if (H5Fclose(fid) < 0)
+            goto badness;
+        fid = H5I_INVALID_HID;
+
+        while (write(fds[1], &segment, sizeof(segment)) < 0)
+            if (EINTR != errno) {
+                fprintf(stderr, "workers have gone away\n");
+                goto badness;
+            }
+
+        printf("segment %d sealed at level %d (%llu chunks so far)\n", segment, LIVE_LEVEL,
+               (unsigned long long)n_chunks);
+        fflush(stdout);
+
+        segment++;
+        if (segment == INT_MAX)
+            break;
+    }
+
+    /* Let the workers finish what was sealed and wait for them */
+    close(fds[1]);
+    fds[1] = -1;
+    if (wait_for_workers(pids, n_started) < 0) {
+        n_started = 0;
+        goto badness;
+    }
+
+    free(buf);
+    free(buf_out);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    /* The workers still finish what was sealed */
+    if (fds[0] >= 0)
+        close(fds[0]);
+    if (fds[1] >= 0)
+        close(fds[1]);
+    wait_for_workers(pids, n_started);
+
+    free(buf);
+    free(buf_out);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
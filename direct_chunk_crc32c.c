@@ -0,0 +1,752 @@
+/* direct_chunk_crc32c.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version records a CRC32C of each chunk's stored (compressed)
+ * bytes in a side dataset and can verify a file against it using
+ * several threads
+ *
+ * To build:
+ *      h5cc -O2 -o crc32c direct_chunk_crc32c.c -lm -lz -lpthread
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ * - Uses the SSE4.2 (x86-64) or ARMv8 CRC32 instructions when the CPU
+ *   has them and a table-driven version when it doesn't. The choice is
+ *   made at run time, so no special compiler flags are needed.
+ *
+ * To run:
+ *      ./crc32c
+ *          - It will generate one 10-integer chunk per second
+ *          - ctrl-c stops the program
+ *
+ *      ./crc32c verify [n_threads]
+ *          - Checks every chunk in the file against its stored CRC
+ *          - Can be run on a file that's still being written (SWMR)
+ *
+ * The checksums live in a separate dataset (data_crc32c), one uint32
+ * per chunk, indexed by chunk number. Unlike the Fletcher-32 filter this
+ * doesn't change the chunks themselves, so readers that know nothing
+ * about the side dataset still read the data as usual.
+ */
+
+#include <hdf5.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_crc32c.h5";
+const char *DSET_NAME = "data";
+const char *CRC_DSET_NAME = "data_crc32c";
+
+#define RANK 1
+
+/* SO SMALL - Don't make chunks this size in real code! */
+const hsize_t CHUNK_SIZE = 10;
+
+/* Number of checksums per chunk of the side dataset */
+const hsize_t CRC_CHUNK_SIZE = 1024;
+
+/* What a checksum slot holds before its checksum is written. A real
+ * checksum of 0 is indistinguishable from this, so the verifier skips
+ * those (about one chunk in four billion).
+ */
+const uint32_t CRC_FILL = 0;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+#define MAX_THREADS 64
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+/**********/
+/* CRC32C */
+/**********/
+
+/* Castagnoli polynomial, bit-reflected */
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_table[256];
+
+/* Portable fallback, one byte at a time */
+static uint32_t
+crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len--)
+        crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+
+    /* Eight bytes per instruction, then mop up the tail */
+    while (len >= 8) {
+        uint64_t word;
+
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (len--)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+
+static int
+crc32c_hw_available(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc"))) static uint32_t
+crc32c_hw(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len >= 8) {
+        uint64_t word;
+
+        memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len--)
+        crc = __crc32cb(crc, *p++);
+
+    return crc;
+}
+
+static int
+crc32c_hw_available(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#else
+#define crc32c_hw crc32c_sw
+
+static int
+crc32c_hw_available(void)
+{
+    return 0;
+}
+#endif
+
+/* Picked once in crc32c_init() */
+static uint32_t (*crc32c_impl)(uint32_t, const unsigned char *, size_t) = crc32c_sw;
+
+void
+crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        crc32c_table[i] = crc;
+    }
+
+    if (crc32c_hw_available())
+        crc32c_impl = crc32c_hw;
+}
+
+/* CRC32C of a whole buffer (the usual ~0 in, ~0 out convention) */
+uint32_t
+crc32c(const void *buf, size_t len)
+{
+    return ~crc32c_impl(~0u, (const unsigned char *)buf, len);
+}
+
+/**********/
+/* Writer */
+/**********/
+
+/* Creates a 1-D unlimited chunked dataset */
+hid_t
+create_dataset(hid_t fid, const char *name, hid_t type_id, hsize_t chunk_size, int compress, const void *fill)
+{
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {chunk_size};
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (compress && H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, type_id, fill) < 0)
+        goto badness;
+
+    if ((did = H5Dcreate2(fid, name, type_id, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+
+    return did;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+    }
+    H5E_END_TRY;
+
+    return H5I_INVALID_HID;
+}
+
+herr_t
+setup(void)
+{
+    hid_t    fapl_id  = H5I_INVALID_HID;
+    hid_t    fid      = H5I_INVALID_HID;
+    hid_t    did      = H5I_INVALID_HID;
+    hid_t    crc_did  = H5I_INVALID_HID;
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Data and its checksums */
+    if ((did = create_dataset(fid, DSET_NAME, H5T_NATIVE_INT, CHUNK_SIZE, 1, &FILL_VALUE)) == H5I_INVALID_HID)
+        goto badness;
+    if ((crc_did = create_dataset(fid, CRC_DSET_NAME, H5T_NATIVE_UINT32, CRC_CHUNK_SIZE, 0, &CRC_FILL)) ==
+        H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Dclose(crc_did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Dclose(did);
+        H5Dclose(crc_did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/* Stores the checksum of chunk chunk_index in the side dataset, which must
+ * already be large enough
+ */
+herr_t
+write_crc(hid_t crc_did, hsize_t chunk_index, uint32_t crc)
+{
+    hid_t   fsid     = H5I_INVALID_HID;
+    hid_t   msid     = H5I_INVALID_HID;
+    hsize_t one[RANK] = {1};
+
+    if ((fsid = H5Dget_space(crc_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sselect_hyperslab(fsid, H5S_SELECT_SET, &chunk_index, NULL, one, NULL) < 0)
+        goto badness;
+    if ((msid = H5Screate_simple(RANK, one, NULL)) == H5I_INVALID_HID)
+        goto badness;
+
+    if (H5Dwrite(crc_did, H5T_NATIVE_UINT32, msid, fsid, H5P_DEFAULT, &crc) < 0)
+        goto badness;
+
+    if (H5Sclose(fsid) < 0)
+        goto badness;
+    if (H5Sclose(msid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(fsid);
+        H5Sclose(msid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+direct_write(hid_t did, hid_t crc_did, hsize_t offset)
+{
+    int     *buf     = NULL;
+    int     *buf_out = NULL;
+    size_t   buf_size;
+    size_t   buf_out_size;
+    uint32_t filter_mask = 0; /* We're not skipping any filters */
+    int      value;           /* The data value we're writing to the buffer */
+
+    /* Buffer sizes
+     * The output buffer has to be larger than the input buffer in case
+     * the compression is inefficient. The compress2() docs give a formula
+     * to determine the minimum size.
+     */
+    buf_size     = CHUNK_SIZE * sizeof(int);
+    buf_out_size = (size_t)ceil(buf_size * 1.001) + 12;
+
+    /* For synthetic data, we just fill the chunk with the chunk number.
+     * That should make it easy to spot screwups.
+     */
+    if (offset / CHUNK_SIZE > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+    value = (int)(offset / CHUNK_SIZE);
+    if (NULL == (buf = malloc(buf_size)))
+        goto badness;
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+        buf[i] = value;
+
+    if (NULL == (buf_out = calloc(buf_out_size, sizeof(char))))
+        goto badness;
+
+    /* Compress the data using zlib */
+    uLongf z_destLen = (uLongf)buf_out_size;
+    int    z_ret     = compress2((Bytef *)buf_out, &z_destLen, (const Bytef *)buf, (uLong)buf_size,
+                                 COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    /* Check to make sure the compressed buffer size isn't bigger than the
+     * chunk size.
+     */
+    if (z_destLen > buf_size) {
+        fprintf(stderr, "can't write chunk data that is larger than the chunk\n");
+        fprintf(stderr, "in: %zu   out: %lu\n", buf_size, (unsigned long)z_destLen);
+        goto badness;
+    }
+
+    /* Write the checksum, then the compressed data to the chunk. Only the
+     * compressed bytes are stored, so that's exactly what the checksum
+     * covers. Checksum first means a SWMR verifier normally never finds
+     * a chunk without one.
+     */
+    if (write_crc(crc_did, offset / CHUNK_SIZE, crc32c(buf_out, (size_t)z_destLen)) < 0)
+        goto badness;
+
+    if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, (size_t)z_destLen, (void *)buf_out) < 0)
+        goto badness;
+
+    free(buf);
+    free(buf_out);
+
+    return SUCCEED;
+
+badness:
+    free(buf);
+    free(buf_out);
+    return FAIL;
+}
+
+herr_t
+run_writer(void)
+{
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+    hid_t crc_did = H5I_INVALID_HID;
+
+    /* Set up file and datasets */
+    if (setup() < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE\n");
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((crc_did = H5Dopen2(fid, CRC_DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+
+    while (!stop) {
+
+        /* Extend by one chunk
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+
+        /* The write offset where we'll be scribbling our data */
+        hsize_t write_offset = n_chunks * CHUNK_SIZE;
+
+        /* The new size of the dataset after we extend */
+        hsize_t new_size = (n_chunks + 1) * CHUNK_SIZE;
+
+        if (extend_dataset(did, new_size) < 0)
+            goto badness;
+        if (extend_dataset(crc_did, n_chunks + 1) < 0)
+            goto badness;
+
+        if (direct_write(did, crc_did, write_offset) < 0)
+            goto badness;
+
+        n_chunks += 1;
+
+        sleep(1);
+    }
+
+    if (H5Dclose(crc_did) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(crc_did);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/************/
+/* Verifier */
+/************/
+
+/* State shared by the verifier threads
+ *
+ * The HDF5 library isn't thread-safe, so the chunk reads go through
+ * h5_mutex. The checksums are computed outside the lock, which is where
+ * the threads get their parallelism.
+ */
+typedef struct {
+    pthread_mutex_t h5_mutex;
+    hid_t           did;
+    const uint32_t *crcs;     /* Expected checksum of each chunk */
+    hsize_t         n_chunks;
+    hsize_t         next;     /* Next chunk to check (under h5_mutex) */
+    int             failed;   /* An HDF5 call failed (under h5_mutex) */
+    hsize_t         n_bad;    /* Checksum mismatches (under h5_mutex) */
+    hsize_t         n_missing; /* Chunks never written (under h5_mutex) */
+    hsize_t         n_pending; /* Chunks with no checksum yet (under h5_mutex) */
+    size_t          n_bytes;  /* Bytes checked (under h5_mutex) */
+} verifier_t;
+
+void *
+verify_thread(void *_v)
+{
+    verifier_t    *v        = (verifier_t *)_v;
+    unsigned char *buf      = NULL;
+    size_t         buf_size = 0;
+
+    for (;;) {
+        hsize_t  chunk_index;
+        hsize_t  offset;
+        hsize_t  storage_size = 0;
+        uint32_t filter_mask  = 0;
+        herr_t   ret          = SUCCEED;
+
+        pthread_mutex_lock(&v->h5_mutex);
+
+        if (v->failed || v->next >= v->n_chunks) {
+            pthread_mutex_unlock(&v->h5_mutex);
+            break;
+        }
+        chunk_index = v->next++;
+        offset      = chunk_index * CHUNK_SIZE;
+
+        /* SWMR doesn't promise the two datasets become visible in the
+         * order they were written, so a chunk can turn up before its
+         * checksum does. Nothing to check it against yet.
+         */
+        if (CRC_FILL == v->crcs[chunk_index]) {
+            v->n_pending++;
+            pthread_mutex_unlock(&v->h5_mutex);
+            continue;
+        }
+
+        /* Chunks that haven't been written report an error here, so
+         * check whether the chunk exists first
+         */
+        H5E_BEGIN_TRY
+        {
+            ret = H5Dget_chunk_storage_size(v->did, &offset, &storage_size);
+        }
+        H5E_END_TRY;
+        if (ret < 0 || 0 == storage_size) {
+            v->n_missing++;
+            pthread_mutex_unlock(&v->h5_mutex);
+            continue;
+        }
+
+        if (storage_size > buf_size) {
+            unsigned char *tmp = realloc(buf, (size_t)storage_size);
+
+            if (NULL == tmp) {
+                v->failed = 1;
+                pthread_mutex_unlock(&v->h5_mutex);
+                break;
+            }
+            buf      = tmp;
+            buf_size = (size_t)storage_size;
+        }
+
+        if (H5Dread_chunk(v->did, H5P_DEFAULT, &offset, &filter_mask, buf) < 0) {
+            v->failed = 1;
+            pthread_mutex_unlock(&v->h5_mutex);
+            break;
+        }
+
+        pthread_mutex_unlock(&v->h5_mutex);
+
+        /* Outside the lock */
+        uint32_t crc = crc32c(buf, (size_t)storage_size);
+
+        pthread_mutex_lock(&v->h5_mutex);
+        v->n_bytes += (size_t)storage_size;
+        if (crc != v->crcs[chunk_index]) {
+            v->n_bad++;
+            fprintf(stderr, "chunk %llu: CRC32C mismatch (stored %08x, computed %08x)\n",
+                    (unsigned long long)chunk_index, v->crcs[chunk_index], crc);
+        }
+        pthread_mutex_unlock(&v->h5_mutex);
+    }
+
+    free(buf);
+
+    return NULL;
+}
+
+herr_t
+run_verifier(int n_threads)
+{
+    hid_t      fid     = H5I_INVALID_HID;
+    hid_t      did     = H5I_INVALID_HID;
+    hid_t      crc_did = H5I_INVALID_HID;
+    hid_t      sid     = H5I_INVALID_HID;
+    uint32_t  *crcs    = NULL;
+    pthread_t  threads[MAX_THREADS];
+    int        n_started = 0;
+    verifier_t v;
+    hsize_t    dims[RANK];
+    hsize_t    n_crcs;
+
+    memset(&v, 0, sizeof(v));
+    pthread_mutex_init(&v.h5_mutex, NULL);
+
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((crc_did = H5Dopen2(fid, CRC_DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Read all the checksums. The writer extends both datasets, then
+     * writes the checksum and then the chunk, so a live file can have
+     * checksums for chunks that aren't written yet (counted as missing).
+     * A slot can also still hold CRC_FILL if the chunk's checksum isn't
+     * visible yet; those are counted as pending, not as mismatches.
+     */
+    if ((sid = H5Dget_space(crc_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sget_simple_extent_dims(sid, dims, NULL) < 0)
+        goto badness;
+    n_crcs = dims[0];
+    if (NULL == (crcs = malloc((size_t)(n_crcs ? n_crcs : 1) * sizeof(uint32_t))))
+        goto badness;
+    if (n_crcs && H5Dread(crc_did, H5T_NATIVE_UINT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, crcs) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    sid = H5I_INVALID_HID;
+
+    /* Only check chunks that have a checksum */
+    if ((sid = H5Dget_space(did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sget_simple_extent_dims(sid, dims, NULL) < 0)
+        goto badness;
+    v.n_chunks = dims[0] / CHUNK_SIZE;
+    if (v.n_chunks > n_crcs)
+        v.n_chunks = n_crcs;
+
+    v.did  = did;
+    v.crcs = crcs;
+
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_create(&threads[i], NULL, verify_thread, &v) != 0)
+            break;
+        n_started++;
+    }
+    for (int i = 0; i < n_started; i++)
+        pthread_join(threads[i], NULL);
+
+    if (0 == n_started || v.failed)
+        goto badness;
+
+    printf("%llu chunks (%zu bytes) checked with %d threads: %llu bad, %llu missing, %llu pending\n",
+           (unsigned long long)v.n_chunks, v.n_bytes, n_started, (unsigned long long)v.n_bad,
+           (unsigned long long)v.n_missing, (unsigned long long)v.n_pending);
+
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Dclose(crc_did) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    free(crcs);
+    pthread_mutex_destroy(&v.h5_mutex);
+
+    return v.n_bad ? FAIL : SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+        H5Dclose(crc_did);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    free(crcs);
+    pthread_mutex_destroy(&v.h5_mutex);
+
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+
+    crc32c_init();
+
+    if (argc > 1 && !strcmp(argv[1], "verify")) {
+        int n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (argc > 2)
+            n_threads = atoi(argv[2]);
+        if (n_threads < 1)
+            n_threads = 1;
+        if (n_threads > MAX_THREADS)
+            n_threads = MAX_THREADS;
+
+        if (run_verifier(n_threads) < 0)
+            goto badness;
+
+        printf("VERIFIED\n");
+
+        return EXIT_SUCCESS;
+    }
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    printf("CRC32C: %s\n", crc32c_impl == crc32c_sw ? "software" : "hardware");
+
+    if (run_writer() < 0)
+        goto badness;
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
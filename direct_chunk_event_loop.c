@@ -0,0 +1,1770 @@
+/* direct_chunk_event_loop.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version is built around a single epoll event loop instead of a
+ * sleep loop. One I/O thread waits on:
+ *
+ *      - a signalfd for SIGINT, SIGTERM and SIGHUP
+ *      - a timerfd that paces the synthetic data source
+ *      - a timerfd that flushes the file
+ *      - an eventfd the compression threads poke when chunks are done
+ *      - a Unix datagram socket other processes send data to
+ *      - a Unix stream socket for control commands, and its clients
+ *
+ * and is the only thread that calls HDF5. Nothing polls, and a burst of
+ * finished chunks costs one wakeup.
+ *
+ * To build:
+ *      h5cc -O2 -o event_loop direct_chunk_event_loop.c -lm -lz -lpthread
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require Linux (epoll, signalfd, timerfd, eventfd)
+ *
+ * To run:
+ *      ./event_loop [config_file]
+ *
+ *      - Stream 0 gets synthetic 1024-integer chunks, one per second by
+ *        default
+ *      - Every stream (including 0) also takes data from the ingest
+ *        socket, which the feed mode below writes to
+ *      - SIGHUP reloads the configuration file (see below)
+ *      - ctrl-c (or SIGTERM) stops the program. Partly filled chunks are
+ *        written out, padded with the fill value, but the dataset extents
+ *        only cover the real data.
+ *
+ *      ./event_loop ctl <command>
+ *
+ *      - Sends a command to a running writer's control socket and
+ *        prints the reply (see below)
+ *
+ *      ./event_loop feed [stream] [n_chunks]
+ *
+ *      - Sends n_chunks (default 10) chunks' worth of data for a stream
+ *        (default 1) to a running writer, in 256-integer datagrams
+ *
+ * Configuration:
+ *
+ *      The config file (default direct_chunk_event_loop.conf) holds
+ *      "key = value" lines:
+ *
+ *          level = 5                # deflate level, 0-9
+ *          codec = deflate          # or none (stored raw)
+ *          threads = 2              # compression threads
+ *          flush_interval_ms = 5000 # 0 = no periodic flushes
+ *          rate = 1                 # synthetic chunks per second, 0 = off
+ *
+ *      Missing keys get the defaults shown. SIGHUP rereads the file and
+ *      applies it without closing the file or dropping any data. A new
+ *      level or codec takes effect at the next chunk each stream submits
+ *      (chunks already submitted keep the settings they were submitted
+ *      with). A file that doesn't parse is ignored.
+ *
+ * Control socket:
+ *
+ *      The writer listens on a Unix stream socket
+ *      (direct_chunk_event_loop.ctl) for one-line commands and answers
+ *      each with one line of JSON:
+ *
+ *          stats           counters, settings and per-stream progress
+ *                          (chunks and elements in the current file)
+ *          flush-now       flush the file right away
+ *          rotate-file     write everything in flight, close the file and
+ *                          carry on in direct_chunk_event_loop.N.h5
+ *          pause, resume   stop and restart reading input. Senders block
+ *                          while paused and synthetic chunks are skipped.
+ *          set-level N     deflate level for chunks submitted from now on
+ *                          (until the next SIGHUP reload)
+ *
+ * Ingest datagrams are a uint32_t stream number followed by native ints.
+ * Each stream has its own dataset (data_0, data_1, ...) and fills its
+ * chunks in the order datagrams arrive.
+ */
+
+#include <hdf5.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+const char *FILE_NAME       = "direct_chunk_event_loop.h5";
+const char *ROTATED_FMT     = "direct_chunk_event_loop.%d.h5";
+const char *DSET_NAME_FMT   = "data_%d";
+const char *INGEST_SOCKET   = "direct_chunk_event_loop.sock";
+const char *CONTROL_SOCKET  = "direct_chunk_event_loop.ctl";
+const char *CONFIG_FILE     = "direct_chunk_event_loop.conf";
+
+#define RANK 1
+
+#define N_STREAMS 4
+
+const hsize_t CHUNK_SIZE = 1024;
+
+/* The level recorded in the dcpl. The level chunks are actually
+ * compressed at comes from the configuration.
+ */
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+#define MAX_WORKERS 16
+
+/* Stop reading input while this many chunks are being compressed or
+ * waiting to be written
+ */
+const uint64_t MAX_INFLIGHT = 64;
+
+/* Values per datagram sent by feed mode, and the largest datagram the
+ * writer accepts
+ */
+#define FEED_VALUES   256
+#define MAX_DATAGRAM  (64 * 1024)
+
+/* Control socket limits. Commands are one line each. */
+#define MAX_CONTROL_CLIENTS 8
+#define MAX_COMMAND         256
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+/*****************/
+/* Configuration */
+/*****************/
+
+typedef enum {
+    CODEC_DEFLATE,
+    CODEC_NONE      /* Store raw, skipping the deflate filter */
+} codec_t;
+
+/* Everything SIGHUP can change */
+typedef struct {
+    unsigned level;
+    codec_t  codec;
+    int      threads;
+    long     flush_interval_ms; /* 0 = no periodic flushes */
+    double   rate;              /* Synthetic chunks per second, 0 = none */
+} config_t;
+
+const config_t DEFAULT_CONFIG = {5, CODEC_DEFLATE, 2, 5000, 1.0};
+
+/* Reads a file of "key = value" lines ('#' starts a comment). Keys that
+ * aren't in the file get their defaults. Nothing in *config changes
+ * unless the whole file is good.
+ */
+herr_t
+config_load(const char *path, config_t *config)
+{
+    config_t new_config = DEFAULT_CONFIG;
+    char     line[256];
+    int      lineno = 0;
+    FILE    *f      = NULL;
+
+    if (NULL == (f = fopen(path, "r")))
+        goto badness;
+
+    while (fgets(line, sizeof(line), f)) {
+        char  key[64];
+        char  value[64];
+        char *hash;
+        char *end;
+
+        lineno++;
+
+        if (NULL != (hash = strchr(line, '#')))
+            *hash = '\0';
+        if (strspn(line, " \t\r\n") == strlen(line))
+            continue;
+
+        if (2 != sscanf(line, " %63[a-z_] = %63s", key, value)) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, lineno);
+            goto badness;
+        }
+
+        errno = 0;
+        if (!strcmp(key, "level")) {
+            long level = strtol(value, &end, 10);
+
+            if (*end || level < 0 || level > 9)
+                goto bad_value;
+            new_config.level = (unsigned)level;
+        }
+        else if (!strcmp(key, "codec")) {
+            if (!strcmp(value, "deflate"))
+                new_config.codec = CODEC_DEFLATE;
+            else if (!strcmp(value, "none"))
+                new_config.codec = CODEC_NONE;
+            else
+                goto bad_value;
+        }
+        else if (!strcmp(key, "threads")) {
+            long threads = strtol(value, &end, 10);
+
+            if (*end || threads < 1 || threads > MAX_WORKERS)
+                goto bad_value;
+            new_config.threads = (int)threads;
+        }
+        else if (!strcmp(key, "flush_interval_ms")) {
+            long ms = strtol(value, &end, 10);
+
+            if (*end || errno || ms < 0)
+                goto bad_value;
+            new_config.flush_interval_ms = ms;
+        }
+        else if (!strcmp(key, "rate")) {
+            double rate = strtod(value, &end);
+
+            if (*end || errno || !(rate >= 0.0) || rate > 1000.0)
+                goto bad_value;
+            new_config.rate = rate;
+        }
+        else {
+            fprintf(stderr, "%s:%d: unknown key %s\n", path, lineno, key);
+            goto badness;
+        }
+
+        continue;
+
+bad_value:
+        fprintf(stderr, "%s:%d: bad value for %s: %s\n", path, lineno, key, value);
+        goto badness;
+    }
+
+    if (ferror(f))
+        goto badness;
+
+    fclose(f);
+
+    *config = new_config;
+
+    return SUCCEED;
+
+badness:
+    if (f)
+        fclose(f);
+    return FAIL;
+}
+
+void
+config_print(const char *what, const config_t *config)
+{
+    printf("%s: level=%u codec=%s threads=%d flush_interval_ms=%ld rate=%g\n", what, config->level,
+           CODEC_NONE == config->codec ? "none" : "deflate", config->threads, config->flush_interval_ms,
+           config->rate);
+}
+
+/********/
+/* Jobs */
+/********/
+
+/* One chunk on its way from a stream's staging buffer to the file */
+typedef struct job_t {
+    struct job_t *next;
+
+    int     stream;
+    hsize_t offset;  /* Element offset of the chunk */
+    hsize_t n_valid; /* Elements of real data (< CHUNK_SIZE only at shutdown) */
+
+    int *raw;
+
+    void    *out;
+    size_t   out_size;
+    uint32_t filter_mask;
+
+    unsigned level;
+    codec_t  codec;
+    int      failed;
+} job_t;
+
+void
+job_free(job_t *job)
+{
+    if (job->out != job->raw)
+        free(job->out);
+    free(job->raw);
+    free(job);
+}
+
+/* Fills in out, out_size and filter_mask */
+herr_t
+compress_job(job_t *job)
+{
+    size_t buf_size  = CHUNK_SIZE * sizeof(int);
+    uLongf z_destLen = compressBound((uLong)buf_size);
+    void  *out       = NULL;
+
+    /* Store raw and tell HDF5 the deflate filter (the first and only one)
+     * was skipped
+     */
+    if (CODEC_NONE == job->codec) {
+        job->out         = job->raw;
+        job->out_size    = buf_size;
+        job->filter_mask = 0x1;
+        return SUCCEED;
+    }
+
+    if (NULL == (out = malloc((size_t)z_destLen)))
+        goto badness;
+
+    /* Compress the data using zlib */
+    int z_ret = compress2((Bytef *)out, &z_destLen, (const Bytef *)job->raw, (uLong)buf_size, (int)job->level);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    if (z_destLen < buf_size) {
+        job->out         = out;
+        job->out_size    = (size_t)z_destLen;
+        job->filter_mask = 0;
+    }
+    else {
+        /* Incompressible, so store the raw data and tell HDF5 the deflate
+         * filter (the first and only one) was skipped
+         */
+        free(out);
+        job->out         = job->raw;
+        job->out_size    = buf_size;
+        job->filter_mask = 0x1;
+    }
+
+    return SUCCEED;
+
+badness:
+    free(out);
+    return FAIL;
+}
+
+/***************/
+/* Worker pool */
+/***************/
+
+/* Jobs go in todo, the workers compress them and move them to done, and
+ * bump done_fd so the event loop wakes up to write them.
+ *
+ * The pool can be resized while it runs. Workers whose slot is at or
+ * above n_target finish their current job and exit.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+
+    job_t *todo_head;
+    job_t *todo_tail;
+    job_t *done_head;
+    job_t *done_tail;
+
+    int closing;
+    int done_fd;
+
+    pthread_t threads[MAX_WORKERS];
+    int       started[MAX_WORKERS]; /* Has a thread that hasn't been joined */
+    int       exited[MAX_WORKERS];  /* ...which has returned */
+    int       n_target;
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    int     slot;
+} worker_arg_t;
+
+static void
+list_push(job_t **head, job_t **tail, job_t *job)
+{
+    job->next = NULL;
+    if (*tail)
+        (*tail)->next = job;
+    else
+        *head = job;
+    *tail = job;
+}
+
+void *
+worker_thread(void *_arg)
+{
+    pool_t  *pool = ((worker_arg_t *)_arg)->pool;
+    int      slot = ((worker_arg_t *)_arg)->slot;
+    uint64_t one  = 1;
+
+    free(_arg);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        job_t *job;
+
+        while (!pool->todo_head && !pool->closing && slot < pool->n_target)
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+
+        /* Deciding to exit and saying so happen under the same lock, so
+         * pool_resize() never sees a worker that is about to leave as
+         * still running
+         */
+        if (slot >= pool->n_target || !pool->todo_head)
+            break;
+
+        job = pool->todo_head;
+        if (NULL == (pool->todo_head = job->next))
+            pool->todo_tail = NULL;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (compress_job(job) < 0)
+            job->failed = 1;
+
+        pthread_mutex_lock(&pool->mutex);
+        list_push(&pool->done_head, &pool->done_tail, job);
+
+        /* eventfd adds up the writes, so several completions before the
+         * event loop gets round to them still mean one wakeup
+         */
+        if (write(pool->done_fd, &one, sizeof(one)) < 0)
+            perror("write eventfd");
+    }
+    pool->exited[slot] = 1;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/* Grows or shrinks the pool to n_threads workers. Jobs already queued
+ * aren't affected: whoever is left picks them up.
+ */
+herr_t
+pool_resize(pool_t *pool, int n_threads)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    pool->n_target = n_threads;
+    pthread_cond_broadcast(&pool->cond);
+
+    for (int i = 0; i < n_threads; i++) {
+        worker_arg_t *arg;
+
+        /* Still running, and now it will stay */
+        if (pool->started[i] && !pool->exited[i])
+            continue;
+
+        if (pool->started[i]) {
+            pthread_join(pool->threads[i], NULL);
+            pool->started[i] = 0;
+        }
+
+        if (NULL == (arg = malloc(sizeof(worker_arg_t))))
+            goto badness;
+        arg->pool = pool;
+        arg->slot = i;
+
+        pool->exited[i] = 0;
+        if (0 != pthread_create(&pool->threads[i], NULL, worker_thread, arg)) {
+            free(arg);
+            goto badness;
+        }
+        pool->started[i] = 1;
+    }
+
+    pthread_mutex_unlock(&pool->mutex);
+
+    return SUCCEED;
+
+badness:
+    pthread_mutex_unlock(&pool->mutex);
+    return FAIL;
+}
+
+herr_t
+pool_start(pool_t *pool, int n_threads)
+{
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    if ((pool->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+        return FAIL;
+
+    return pool_resize(pool, n_threads);
+}
+
+void
+pool_submit(pool_t *pool, job_t *job)
+{
+    pthread_mutex_lock(&pool->mutex);
+    list_push(&pool->todo_head, &pool->todo_tail, job);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/* Takes the whole done list */
+job_t *
+pool_take_done(pool_t *pool)
+{
+    job_t *jobs;
+
+    pthread_mutex_lock(&pool->mutex);
+    jobs            = pool->done_head;
+    pool->done_head = NULL;
+    pool->done_tail = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+
+    return jobs;
+}
+
+void
+pool_stop(pool_t *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->closing = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < MAX_WORKERS; i++)
+        if (pool->started[i])
+            pthread_join(pool->threads[i], NULL);
+
+    /* Anything left over was never written */
+    for (job_t *job = pool->todo_head, *next; job; job = next) {
+        next = job->next;
+        job_free(job);
+    }
+    for (job_t *job = pool->done_head, *next; job; job = next) {
+        next = job->next;
+        job_free(job);
+    }
+
+    if (pool->done_fd >= 0)
+        close(pool->done_fd);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+}
+
+/**************/
+/* Event loop */
+/**************/
+
+struct loop_t;
+
+/* Something the event loop waits on. epoll hands back a pointer to it. */
+typedef struct source_t {
+    int      fd;
+    uint32_t events;
+    herr_t (*handler)(struct loop_t *loop, struct source_t *src);
+} source_t;
+
+typedef struct {
+    hid_t   did;
+    int    *staging;   /* The chunk being filled */
+    hsize_t n_staged;  /* Elements in staging */
+    hsize_t next;      /* Offset of the next chunk to submit */
+    hsize_t extent;    /* Current dataset size */
+    uint64_t n_written; /* Chunks written to the current file */
+} stream_t;
+
+typedef struct loop_t {
+    int epfd;
+
+    source_t signals;
+    source_t pacer;
+    source_t flusher;
+    source_t completions;
+    source_t ingest;
+
+    pool_t pool;
+
+    const char *config_path;
+    config_t    config;
+
+    source_t                control;
+    struct control_client_t *clients;
+    int                     n_clients;
+
+    char     file_name[64];
+    int      file_index;  /* Times the file has been rotated */
+    hid_t    fid;
+    stream_t streams[N_STREAMS];
+
+    uint64_t inflight;    /* Submitted, not yet written */
+    int      throttled;   /* Too much in flight */
+    int      paused;      /* Told to pause over the control socket */
+    int      inputs_on;   /* Input sources are in the epoll set */
+    int      stopping;
+
+    uint64_t n_synthetic; /* Synthetic chunks generated */
+    uint64_t n_datagrams;
+    uint64_t n_flushes;
+} loop_t;
+
+herr_t
+loop_add(loop_t *loop, source_t *src)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = src->events;
+    ev.data.ptr = src;
+
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0 ? FAIL : SUCCEED;
+}
+
+/* Stops waiting on a source without closing it (events = 0) or starts
+ * again
+ */
+herr_t
+loop_mod(loop_t *loop, source_t *src, uint32_t events)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = events;
+    ev.data.ptr = src;
+
+    return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, src->fd, &ev) < 0 ? FAIL : SUCCEED;
+}
+
+void
+loop_remove(loop_t *loop, source_t *src)
+{
+    if (src->fd < 0)
+        return;
+
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, src->fd, NULL);
+    close(src->fd);
+    src->fd = -1;
+}
+
+/* Reads a timerfd or eventfd counter */
+uint64_t
+read_counter(int fd)
+{
+    uint64_t count = 0;
+
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+
+    return count;
+}
+
+/* Switches the input sources on or off, depending on whether we're
+ * throttled or paused
+ */
+herr_t
+loop_update_inputs(loop_t *loop)
+{
+    int       on       = !loop->throttled && !loop->paused;
+    source_t *inputs[] = {&loop->pacer, &loop->ingest};
+
+    if (on == loop->inputs_on)
+        return SUCCEED;
+
+    /* Don't catch up on synthetic chunks we missed while the inputs were
+     * off, whether paused or throttled. Replaying them would just put
+     * the backlog straight back in flight.
+     */
+    if (on && loop->pacer.fd >= 0)
+        read_counter(loop->pacer.fd);
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+        if (inputs[i]->fd >= 0 && loop_mod(loop, inputs[i], on ? inputs[i]->events : 0) < 0)
+            return FAIL;
+
+    loop->inputs_on = on;
+
+    return SUCCEED;
+}
+
+/* Switches the input sources off while too much is in flight, and back
+ * on when the backlog has drained to half
+ */
+herr_t
+loop_throttle(loop_t *loop)
+{
+    if (loop->throttled)
+        loop->throttled = loop->inflight > MAX_INFLIGHT / 2;
+    else
+        loop->throttled = loop->inflight >= MAX_INFLIGHT;
+
+    return loop_update_inputs(loop);
+}
+
+/* Arms a periodic timerfd, or disarms it if interval_ns is 0 */
+herr_t
+set_timer(int fd, long long interval_ns)
+{
+    struct itimerspec its;
+
+    its.it_interval.tv_sec  = (time_t)(interval_ns / 1000000000LL);
+    its.it_interval.tv_nsec = (long)(interval_ns % 1000000000LL);
+    its.it_value            = its.it_interval;
+
+    return timerfd_settime(fd, 0, &its, NULL) < 0 ? FAIL : SUCCEED;
+}
+
+/***********/
+/* Streams */
+/***********/
+
+/* Hands a stream's staging buffer to the workers */
+herr_t
+submit_chunk(loop_t *loop, int stream)
+{
+    stream_t *s   = &loop->streams[stream];
+    job_t    *job = NULL;
+
+    if (NULL == (job = calloc(1, sizeof(job_t))))
+        goto badness;
+
+    /* Pad a partial chunk out with the fill value */
+    for (hsize_t i = s->n_staged; i < CHUNK_SIZE; i++)
+        s->staging[i] = FILL_VALUE;
+
+    job->stream  = stream;
+    job->offset  = s->next;
+    job->n_valid = s->n_staged;
+    job->raw     = s->staging;
+
+    /* Settings are picked up here, one whole chunk at a time */
+    job->level = loop->config.level;
+    job->codec = loop->config.codec;
+
+    s->next += CHUNK_SIZE;
+    s->n_staged = 0;
+    s->staging  = NULL;
+
+    /* Don't wait for the next chunk's data to allocate its buffer */
+    if (!loop->stopping && NULL == (s->staging = malloc(CHUNK_SIZE * sizeof(int)))) {
+        free(job->raw);
+        free(job);
+        goto badness;
+    }
+
+    loop->inflight++;
+    pool_submit(&loop->pool, job);
+
+    return loop_throttle(loop);
+
+badness:
+    return FAIL;
+}
+
+herr_t
+stream_append(loop_t *loop, int stream, const int *values, size_t n)
+{
+    stream_t *s = &loop->streams[stream];
+
+    while (n) {
+        size_t m = (size_t)(CHUNK_SIZE - s->n_staged);
+
+        if (m > n)
+            m = n;
+
+        memcpy(s->staging + s->n_staged, values, m * sizeof(int));
+        s->n_staged += m;
+        values += m;
+        n -= m;
+
+        if (s->n_staged == CHUNK_SIZE && submit_chunk(loop, stream) < 0)
+            return FAIL;
+    }
+
+    return SUCCEED;
+}
+
+/************/
+/* Handlers */
+/************/
+
+herr_t
+begin_stop(loop_t *loop)
+{
+    if (loop->stopping)
+        return SUCCEED;
+
+    loop->stopping = 1;
+
+    /* No more input */
+    loop_remove(loop, &loop->pacer);
+    loop_remove(loop, &loop->ingest);
+    unlink(INGEST_SOCKET);
+
+    /* Send whatever is left over */
+    for (int i = 0; i < N_STREAMS; i++) {
+        if (loop->streams[i].n_staged) {
+            if (submit_chunk(loop, i) < 0)
+                return FAIL;
+        }
+        else {
+            free(loop->streams[i].staging);
+            loop->streams[i].staging = NULL;
+        }
+    }
+
+    return SUCCEED;
+}
+
+herr_t
+flush_file(loop_t *loop)
+{
+    if (H5Fflush(loop->fid, H5F_SCOPE_LOCAL) < 0)
+        return FAIL;
+
+    loop->n_flushes++;
+
+    return SUCCEED;
+}
+
+/* Makes a new configuration take effect. The file and datasets stay open
+ * and nothing buffered is touched: level and codec are read as each
+ * chunk is submitted, the pool resizes in the background and the timers
+ * are just re-armed.
+ */
+herr_t
+apply_config(loop_t *loop, const config_t *config, int first)
+{
+    if ((first || config->threads != loop->config.threads) && pool_resize(&loop->pool, config->threads) < 0)
+        return FAIL;
+
+    if (first || config->flush_interval_ms != loop->config.flush_interval_ms)
+        if (set_timer(loop->flusher.fd, (long long)config->flush_interval_ms * 1000000LL) < 0)
+            return FAIL;
+
+    /* The pacer is gone once we're stopping */
+    if ((first || config->rate != loop->config.rate) && loop->pacer.fd >= 0) {
+        long long interval_ns = config->rate > 0.0 ? (long long)(1e9 / config->rate) : 0;
+
+        if (set_timer(loop->pacer.fd, interval_ns) < 0)
+            return FAIL;
+    }
+
+    loop->config = *config;
+
+    return SUCCEED;
+}
+
+/* A bad or missing file leaves the running configuration alone */
+herr_t
+reload_config(loop_t *loop)
+{
+    config_t config;
+
+    if (config_load(loop->config_path, &config) < 0) {
+        fprintf(stderr, "SIGHUP: can't load %s, keeping the current configuration\n", loop->config_path);
+        return SUCCEED;
+    }
+
+    if (apply_config(loop, &config, 0) < 0)
+        return FAIL;
+
+    config_print("RELOADED", &loop->config);
+
+    return SUCCEED;
+}
+
+herr_t
+on_signal(loop_t *loop, source_t *src)
+{
+    struct signalfd_siginfo si;
+
+    while (read(src->fd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+            case SIGINT:
+            case SIGTERM:
+                if (begin_stop(loop) < 0)
+                    return FAIL;
+                break;
+
+            case SIGHUP:
+                if (reload_config(loop) < 0)
+                    return FAIL;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return SUCCEED;
+}
+
+/* For synthetic data, we just fill each chunk with the synthetic chunk
+ * number. That should make it easy to spot screwups.
+ */
+herr_t
+on_pace(loop_t *loop, source_t *src)
+{
+    uint64_t ticks = read_counter(src->fd);
+    int      buf[FEED_VALUES];
+
+    /* If we fell behind (a slow flush, say), catch up, but only while
+     * there's room in flight. Ticks left over when we get throttled are
+     * dropped, like the ones missed while the inputs are off.
+     */
+    while (ticks-- && !loop->throttled) {
+        if (loop->n_synthetic > INT_MAX) {
+            fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+            return FAIL;
+        }
+
+        for (int i = 0; i < FEED_VALUES; i++)
+            buf[i] = (int)loop->n_synthetic;
+
+        for (hsize_t i = 0; i < CHUNK_SIZE; i += FEED_VALUES)
+            if (stream_append(loop, 0, buf, FEED_VALUES) < 0)
+                return FAIL;
+
+        loop->n_synthetic++;
+    }
+
+    return SUCCEED;
+}
+
+herr_t
+on_flush_timer(loop_t *loop, source_t *src)
+{
+    read_counter(src->fd);
+
+    return flush_file(loop);
+}
+
+herr_t
+on_ingest(loop_t *loop, source_t *src)
+{
+    static int buf[MAX_DATAGRAM / sizeof(int)];
+
+    /* Don't let a flood starve the other sources */
+    for (int i = 0; i < 64; i++) {
+        ssize_t  n = recv(src->fd, buf, sizeof(buf), 0);
+        uint32_t stream;
+
+        if (n < 0)
+            return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) ? SUCCEED : FAIL;
+
+        if ((size_t)n < sizeof(uint32_t) || ((size_t)n - sizeof(uint32_t)) % sizeof(int)) {
+            fprintf(stderr, "dropping malformed datagram (%zd bytes)\n", n);
+            continue;
+        }
+
+        memcpy(&stream, buf, sizeof(stream));
+        if (stream >= N_STREAMS) {
+            fprintf(stderr, "dropping datagram for unknown stream %u\n", stream);
+            continue;
+        }
+
+        loop->n_datagrams++;
+
+        if (stream_append(loop, (int)stream, buf + 1, ((size_t)n - sizeof(uint32_t)) / sizeof(int)) < 0)
+            return FAIL;
+
+        if (!loop->inputs_on)
+            break;
+    }
+
+    return SUCCEED;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/* Writes every chunk the workers have finished */
+herr_t
+on_completions(loop_t *loop, source_t *src)
+{
+    job_t *jobs;
+
+    read_counter(src->fd);
+
+    jobs = pool_take_done(&loop->pool);
+
+    while (jobs) {
+        job_t    *job = jobs;
+        stream_t *s   = &loop->streams[job->stream];
+        hsize_t   end = job->offset + job->n_valid;
+
+        jobs = job->next;
+
+        if (job->failed)
+            goto badness;
+
+        /* Chunks can finish out of order, so only ever grow */
+        if (end > s->extent) {
+            if (extend_dataset(s->did, end) < 0)
+                goto badness;
+            s->extent = end;
+        }
+
+        /* Write the compressed data to the chunk */
+        if (H5Dwrite_chunk(s->did, H5P_DEFAULT, job->filter_mask, &job->offset, job->out_size, job->out) < 0)
+            goto badness;
+
+        s->n_written++;
+        loop->inflight--;
+        job_free(job);
+    }
+
+    return loop_throttle(loop);
+
+badness:
+    while (jobs) {
+        job_t *next = jobs->next;
+
+        job_free(jobs);
+        jobs = next;
+    }
+    return FAIL;
+}
+
+/********/
+/* HDF5 */
+/********/
+
+herr_t
+setup(const char *file_name)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(file_name, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for datasets */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create one dataset per stream */
+    for (int i = 0; i < N_STREAMS; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), DSET_NAME_FMT, i);
+        if ((did = H5Dcreate2(fid, name, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) ==
+            H5I_INVALID_HID)
+            goto badness;
+        if (H5Dclose(did) < 0)
+            goto badness;
+        did = H5I_INVALID_HID;
+    }
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+open_file(loop_t *loop)
+{
+    if ((loop->fid = H5Fopen(loop->file_name, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) ==
+        H5I_INVALID_HID)
+        goto badness;
+
+    for (int i = 0; i < N_STREAMS; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), DSET_NAME_FMT, i);
+        if ((loop->streams[i].did = H5Dopen2(loop->fid, name, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+herr_t
+close_file(loop_t *loop)
+{
+    herr_t ret = SUCCEED;
+
+    for (int i = 0; i < N_STREAMS; i++) {
+        if (loop->streams[i].did != H5I_INVALID_HID && H5Dclose(loop->streams[i].did) < 0)
+            ret = FAIL;
+        loop->streams[i].did = H5I_INVALID_HID;
+    }
+    if (loop->fid != H5I_INVALID_HID && H5Fclose(loop->fid) < 0)
+        ret = FAIL;
+    loop->fid = H5I_INVALID_HID;
+
+    return ret;
+}
+
+/******************/
+/* Control socket */
+/******************/
+
+/* A connection to the control socket. src has to come first: epoll hands
+ * back a source_t pointer.
+ */
+typedef struct control_client_t {
+    source_t                 src;
+    struct control_client_t *next;
+    char                     buf[MAX_COMMAND];
+    size_t                   len;
+} control_client_t;
+
+/* Writes everything in flight into the current file. This blocks the
+ * loop, but only for as long as the workers take to finish what they
+ * already have.
+ */
+herr_t
+drain_inflight(loop_t *loop)
+{
+    while (loop->inflight) {
+        struct pollfd pfd = {loop->pool.done_fd, POLLIN, 0};
+
+        if (poll(&pfd, 1, -1) < 0 && EINTR != errno)
+            return FAIL;
+        if (on_completions(loop, &loop->completions) < 0)
+            return FAIL;
+    }
+
+    return SUCCEED;
+}
+
+/* Closes the current file and carries on in a new one. Partly filled
+ * chunks stay staged and become the start of the new file's datasets.
+ */
+herr_t
+rotate_file(loop_t *loop)
+{
+    if (drain_inflight(loop) < 0)
+        goto badness;
+    if (close_file(loop) < 0)
+        goto badness;
+
+    loop->file_index++;
+    snprintf(loop->file_name, sizeof(loop->file_name), ROTATED_FMT, loop->file_index);
+
+    if (setup(loop->file_name) < 0)
+        goto badness;
+    if (open_file(loop) < 0)
+        goto badness;
+
+    for (int i = 0; i < N_STREAMS; i++) {
+        loop->streams[i].next      = 0;
+        loop->streams[i].extent    = 0;
+        loop->streams[i].n_written = 0;
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/* Appends to a fixed-size reply buffer, quietly truncating */
+static void
+reply_append(char *reply, size_t size, const char *fmt, ...)
+{
+    size_t  len = strlen(reply);
+    va_list ap;
+
+    if (len >= size - 1)
+        return;
+
+    va_start(ap, fmt);
+    vsnprintf(reply + len, size - len, fmt, ap);
+    va_end(ap);
+}
+
+void
+reply_stats(loop_t *loop, char *reply, size_t size)
+{
+    reply_append(reply, size,
+                 "{\"ok\":true,\"file\":\"%s\",\"paused\":%s,\"throttled\":%s,\"stopping\":%s,"
+                 "\"inflight\":%llu,\"level\":%u,\"codec\":\"%s\",\"threads\":%d,"
+                 "\"synthetic_chunks\":%llu,\"datagrams\":%llu,\"flushes\":%llu,\"streams\":[",
+                 loop->file_name, loop->paused ? "true" : "false", loop->throttled ? "true" : "false",
+                 loop->stopping ? "true" : "false", (unsigned long long)loop->inflight, loop->config.level,
+                 CODEC_NONE == loop->config.codec ? "none" : "deflate", loop->config.threads,
+                 (unsigned long long)loop->n_synthetic, (unsigned long long)loop->n_datagrams,
+                 (unsigned long long)loop->n_flushes);
+
+    for (int i = 0; i < N_STREAMS; i++)
+        reply_append(reply, size, "%s{\"chunks_written\":%llu,\"elements\":%llu,\"staged\":%llu}",
+                     i ? "," : "", (unsigned long long)loop->streams[i].n_written,
+                     (unsigned long long)loop->streams[i].extent, (unsigned long long)loop->streams[i].n_staged);
+
+    reply_append(reply, size, "]}");
+}
+
+/* Runs one command and fills in a one-line JSON reply */
+herr_t
+run_command(loop_t *loop, char *line, char *reply, size_t size)
+{
+    char *cmd;
+    char *arg;
+    char *save = NULL;
+
+    reply[0] = '\0';
+
+    if (NULL == (cmd = strtok_r(line, " \t\r", &save))) {
+        reply_append(reply, size, "{\"ok\":false,\"error\":\"empty command\"}");
+        return SUCCEED;
+    }
+    arg = strtok_r(NULL, " \t\r", &save);
+
+    if (!strcmp(cmd, "stats"))
+        reply_stats(loop, reply, size);
+    else if (!strcmp(cmd, "flush-now")) {
+        if (flush_file(loop) < 0)
+            return FAIL;
+        reply_append(reply, size, "{\"ok\":true,\"flushes\":%llu}", (unsigned long long)loop->n_flushes);
+    }
+    else if (!strcmp(cmd, "rotate-file")) {
+        if (loop->stopping)
+            reply_append(reply, size, "{\"ok\":false,\"error\":\"stopping\"}");
+        else {
+            if (rotate_file(loop) < 0)
+                return FAIL;
+            reply_append(reply, size, "{\"ok\":true,\"file\":\"%s\"}", loop->file_name);
+        }
+    }
+    else if (!strcmp(cmd, "pause") || !strcmp(cmd, "resume")) {
+        int pause = !strcmp(cmd, "pause");
+
+        loop->paused = pause;
+        if (loop_update_inputs(loop) < 0)
+            return FAIL;
+        reply_append(reply, size, "{\"ok\":true,\"paused\":%s}", pause ? "true" : "false");
+    }
+    else if (!strcmp(cmd, "set-level")) {
+        char *end   = NULL;
+        long  level = arg ? strtol(arg, &end, 10) : -1;
+
+        if (!arg || *end || level < 0 || level > 9)
+            reply_append(reply, size, "{\"ok\":false,\"error\":\"set-level needs a level from 0 to 9\"}");
+        else {
+            /* Lasts until the next SIGHUP reload */
+            loop->config.level = (unsigned)level;
+            reply_append(reply, size, "{\"ok\":true,\"level\":%u}", loop->config.level);
+        }
+    }
+    else
+        reply_append(reply, size, "{\"ok\":false,\"error\":\"unknown command\"}");
+
+    return SUCCEED;
+}
+
+void
+control_client_close(loop_t *loop, control_client_t *client)
+{
+    for (control_client_t **p = &loop->clients; *p; p = &(*p)->next)
+        if (*p == client) {
+            *p = client->next;
+            break;
+        }
+
+    loop_remove(loop, &client->src);
+    loop->n_clients--;
+    free(client);
+}
+
+herr_t
+on_control_client(loop_t *loop, source_t *src)
+{
+    control_client_t *client = (control_client_t *)src;
+    char              reply[4096];
+    char             *nl;
+    ssize_t           n;
+
+    n = read(src->fd, client->buf + client->len, sizeof(client->buf) - 1 - client->len);
+    if (n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno))
+        return SUCCEED;
+    if (n <= 0) {
+        control_client_close(loop, client);
+        return SUCCEED;
+    }
+    client->len += (size_t)n;
+    client->buf[client->len] = '\0';
+
+    while (NULL != (nl = strchr(client->buf, '\n'))) {
+        size_t len;
+
+        *nl = '\0';
+        if (run_command(loop, client->buf, reply, sizeof(reply) - 1) < 0)
+            return FAIL;
+        strcat(reply, "\n");
+
+        /* Replies are small, so a client that can't take one all at once
+         * isn't reading them
+         */
+        len = strlen(reply);
+        if (send(src->fd, reply, len, MSG_NOSIGNAL) != (ssize_t)len) {
+            control_client_close(loop, client);
+            return SUCCEED;
+        }
+
+        client->len -= (size_t)(nl + 1 - client->buf);
+        memmove(client->buf, nl + 1, client->len + 1);
+    }
+
+    if (client->len == sizeof(client->buf) - 1) {
+        fprintf(stderr, "control command too long, dropping client\n");
+        control_client_close(loop, client);
+    }
+
+    return SUCCEED;
+}
+
+herr_t
+on_control_accept(loop_t *loop, source_t *src)
+{
+    control_client_t *client;
+    int               fd;
+
+    if ((fd = accept(src->fd, NULL, NULL)) < 0)
+        return (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) ? SUCCEED : FAIL;
+    if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+        close(fd);
+        return SUCCEED;
+    }
+
+    if (loop->n_clients == MAX_CONTROL_CLIENTS || NULL == (client = calloc(1, sizeof(control_client_t)))) {
+        close(fd);
+        return SUCCEED;
+    }
+
+    client->src.fd      = fd;
+    client->src.events  = EPOLLIN;
+    client->src.handler = on_control_client;
+
+    if (loop_add(loop, &client->src) < 0) {
+        close(fd);
+        free(client);
+        return FAIL;
+    }
+
+    client->next  = loop->clients;
+    loop->clients = client;
+    loop->n_clients++;
+
+    return SUCCEED;
+}
+
+/*********/
+/* Setup */
+/*********/
+
+herr_t
+open_sources(loop_t *loop)
+{
+    sigset_t           mask;
+    struct sockaddr_un addr;
+
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        goto badness;
+
+    /* Signals. These are blocked before any threads start, so they only
+     * ever show up here.
+     */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    if ((loop->signals.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        goto badness;
+    loop->signals.events  = EPOLLIN;
+    loop->signals.handler = on_signal;
+
+    /* Timers */
+    if ((loop->pacer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        goto badness;
+    loop->pacer.events  = EPOLLIN;
+    loop->pacer.handler = on_pace;
+
+    if ((loop->flusher.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        goto badness;
+    loop->flusher.events  = EPOLLIN;
+    loop->flusher.handler = on_flush_timer;
+
+    /* Worker completions */
+    loop->completions.fd      = loop->pool.done_fd;
+    loop->completions.events  = EPOLLIN;
+    loop->completions.handler = on_completions;
+
+    /* Ingest socket */
+    if ((loop->ingest.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        goto badness;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, INGEST_SOCKET, sizeof(addr.sun_path) - 1);
+    unlink(INGEST_SOCKET);
+    if (bind(loop->ingest.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto badness;
+    loop->ingest.events  = EPOLLIN;
+    loop->ingest.handler = on_ingest;
+
+    /* Control socket */
+    if ((loop->control.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        goto badness;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, CONTROL_SOCKET, sizeof(addr.sun_path) - 1);
+    unlink(CONTROL_SOCKET);
+    if (bind(loop->control.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto badness;
+    if (listen(loop->control.fd, MAX_CONTROL_CLIENTS) < 0)
+        goto badness;
+    loop->control.events  = EPOLLIN;
+    loop->control.handler = on_control_accept;
+
+    if (loop_add(loop, &loop->signals) < 0 || loop_add(loop, &loop->pacer) < 0 ||
+        loop_add(loop, &loop->flusher) < 0 || loop_add(loop, &loop->completions) < 0 ||
+        loop_add(loop, &loop->ingest) < 0 || loop_add(loop, &loop->control) < 0)
+        goto badness;
+    loop->inputs_on = 1;
+
+    return SUCCEED;
+
+badness:
+    perror("event sources");
+    return FAIL;
+}
+
+void
+close_sources(loop_t *loop)
+{
+    loop_remove(loop, &loop->signals);
+    loop_remove(loop, &loop->pacer);
+    loop_remove(loop, &loop->flusher);
+    loop_remove(loop, &loop->ingest);
+    loop_remove(loop, &loop->control);
+    while (loop->clients)
+        control_client_close(loop, loop->clients);
+    unlink(CONTROL_SOCKET);
+
+    /* The pool owns the eventfd */
+    if (loop->completions.fd >= 0)
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, loop->completions.fd, NULL);
+
+    if (loop->epfd >= 0)
+        close(loop->epfd);
+
+    if (!loop->stopping)
+        unlink(INGEST_SOCKET);
+}
+
+/*************/
+/* Feed mode */
+/*************/
+
+/* Sends n_chunks chunks' worth of data for a stream to a running
+ * writer. The values are the chunk number, like the synthetic source.
+ */
+int
+feed(int stream, long n_chunks)
+{
+    struct sockaddr_un addr;
+    uint32_t           msg[1 + FEED_VALUES];
+    int                fd;
+    hsize_t            n = 0;
+
+    if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+        goto badness;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, INGEST_SOCKET, sizeof(addr.sun_path) - 1);
+
+    msg[0] = (uint32_t)stream;
+
+    while (n < (hsize_t)n_chunks * CHUNK_SIZE) {
+        int *values = (int *)(msg + 1);
+
+        for (int i = 0; i < FEED_VALUES; i++)
+            values[i] = (int)((n + (hsize_t)i) / CHUNK_SIZE);
+
+        /* Datagram sockets block when the writer's queue is full, which is
+         * all the flow control we need
+         */
+        if (sendto(fd, msg, sizeof(msg), 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+            goto badness;
+
+        n += FEED_VALUES;
+    }
+
+    close(fd);
+
+    printf("SENT %ld CHUNKS TO STREAM %d\n", n_chunks, stream);
+
+    return EXIT_SUCCESS;
+
+badness:
+    perror("feed");
+    if (fd >= 0)
+        close(fd);
+    return EXIT_FAILURE;
+}
+
+/* Sends one command to a running writer's control socket and prints the
+ * reply
+ */
+int
+control(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    char               line[MAX_COMMAND];
+    char               reply[4096];
+    size_t             line_len = 0;
+    size_t             len      = 0;
+    int                fd       = -1;
+
+    /* The words joined with spaces and ending in a newline. A command
+     * that doesn't fit is an error, not something to send truncated.
+     */
+    line[0] = '\0';
+    for (int i = 0; i < argc; i++) {
+        int n = snprintf(line + line_len, sizeof(line) - line_len, "%s%s", argv[i], i == argc - 1 ? "\n" : " ");
+
+        if (n < 0 || (size_t)n >= sizeof(line) - line_len) {
+            fprintf(stderr, "command is too long (max %zu bytes)\n", sizeof(line) - 1);
+            return EXIT_FAILURE;
+        }
+        line_len += (size_t)n;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        goto badness;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, CONTROL_SOCKET, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto badness;
+    if (write(fd, line, line_len) != (ssize_t)line_len)
+        goto badness;
+
+    /* The reply is one line */
+    while (len < sizeof(reply) - 1) {
+        ssize_t n = read(fd, reply + len, sizeof(reply) - 1 - len);
+
+        if (n < 0)
+            goto badness;
+        if (0 == n)
+            break;
+        len += (size_t)n;
+        if (reply[len - 1] == '\n')
+            break;
+    }
+    reply[len] = '\0';
+
+    close(fd);
+
+    fputs(reply, stdout);
+
+    return EXIT_SUCCESS;
+
+badness:
+    perror("control");
+    if (fd >= 0)
+        close(fd);
+    return EXIT_FAILURE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    loop_t   loop;
+    sigset_t mask;
+    config_t config = DEFAULT_CONFIG;
+
+    if (argc > 1 && !strcmp(argv[1], "feed")) {
+        int  stream   = argc > 2 ? atoi(argv[2]) : 1;
+        long n_chunks = argc > 3 ? atol(argv[3]) : 10;
+
+        if (stream < 0 || stream >= N_STREAMS || n_chunks < 0) {
+            fprintf(stderr, "usage: %s feed [stream 0-%d] [n_chunks]\n", argv[0], N_STREAMS - 1);
+            return EXIT_FAILURE;
+        }
+
+        return feed(stream, n_chunks);
+    }
+
+    if (argc > 2 && !strcmp(argv[1], "ctl"))
+        return control(argc - 2, argv + 2);
+
+    memset(&loop, 0, sizeof(loop));
+    loop.epfd         = -1;
+    loop.fid          = H5I_INVALID_HID;
+    loop.pool.done_fd = -1;
+    for (int i = 0; i < N_STREAMS; i++)
+        loop.streams[i].did = H5I_INVALID_HID;
+    loop.signals.fd = loop.pacer.fd = loop.flusher.fd = loop.completions.fd = loop.ingest.fd = -1;
+    loop.control.fd = -1;
+
+    /* A config file named on the command line has to be there. The
+     * default one is optional until the first SIGHUP.
+     */
+    loop.config_path = argc > 1 ? argv[1] : CONFIG_FILE;
+    if (config_load(loop.config_path, &config) < 0) {
+        if (argc > 1) {
+            fprintf(stderr, "can't load %s\n", loop.config_path);
+            goto badness;
+        }
+        config = DEFAULT_CONFIG;
+    }
+
+    /* Signals are delivered through the signalfd, so block them before the
+     * workers start and inherit the mask
+     */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    if (0 != pthread_sigmask(SIG_BLOCK, &mask, NULL))
+        goto badness;
+
+    /* Set up file and datasets */
+    snprintf(loop.file_name, sizeof(loop.file_name), "%s", FILE_NAME);
+    if (setup(loop.file_name) < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE\n");
+
+    if (open_file(&loop) < 0)
+        goto badness;
+
+    for (int i = 0; i < N_STREAMS; i++)
+        if (NULL == (loop.streams[i].staging = malloc(CHUNK_SIZE * sizeof(int))))
+            goto badness;
+
+    if (pool_start(&loop.pool, 0) < 0)
+        goto badness;
+    if (open_sources(&loop) < 0)
+        goto badness;
+    if (apply_config(&loop, &config, 1) < 0)
+        goto badness;
+
+    config_print("CONFIGURATION", &loop.config);
+
+    printf("INGEST SOCKET: %s\n", INGEST_SOCKET);
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    /* Run until we've been told to stop and everything in flight is in
+     * the file
+     */
+    while (!loop.stopping || loop.inflight) {
+        struct epoll_event events[16];
+        int                n;
+
+        if ((n = epoll_wait(loop.epfd, events, 16, -1)) < 0) {
+            if (EINTR == errno)
+                continue;
+            goto badness;
+        }
+
+        for (int i = 0; i < n; i++) {
+            source_t *src = (source_t *)events[i].data.ptr;
+
+            /* An earlier handler in this batch may have closed it */
+            if (src->fd < 0)
+                continue;
+
+            if (src->handler(&loop, src) < 0)
+                goto badness;
+        }
+    }
+
+    for (int i = 0; i < N_STREAMS; i++)
+        printf("STREAM %d: %llu CHUNKS, %llu ELEMENTS\n", i, (unsigned long long)loop.streams[i].n_written,
+               (unsigned long long)loop.streams[i].extent);
+    printf("SYNTHETIC CHUNKS: %llu  DATAGRAMS: %llu  FLUSHES: %llu\n", (unsigned long long)loop.n_synthetic,
+           (unsigned long long)loop.n_datagrams, (unsigned long long)loop.n_flushes);
+
+    close_sources(&loop);
+    pool_stop(&loop.pool);
+
+    if (close_file(&loop) < 0)
+        goto badness;
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    close_sources(&loop);
+    pool_stop(&loop.pool);
+    for (int i = 0; i < N_STREAMS; i++)
+        free(loop.streams[i].staging);
+
+    H5E_BEGIN_TRY
+    {
+        close_file(&loop);
+    }
+    H5E_END_TRY;
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
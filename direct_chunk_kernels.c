@@ -0,0 +1,816 @@
+/* direct_chunk_kernels.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version processes each chunk with kernels (fill, byte shuffle,
+ * statistics and checksum) that are compiled separately for the most
+ * common element type / chunk size combinations, so the compiler knows
+ * the loop counts and element sizes and can unroll and vectorize them.
+ * Any other combination falls back to generic versions of the same
+ * kernels.
+ *
+ * To build:
+ *      h5cc -O3 -o kernels direct_chunk_kernels.c -lm -lz
+ *
+ * - DOES require the deflate and shuffle filters
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ *
+ * To run:
+ *      ./kernels [int16|int32|float|double] [chunk_elements]
+ *          - It will generate one chunk per second (default int32, 4096
+ *            elements), shuffle and compress it, and store per-chunk
+ *            statistics and a Fletcher-32 checksum of the raw data in
+ *            data_stats
+ *          - ctrl-c stops the program
+ *
+ *      ./kernels bench
+ *          - Times the specialized kernels against the generic ones for
+ *            every specialized combination
+ *
+ * How the specialization works:
+ *
+ *      Each kernel is written once as an always-inline body that takes
+ *      the element count as an argument (DEFINE_KERNEL_BODIES). The
+ *      specialized versions (DEFINE_SPECIALIZED_KERNELS) call that body
+ *      with a constant, so after inlining the compiler sees a fixed trip
+ *      count. The generic versions call the same body with the run time
+ *      count. To specialize another combination, add a line to
+ *      SPECIALIZED_CONFIGS.
+ *
+ * What it buys (or doesn't):
+ *
+ *      Not much, with gcc -O3 on x86-64. In three runs of ./kernels bench
+ *      on one core, only float came out consistently ahead (1.06x-1.22x).
+ *      double/4096 was consistently slower (0.87x-0.89x) and everything
+ *      else landed between 0.89x and 1.13x, i.e. within the noise. The
+ *      generic loops already get vectorized with a run time trip count,
+ *      and most of the time goes to the Fletcher-32 checksum, which is
+ *      one long dependency chain that a constant length doesn't help.
+ *      Run the bench with your compiler and flags before relying on it.
+ */
+
+#include <hdf5.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_kernels.h5";
+const char *DSET_NAME = "data";
+const char *STATS_DSET_NAME = "data_stats";
+
+#define RANK 1
+
+const hsize_t DEFAULT_CHUNK_SIZE = 4096;
+
+/* Number of statistics records per chunk of the stats dataset */
+const hsize_t STATS_CHUNK_SIZE = 1024;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const double FILL_VALUE = -1;
+
+/* Chunks processed per kernel in bench mode, and how many times that's
+ * repeated (the fastest repeat is reported)
+ */
+const unsigned BENCH_ITERATIONS = 2000;
+const unsigned BENCH_ROUNDS     = 5;
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/***********/
+/* Kernels */
+/***********/
+
+/* Element types we have kernels for */
+typedef enum {
+    ELEM_INT16,
+    ELEM_INT32,
+    ELEM_FLOAT,
+    ELEM_DOUBLE,
+    N_ELEM_TYPES
+} elem_type_t;
+
+const char *ELEM_NAMES[N_ELEM_TYPES] = {"int16", "int32", "float", "double"};
+
+/* Per-chunk statistics, also the record type of the stats dataset */
+typedef struct {
+    double   min;
+    double   max;
+    double   mean;
+    uint32_t fletcher32; /* Of the raw (unfiltered) chunk bytes */
+} chunk_stats_t;
+
+/* One set of kernels. The specialized ones ignore n. */
+typedef struct {
+    void (*fill)(void *buf, hsize_t n, double value);
+    void (*shuffle)(const void *in, void *out, hsize_t n);
+    void (*stats)(const void *buf, hsize_t n, chunk_stats_t *stats);
+} kernels_t;
+
+/* The Fletcher-32 checksum used by the HDF5 Fletcher-32 filter. With a
+ * constant len, the block loop is fully known at compile time.
+ */
+static inline __attribute__((always_inline)) uint32_t
+fletcher32_body(const uint8_t *data, size_t len)
+{
+    size_t   words = len / 2;
+    uint32_t sum1  = 0;
+    uint32_t sum2  = 0;
+
+    while (words) {
+        size_t block = words > 360 ? 360 : words;
+
+        words -= block;
+        do {
+            sum1 += (uint32_t)(((uint16_t)data[0]) << 8) | ((uint16_t)data[1]);
+            data += 2;
+            sum2 += sum1;
+        } while (--block);
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+
+    if (len % 2) {
+        sum1 += (uint32_t)(((uint16_t)*data) << 8);
+        sum2 += sum1;
+        sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+        sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+    }
+
+    sum1 = (sum1 & 0xffff) + (sum1 >> 16);
+    sum2 = (sum2 & 0xffff) + (sum2 >> 16);
+
+    return (sum2 << 16) | sum1;
+}
+
+/* The kernel bodies for one element type, plus the generic (run time
+ * element count) versions of them
+ *
+ * ACC is the type used to sum the elements.
+ */
+#define DEFINE_KERNEL_BODIES(TYPE, NAME, ACC)                                                               \
+    static inline __attribute__((always_inline)) void NAME##_fill_body(void *_buf, hsize_t n, double value)  \
+    {                                                                                                       \
+        TYPE *restrict buf = (TYPE *)_buf;                                                                  \
+        TYPE           v   = (TYPE)value;                                                                   \
+                                                                                                            \
+        for (hsize_t i = 0; i < n; i++)                                                                     \
+            buf[i] = v;                                                                                     \
+    }                                                                                                       \
+                                                                                                            \
+    /* Same byte order as the HDF5 shuffle filter: byte 0 of every element,                                 \
+     * then byte 1 of every element, ...                                                                    \
+     */                                                                                                     \
+    static inline __attribute__((always_inline)) void NAME##_shuffle_body(const void *_in, void *_out,      \
+                                                                          hsize_t n)                        \
+    {                                                                                                       \
+        const uint8_t *restrict in  = (const uint8_t *)_in;                                                 \
+        uint8_t *restrict       out = (uint8_t *)_out;                                                      \
+                                                                                                            \
+        for (size_t b = 0; b < sizeof(TYPE); b++)                                                           \
+            for (hsize_t i = 0; i < n; i++)                                                                 \
+                out[b * n + i] = in[i * sizeof(TYPE) + b];                                                  \
+    }                                                                                                       \
+                                                                                                            \
+    static inline __attribute__((always_inline)) void NAME##_stats_body(const void *_buf, hsize_t n,        \
+                                                                        chunk_stats_t *stats)               \
+    {                                                                                                       \
+        const TYPE *restrict buf = (const TYPE *)_buf;                                                      \
+        TYPE                 lo  = buf[0];                                                                  \
+        TYPE                 hi  = buf[0];                                                                  \
+        ACC                  sum = 0;                                                                       \
+                                                                                                            \
+        for (hsize_t i = 0; i < n; i++) {                                                                   \
+            lo = buf[i] < lo ? buf[i] : lo;                                                                 \
+            hi = buf[i] > hi ? buf[i] : hi;                                                                 \
+            sum += (ACC)buf[i];                                                                             \
+        }                                                                                                   \
+                                                                                                            \
+        stats->min        = (double)lo;                                                                     \
+        stats->max        = (double)hi;                                                                     \
+        stats->mean       = (double)sum / (double)n;                                                        \
+        stats->fletcher32 = fletcher32_body((const uint8_t *)_buf, n * sizeof(TYPE));                       \
+    }                                                                                                       \
+                                                                                                            \
+    static void NAME##_fill_generic(void *buf, hsize_t n, double value)                                     \
+    {                                                                                                       \
+        NAME##_fill_body(buf, n, value);                                                                    \
+    }                                                                                                       \
+    static void NAME##_shuffle_generic(const void *in, void *out, hsize_t n)                                \
+    {                                                                                                       \
+        NAME##_shuffle_body(in, out, n);                                                                    \
+    }                                                                                                       \
+    static void NAME##_stats_generic(const void *buf, hsize_t n, chunk_stats_t *stats)                      \
+    {                                                                                                       \
+        NAME##_stats_body(buf, n, stats);                                                                   \
+    }
+
+DEFINE_KERNEL_BODIES(int16_t, int16, int64_t)
+DEFINE_KERNEL_BODIES(int32_t, int32, int64_t)
+DEFINE_KERNEL_BODIES(float, float, double)
+DEFINE_KERNEL_BODIES(double, double, double)
+
+const kernels_t GENERIC_KERNELS[N_ELEM_TYPES] = {
+    {int16_fill_generic, int16_shuffle_generic, int16_stats_generic},
+    {int32_fill_generic, int32_shuffle_generic, int32_stats_generic},
+    {float_fill_generic, float_shuffle_generic, float_stats_generic},
+    {double_fill_generic, double_shuffle_generic, double_stats_generic},
+};
+
+/* The combinations that get their own kernels: (C type, name, elem_type_t,
+ * elements per chunk)
+ */
+#define SPECIALIZED_CONFIGS(X)                                                                              \
+    X(int16_t, int16, ELEM_INT16, 4096)                                                                     \
+    X(int16_t, int16, ELEM_INT16, 65536)                                                                    \
+    X(int32_t, int32, ELEM_INT32, 1024)                                                                     \
+    X(int32_t, int32, ELEM_INT32, 4096)                                                                     \
+    X(int32_t, int32, ELEM_INT32, 65536)                                                                    \
+    X(float, float, ELEM_FLOAT, 4096)                                                                       \
+    X(float, float, ELEM_FLOAT, 65536)                                                                      \
+    X(double, double, ELEM_DOUBLE, 4096)                                                                    \
+    X(double, double, ELEM_DOUBLE, 65536)
+
+#define DEFINE_SPECIALIZED_KERNELS(TYPE, NAME, ELEM, N)                                                     \
+    static void NAME##_fill_##N(void *buf, hsize_t n, double value)                                         \
+    {                                                                                                       \
+        (void)n;                                                                                            \
+        NAME##_fill_body(buf, (N), value);                                                                  \
+    }                                                                                                       \
+    static void NAME##_shuffle_##N(const void *in, void *out, hsize_t n)                                    \
+    {                                                                                                       \
+        (void)n;                                                                                            \
+        NAME##_shuffle_body(in, out, (N));                                                                  \
+    }                                                                                                       \
+    static void NAME##_stats_##N(const void *buf, hsize_t n, chunk_stats_t *stats)                          \
+    {                                                                                                       \
+        (void)n;                                                                                            \
+        NAME##_stats_body(buf, (N), stats);                                                                 \
+    }
+
+SPECIALIZED_CONFIGS(DEFINE_SPECIALIZED_KERNELS)
+
+/* The dispatch table */
+typedef struct {
+    elem_type_t elem;
+    hsize_t     chunk_size;
+    kernels_t   kernels;
+} specialized_t;
+
+#define SPECIALIZED_ENTRY(TYPE, NAME, ELEM, N) {ELEM, (N), {NAME##_fill_##N, NAME##_shuffle_##N, NAME##_stats_##N}},
+
+const specialized_t SPECIALIZED[] = {SPECIALIZED_CONFIGS(SPECIALIZED_ENTRY)};
+
+#define N_SPECIALIZED (sizeof(SPECIALIZED) / sizeof(SPECIALIZED[0]))
+
+/* Picks the kernels for a dataset. This is done once, when the dataset
+ * is set up, not for every chunk.
+ */
+const kernels_t *
+find_kernels(elem_type_t elem, hsize_t chunk_size, int *is_specialized)
+{
+    for (size_t i = 0; i < N_SPECIALIZED; i++)
+        if (SPECIALIZED[i].elem == elem && SPECIALIZED[i].chunk_size == chunk_size) {
+            *is_specialized = 1;
+            return &SPECIALIZED[i].kernels;
+        }
+
+    *is_specialized = 0;
+    return &GENERIC_KERNELS[elem];
+}
+
+size_t
+elem_size(elem_type_t elem)
+{
+    switch (elem) {
+        case ELEM_INT16:
+            return sizeof(int16_t);
+        case ELEM_INT32:
+            return sizeof(int32_t);
+        case ELEM_FLOAT:
+            return sizeof(float);
+        case ELEM_DOUBLE:
+        default:
+            return sizeof(double);
+    }
+}
+
+hid_t
+elem_h5type(elem_type_t elem)
+{
+    switch (elem) {
+        case ELEM_INT16:
+            return H5T_NATIVE_INT16;
+        case ELEM_INT32:
+            return H5T_NATIVE_INT32;
+        case ELEM_FLOAT:
+            return H5T_NATIVE_FLOAT;
+        case ELEM_DOUBLE:
+        default:
+            return H5T_NATIVE_DOUBLE;
+    }
+}
+
+/**********/
+/* Writer */
+/**********/
+
+/* The record type of the stats dataset */
+hid_t
+create_stats_type(void)
+{
+    hid_t tid = H5I_INVALID_HID;
+
+    if ((tid = H5Tcreate(H5T_COMPOUND, sizeof(chunk_stats_t))) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Tinsert(tid, "min", HOFFSET(chunk_stats_t, min), H5T_NATIVE_DOUBLE) < 0)
+        goto badness;
+    if (H5Tinsert(tid, "max", HOFFSET(chunk_stats_t, max), H5T_NATIVE_DOUBLE) < 0)
+        goto badness;
+    if (H5Tinsert(tid, "mean", HOFFSET(chunk_stats_t, mean), H5T_NATIVE_DOUBLE) < 0)
+        goto badness;
+    if (H5Tinsert(tid, "fletcher32", HOFFSET(chunk_stats_t, fletcher32), H5T_NATIVE_UINT32) < 0)
+        goto badness;
+
+    return tid;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Tclose(tid);
+    }
+    H5E_END_TRY;
+
+    return H5I_INVALID_HID;
+}
+
+herr_t
+setup(elem_type_t elem, hsize_t chunk_size)
+{
+    hid_t fapl_id  = H5I_INVALID_HID;
+    hid_t fid      = H5I_INVALID_HID;
+    hid_t sid      = H5I_INVALID_HID;
+    hid_t dcpl_id  = H5I_INVALID_HID;
+    hid_t did      = H5I_INVALID_HID;
+    hid_t stats_id = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {chunk_size};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for datasets */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl - the filters are applied in the order they're added, which
+     * must match what direct_write() does: shuffle, then deflate
+     */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_shuffle(dcpl_id) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_DOUBLE, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, elem_h5type(elem), sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) ==
+        H5I_INVALID_HID)
+        goto badness;
+
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    dcpl_id = H5I_INVALID_HID;
+
+    /* Stats dataset */
+    chunk_dims[0] = STATS_CHUNK_SIZE;
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if ((stats_id = create_stats_type()) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if ((did = H5Dcreate2(fid, STATS_DSET_NAME, stats_id, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) ==
+        H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Tclose(stats_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Tclose(stats_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/* Stores the statistics of one chunk in the stats dataset, which must
+ * already be large enough
+ */
+herr_t
+write_stats(hid_t stats_did, hid_t stats_tid, hsize_t chunk_index, const chunk_stats_t *stats)
+{
+    hid_t   fsid      = H5I_INVALID_HID;
+    hid_t   msid      = H5I_INVALID_HID;
+    hsize_t one[RANK] = {1};
+
+    if ((fsid = H5Dget_space(stats_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sselect_hyperslab(fsid, H5S_SELECT_SET, &chunk_index, NULL, one, NULL) < 0)
+        goto badness;
+    if ((msid = H5Screate_simple(RANK, one, NULL)) == H5I_INVALID_HID)
+        goto badness;
+
+    if (H5Dwrite(stats_did, stats_tid, msid, fsid, H5P_DEFAULT, stats) < 0)
+        goto badness;
+
+    if (H5Sclose(fsid) < 0)
+        goto badness;
+    if (H5Sclose(msid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(fsid);
+        H5Sclose(msid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Buffers reused for every chunk */
+typedef struct {
+    void  *raw;
+    void  *shuffled;
+    void  *out;
+    size_t raw_size;
+    size_t out_size;
+} buffers_t;
+
+herr_t
+direct_write(hid_t did, hsize_t offset, hsize_t chunk_size, const kernels_t *k, buffers_t *bufs,
+             chunk_stats_t *stats)
+{
+    uint32_t filter_mask = 0; /* We're not skipping any filters */
+
+    /* For synthetic data, we just fill the chunk with the chunk number.
+     * That should make it easy to spot screwups. It wraps at 32768 so it
+     * always fits in an int16 (converting an out of range double to an
+     * integer type is undefined).
+     */
+    k->fill(bufs->raw, chunk_size, (double)((offset / chunk_size) & 0x7FFF));
+
+    /* Statistics and checksum of the raw data */
+    k->stats(bufs->raw, chunk_size, stats);
+
+    /* The first filter in the pipeline */
+    k->shuffle(bufs->raw, bufs->shuffled, chunk_size);
+
+    /* ...and the second. Compress the data using zlib */
+    uLongf z_destLen = (uLongf)bufs->out_size;
+    int    z_ret     = compress2((Bytef *)bufs->out, &z_destLen, (const Bytef *)bufs->shuffled,
+                                 (uLong)bufs->raw_size, COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    /* Check to make sure the compressed buffer size isn't bigger than the
+     * chunk size.
+     */
+    if (z_destLen > bufs->raw_size) {
+        fprintf(stderr, "can't write chunk data that is larger than the chunk\n");
+        fprintf(stderr, "in: %zu   out: %lu\n", bufs->raw_size, (unsigned long)z_destLen);
+        goto badness;
+    }
+
+    /* Write the compressed data to the chunk */
+    if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, (size_t)z_destLen, bufs->out) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+herr_t
+run_writer(elem_type_t elem, hsize_t chunk_size)
+{
+    hid_t            fid       = H5I_INVALID_HID;
+    hid_t            did       = H5I_INVALID_HID;
+    hid_t            stats_did = H5I_INVALID_HID;
+    hid_t            stats_tid = H5I_INVALID_HID;
+    buffers_t        bufs;
+    const kernels_t *k;
+    int              is_specialized;
+
+    memset(&bufs, 0, sizeof(bufs));
+
+    k = find_kernels(elem, chunk_size, &is_specialized);
+    printf("%s, %llu elements per chunk: %s kernels\n", ELEM_NAMES[elem], (unsigned long long)chunk_size,
+           is_specialized ? "specialized" : "generic");
+
+    /* Buffer sizes
+     * The output buffer has to be larger than the input buffer in case
+     * the compression is inefficient.
+     */
+    bufs.raw_size = (size_t)chunk_size * elem_size(elem);
+    bufs.out_size = (size_t)compressBound((uLong)bufs.raw_size);
+    if (NULL == (bufs.raw = malloc(bufs.raw_size)))
+        goto badness;
+    if (NULL == (bufs.shuffled = malloc(bufs.raw_size)))
+        goto badness;
+    if (NULL == (bufs.out = malloc(bufs.out_size)))
+        goto badness;
+
+    /* Set up file and datasets */
+    if (setup(elem, chunk_size) < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE\n");
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((stats_did = H5Dopen2(fid, STATS_DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((stats_tid = create_stats_type()) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+
+    while (!stop) {
+        chunk_stats_t stats;
+
+        /* Extend by one chunk
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+
+        /* The write offset where we'll be scribbling our data */
+        hsize_t write_offset = n_chunks * chunk_size;
+
+        /* The new size of the dataset after we extend */
+        hsize_t new_size = (n_chunks + 1) * chunk_size;
+
+        if (extend_dataset(did, new_size) < 0)
+            goto badness;
+        if (extend_dataset(stats_did, n_chunks + 1) < 0)
+            goto badness;
+
+        if (direct_write(did, write_offset, chunk_size, k, &bufs, &stats) < 0)
+            goto badness;
+        if (write_stats(stats_did, stats_tid, n_chunks, &stats) < 0)
+            goto badness;
+
+        n_chunks += 1;
+
+        sleep(1);
+    }
+
+    if (H5Tclose(stats_tid) < 0)
+        goto badness;
+    if (H5Dclose(stats_did) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    free(bufs.raw);
+    free(bufs.shuffled);
+    free(bufs.out);
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Tclose(stats_tid);
+        H5Dclose(stats_did);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    free(bufs.raw);
+    free(bufs.shuffled);
+    free(bufs.out);
+
+    return FAIL;
+}
+
+/*********/
+/* Bench */
+/*********/
+
+/* Seconds per chunk for fill + stats + shuffle with the given kernels */
+double
+time_kernels(const kernels_t *k, hsize_t chunk_size, void *raw, void *shuffled, chunk_stats_t *stats)
+{
+    double start = now_seconds();
+
+    for (unsigned i = 0; i < BENCH_ITERATIONS; i++) {
+        k->fill(raw, chunk_size, (double)(i & 0x7F));
+        k->stats(raw, chunk_size, stats);
+        k->shuffle(raw, shuffled, chunk_size);
+    }
+
+    return (now_seconds() - start) / BENCH_ITERATIONS;
+}
+
+herr_t
+run_bench(void)
+{
+    printf("%-8s %8s %14s %14s %8s\n", "type", "elements", "generic MB/s", "special MB/s", "speedup");
+
+    /* The generic and specialized kernels take turns and each keeps its
+     * best round, so neither one pays for page faults or a noisy
+     * neighbour that the other doesn't
+     */
+    for (size_t i = 0; i < N_SPECIALIZED; i++) {
+        const specialized_t *s = &SPECIALIZED[i];
+        size_t               n_bytes = (size_t)s->chunk_size * elem_size(s->elem);
+        void                *raw     = NULL;
+        void                *shuffled = NULL;
+        chunk_stats_t        generic_stats;
+        chunk_stats_t        special_stats;
+
+        double               t_generic = HUGE_VAL;
+        double               t_special = HUGE_VAL;
+
+        if (NULL == (raw = calloc(1, n_bytes)) || NULL == (shuffled = calloc(1, n_bytes))) {
+            free(raw);
+            return FAIL;
+        }
+
+        for (unsigned r = 0; r < BENCH_ROUNDS; r++) {
+            double t;
+
+            t         = time_kernels(&GENERIC_KERNELS[s->elem], s->chunk_size, raw, shuffled, &generic_stats);
+            t_generic = t < t_generic ? t : t_generic;
+            t         = time_kernels(&s->kernels, s->chunk_size, raw, shuffled, &special_stats);
+            t_special = t < t_special ? t : t_special;
+        }
+
+        free(raw);
+        free(shuffled);
+
+        /* Same input, so they had better agree */
+        if (generic_stats.min != special_stats.min || generic_stats.max != special_stats.max ||
+            generic_stats.mean != special_stats.mean || generic_stats.fletcher32 != special_stats.fletcher32) {
+            fprintf(stderr, "%s/%llu: specialized and generic kernels disagree\n", ELEM_NAMES[s->elem],
+                    (unsigned long long)s->chunk_size);
+            return FAIL;
+        }
+
+        printf("%-8s %8llu %14.1f %14.1f %7.2fx\n", ELEM_NAMES[s->elem], (unsigned long long)s->chunk_size,
+               (double)n_bytes / t_generic / 1e6, (double)n_bytes / t_special / 1e6, t_generic / t_special);
+    }
+
+    return SUCCEED;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    elem_type_t      elem       = ELEM_INT32;
+    hsize_t          chunk_size = DEFAULT_CHUNK_SIZE;
+
+    if (argc > 1 && !strcmp(argv[1], "bench")) {
+        if (run_bench() < 0)
+            goto badness;
+
+        return EXIT_SUCCESS;
+    }
+
+    if (argc > 1) {
+        int found = 0;
+
+        for (int i = 0; i < N_ELEM_TYPES; i++)
+            if (!strcmp(argv[1], ELEM_NAMES[i])) {
+                elem  = (elem_type_t)i;
+                found = 1;
+            }
+        if (!found) {
+            fprintf(stderr, "type must be int16, int32, float or double\n");
+            goto badness;
+        }
+    }
+    if (argc > 2)
+        chunk_size = (hsize_t)strtoull(argv[2], NULL, 10);
+    if (chunk_size < 1) {
+        fprintf(stderr, "bad chunk size\n");
+        goto badness;
+    }
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    if (run_writer(elem, chunk_size) < 0)
+        goto badness;
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,744 @@
+/* direct_chunk_manifest.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version is an offline tool that writes a chunk reference manifest
+ * for a dataset: a JSON file giving, for every chunk, the file it lives
+ * in plus its byte offset and size, along with the type and codec needed
+ * to decode it. With that, a reader that has no HDF5 library at all (a
+ * web viewer, say) can fetch any chunk with one HTTP range request and
+ * inflate it, and can fetch as many at once as it likes.
+ *
+ * The manifest is in the kerchunk "version 1" format, so fsspec/zarr can
+ * open it as-is:
+ *
+ *      {
+ *          "version": 1,
+ *          "refs": {
+ *              ".zgroup": "{\"zarr_format\":2}",
+ *              "data/.zarray": "{\"shape\":[...],\"compressor\":...}",
+ *              "data/0.0": ["direct_chunk_writer.h5", 4016, 1835],
+ *              ...
+ *          }
+ *      }
+ *
+ * i.e. a Zarr v2 store whose chunk keys point into the HDF5 file. The
+ * dtype, shuffle and zlib settings in .zarray are the codec for every
+ * chunk; see direct_chunk_zarr.c for how those map from HDF5.
+ *
+ * To build:
+ *      h5cc -O2 -o manifest direct_chunk_manifest.c -lm -lz
+ *
+ * - DOES require zlib (for the odd chunk that has to be re-encoded)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./manifest <in.h5> <out.json> [dataset] [url]
+ *
+ *      - dataset defaults to "data"
+ *      - url is what readers should fetch chunks from, e.g.
+ *        https://example.org/shots/direct_chunk_writer.h5 (default: the
+ *        input file name as given)
+ *
+ * Finding the chunks:
+ *
+ *      With HDF5 1.14.4 or later the chunk index is read in one pass with
+ *      H5Dchunk_iter(). Older libraries don't have it, so each chunk is
+ *      looked up with H5Dget_chunk_info(). That walks the index from the
+ *      start on every call, so the time grows with the square of the
+ *      number of chunks. With HDF5 1.10.8, 20,000 chunks took about 4 s
+ *      with a version 1 B-tree chunk index and about 35 s with the
+ *      extensible array index that SWMR (latest format) files get, and
+ *      every doubling of the chunk count takes four times as long. Past a
+ *      few thousand chunks, use a newer library. (The dataset selection
+ *      doesn't help: H5Dget_chunk_info() ignores it, and
+ *      H5Dget_chunk_info_by_coord() is no faster in 1.10.)
+ *
+ *      Offsets in the manifest include any user block, so they're true
+ *      byte offsets into the file. H5Dget_chunk_info() in 1.10 returns
+ *      addresses relative to the end of the user block. Rather than trust
+ *      each library version to say which, the first chunk's bytes are
+ *      read both ways and compared with H5Dread_chunk() (see
+ *      check_base()).
+ *
+ * Chunks that don't fit the manifest:
+ *
+ *      A chunk stored with a filter skipped (usually deflate, because it
+ *      didn't compress) can't be decoded with the dataset's codec, and
+ *      kerchunk has no way to say otherwise. Those few are read, encoded
+ *      with the full pipeline and put in the manifest inline as
+ *      "base64:..." instead of as a reference.
+ *
+ *      Chunks that were never written have no entry and read as the fill
+ *      value.
+ */
+
+#include <hdf5.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+const char *DEFAULT_DSET_NAME = "data";
+
+#if H5_VERSION_GE(1, 14, 4)
+#define USE_CHUNK_ITER
+#endif
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+/**********/
+/* Codecs */
+/**********/
+
+/* The filter pipelines a manifest can describe */
+typedef struct {
+    int shuffle;
+    int deflate;
+    int level;    /* Deflate level */
+} codec_t;
+
+/* Filter mask bit for each filter, which depends on what comes before it */
+uint32_t
+codec_shuffle_bit(const codec_t *codec)
+{
+    (void)codec;
+
+    return 0x1;
+}
+
+uint32_t
+codec_deflate_bit(const codec_t *codec)
+{
+    return codec->shuffle ? 0x2 : 0x1;
+}
+
+/* Works out the codec from a dataset's filters */
+herr_t
+codec_from_dcpl(hid_t dcpl_id, codec_t *codec)
+{
+    int n_filters;
+
+    memset(codec, 0, sizeof(*codec));
+
+    if ((n_filters = H5Pget_nfilters(dcpl_id)) < 0)
+        goto badness;
+
+    for (int i = 0; i < n_filters; i++) {
+        unsigned     flags;
+        size_t       n_values  = 1;
+        unsigned     values[1] = {0};
+        H5Z_filter_t filter;
+
+        if ((filter = H5Pget_filter2(dcpl_id, (unsigned)i, &flags, &n_values, values, 0, NULL, NULL)) < 0)
+            goto badness;
+
+        if (H5Z_FILTER_SHUFFLE == filter && 0 == i)
+            codec->shuffle = 1;
+        else if (H5Z_FILTER_DEFLATE == filter && !codec->deflate) {
+            codec->deflate = 1;
+            codec->level   = (int)values[0];
+        }
+        else {
+            fprintf(stderr, "a manifest can't describe filter %d in position %d\n", (int)filter, i);
+            goto badness;
+        }
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+void
+shuffle(const unsigned char *in, unsigned char *out, size_t n_bytes, size_t elem_size)
+{
+    size_t n_elems = n_bytes / elem_size;
+
+    for (size_t b = 0; b < elem_size; b++)
+        for (size_t i = 0; i < n_elems; i++)
+            out[b * n_elems + i] = in[i * elem_size + b];
+
+    /* Like the HDF5 filter, leftover bytes stay where they are */
+    memcpy(out + n_elems * elem_size, in + n_elems * elem_size, n_bytes - n_elems * elem_size);
+}
+
+void
+unshuffle(const unsigned char *in, unsigned char *out, size_t n_bytes, size_t elem_size)
+{
+    size_t n_elems = n_bytes / elem_size;
+
+    for (size_t b = 0; b < elem_size; b++)
+        for (size_t i = 0; i < n_elems; i++)
+            out[i * elem_size + b] = in[b * n_elems + i];
+
+    memcpy(out + n_elems * elem_size, in + n_elems * elem_size, n_bytes - n_elems * elem_size);
+}
+
+/* Re-encodes a chunk that had filters skipped so it has them all. On
+ * success the chunk's data is replaced.
+ */
+herr_t
+codec_complete(const codec_t *codec, void **data, size_t *size, uint32_t filter_mask, size_t raw_size,
+               size_t elem_size)
+{
+    unsigned char *a     = NULL;
+    unsigned char *b     = NULL;
+    uLongf         z_len = compressBound((uLong)raw_size);
+
+    if (NULL == (a = malloc(raw_size)) || NULL == (b = malloc((size_t)z_len)))
+        goto badness;
+
+    /* Back to raw, undoing only what was applied */
+    if (codec->deflate && !(filter_mask & codec_deflate_bit(codec))) {
+        uLongf destLen = (uLongf)raw_size;
+
+        if (Z_OK != uncompress(a, &destLen, (const Bytef *)*data, (uLong)*size) || destLen != raw_size) {
+            fprintf(stderr, "can't inflate chunk\n");
+            goto badness;
+        }
+    }
+    else {
+        if (*size != raw_size) {
+            fprintf(stderr, "unfiltered chunk is %zu bytes, expected %zu\n", *size, raw_size);
+            goto badness;
+        }
+        memcpy(a, *data, raw_size);
+    }
+    if (codec->shuffle && !(filter_mask & codec_shuffle_bit(codec))) {
+        unshuffle(a, b, raw_size, elem_size);
+        memcpy(a, b, raw_size);
+    }
+
+    /* And forward again through everything */
+    if (codec->shuffle) {
+        shuffle(a, b, raw_size, elem_size);
+        memcpy(a, b, raw_size);
+    }
+    if (codec->deflate) {
+        if (Z_OK != compress2((Bytef *)b, &z_len, a, (uLong)raw_size, codec->level)) {
+            fprintf(stderr, "can't deflate chunk\n");
+            goto badness;
+        }
+        free(a);
+        free(*data);
+        *data = b;
+        *size = (size_t)z_len;
+    }
+    else {
+        free(b);
+        free(*data);
+        *data = a;
+        *size = raw_size;
+    }
+
+    return SUCCEED;
+
+badness:
+    free(a);
+    free(b);
+    return FAIL;
+}
+
+/********/
+/* JSON */
+/********/
+
+/* Writes a string as a JSON string literal */
+void
+json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        if ('"' == c || '\\' == c)
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/* Writes bytes as a JSON string holding "base64:..." */
+void
+json_base64(FILE *f, const unsigned char *data, size_t len)
+{
+    const char *digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    fputs("\"base64:", f);
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t n    = (uint32_t)data[i] << 16;
+        size_t   left = len - i;
+
+        if (left > 1)
+            n |= (uint32_t)data[i + 1] << 8;
+        if (left > 2)
+            n |= data[i + 2];
+
+        fputc(digits[(n >> 18) & 0x3F], f);
+        fputc(digits[(n >> 12) & 0x3F], f);
+        fputc(left > 1 ? digits[(n >> 6) & 0x3F] : '=', f);
+        fputc(left > 2 ? digits[n & 0x3F] : '=', f);
+    }
+    fputc('"', f);
+}
+
+/* numpy-style type string, e.g. "<i4" */
+herr_t
+zarr_dtype(hid_t tid, char *dtype, size_t len)
+{
+    H5T_class_t cls   = H5Tget_class(tid);
+    H5T_order_t order = H5Tget_order(tid);
+    size_t      size  = H5Tget_size(tid);
+    char        kind;
+
+    if (H5T_INTEGER == cls)
+        kind = H5T_SGN_NONE == H5Tget_sign(tid) ? 'u' : 'i';
+    else if (H5T_FLOAT == cls)
+        kind = 'f';
+    else {
+        fprintf(stderr, "a manifest can only describe integer and floating-point types\n");
+        return FAIL;
+    }
+
+    snprintf(dtype, len, "%c%c%zu", 1 == size ? '|' : (H5T_ORDER_BE == order ? '>' : '<'), kind, size);
+
+    return SUCCEED;
+}
+
+/* The fill value as JSON */
+herr_t
+zarr_fill_value(hid_t dcpl_id, hid_t tid, char *fill, size_t len)
+{
+    H5D_fill_value_t status;
+
+    if (H5Pfill_value_defined(dcpl_id, &status) < 0)
+        return FAIL;
+
+    if (H5D_FILL_VALUE_UNDEFINED == status)
+        snprintf(fill, len, "null");
+    else if (H5T_FLOAT == H5Tget_class(tid)) {
+        double value;
+
+        if (H5Pget_fill_value(dcpl_id, H5T_NATIVE_DOUBLE, &value) < 0)
+            return FAIL;
+        if (isnan(value))
+            snprintf(fill, len, "\"NaN\"");
+        else if (isinf(value))
+            snprintf(fill, len, value > 0 ? "\"Infinity\"" : "\"-Infinity\"");
+        else
+            snprintf(fill, len, "%.17g", value);
+    }
+    else if (H5T_SGN_NONE == H5Tget_sign(tid)) {
+        unsigned long long value;
+
+        if (H5Pget_fill_value(dcpl_id, H5T_NATIVE_ULLONG, &value) < 0)
+            return FAIL;
+        snprintf(fill, len, "%llu", value);
+    }
+    else {
+        long long value;
+
+        if (H5Pget_fill_value(dcpl_id, H5T_NATIVE_LLONG, &value) < 0)
+            return FAIL;
+        snprintf(fill, len, "%lld", value);
+    }
+
+    return SUCCEED;
+}
+
+/* Zarr .zarray for the dataset, on one line since it goes in a string */
+herr_t
+zarray(char *json, size_t size, int rank, const hsize_t *dims, const hsize_t *chunk_dims, hid_t tid,
+       hid_t dcpl_id, const codec_t *codec)
+{
+    char dtype[16];
+    char fill[64];
+    int  len = 0;
+
+    if (zarr_dtype(tid, dtype, sizeof(dtype)) < 0)
+        return FAIL;
+    if (zarr_fill_value(dcpl_id, tid, fill, sizeof(fill)) < 0)
+        return FAIL;
+
+    len += snprintf(json + len, size - (size_t)len, "{\"zarr_format\":2,\"shape\":[");
+    for (int d = 0; d < rank; d++)
+        len += snprintf(json + len, size - (size_t)len, "%s%llu", d ? "," : "", (unsigned long long)dims[d]);
+    len += snprintf(json + len, size - (size_t)len, "],\"chunks\":[");
+    for (int d = 0; d < rank; d++)
+        len += snprintf(json + len, size - (size_t)len, "%s%llu", d ? "," : "",
+                        (unsigned long long)chunk_dims[d]);
+    len += snprintf(json + len, size - (size_t)len, "],\"dtype\":\"%s\",", dtype);
+    if (codec->deflate)
+        len += snprintf(json + len, size - (size_t)len, "\"compressor\":{\"id\":\"zlib\",\"level\":%d},",
+                        codec->level);
+    else
+        len += snprintf(json + len, size - (size_t)len, "\"compressor\":null,");
+    if (codec->shuffle)
+        len += snprintf(json + len, size - (size_t)len, "\"filters\":[{\"id\":\"shuffle\",\"elementsize\":%zu}],",
+                        H5Tget_size(tid));
+    else
+        len += snprintf(json + len, size - (size_t)len, "\"filters\":null,");
+    len += snprintf(json + len, size - (size_t)len,
+                    "\"fill_value\":%s,\"order\":\"C\",\"dimension_separator\":\".\"}", fill);
+
+    if (len >= (int)size) {
+        fprintf(stderr, ".zarray is too long\n");
+        return FAIL;
+    }
+
+    return SUCCEED;
+}
+
+/**********/
+/* Chunks */
+/**********/
+
+/* Where one chunk is */
+typedef struct {
+    hsize_t  offset[H5S_MAX_RANK];
+    unsigned filter_mask;
+    haddr_t  addr;
+    hsize_t  size;
+} ref_t;
+
+typedef struct {
+    ref_t *refs;
+    size_t n;
+    size_t max;
+    int    rank;
+} refs_t;
+
+herr_t
+refs_add(refs_t *r, const hsize_t *offset, unsigned filter_mask, haddr_t addr, hsize_t size)
+{
+    ref_t *ref;
+
+    if (r->n == r->max) {
+        size_t new_max  = r->max ? 2 * r->max : 1024;
+        ref_t *new_refs = realloc(r->refs, new_max * sizeof(ref_t));
+
+        if (NULL == new_refs)
+            return FAIL;
+        r->refs = new_refs;
+        r->max  = new_max;
+    }
+
+    ref = &r->refs[r->n++];
+    memcpy(ref->offset, offset, (size_t)r->rank * sizeof(hsize_t));
+    ref->filter_mask = filter_mask;
+    ref->addr        = addr;
+    ref->size        = size;
+
+    return SUCCEED;
+}
+
+#ifdef USE_CHUNK_ITER
+int
+chunk_cb(const hsize_t *offset, unsigned filter_mask, haddr_t addr, hsize_t size, void *_r)
+{
+    return refs_add((refs_t *)_r, offset, filter_mask, addr, size) < 0 ? H5_ITER_ERROR : H5_ITER_CONT;
+}
+#endif
+
+/* Above this many chunks, warn that the H5Dget_chunk_info() fallback
+ * will take a while
+ */
+const hsize_t SLOW_CHUNKS = 10000;
+
+/* Gets the location of every chunk that has been written */
+herr_t
+gather_refs(hid_t did, hid_t sid, refs_t *r)
+{
+    hsize_t n_chunks;
+
+    if (H5Dget_num_chunks(did, sid, &n_chunks) < 0)
+        goto badness;
+
+#ifdef USE_CHUNK_ITER
+    if (H5Dchunk_iter(did, H5P_DEFAULT, chunk_cb, r) < 0)
+        goto badness;
+#else
+    if (n_chunks > SLOW_CHUNKS)
+        fprintf(stderr,
+                "%llu chunks: without H5Dchunk_iter() (HDF5 1.14.4+) this takes time that grows with "
+                "the square of that\n",
+                (unsigned long long)n_chunks);
+
+    for (hsize_t i = 0; i < n_chunks; i++) {
+        hsize_t  offset[H5S_MAX_RANK];
+        unsigned filter_mask;
+        haddr_t  addr;
+        hsize_t  size;
+
+        if (H5Dget_chunk_info(did, sid, i, offset, &filter_mask, &addr, &size) < 0)
+            goto badness;
+        if (refs_add(r, offset, filter_mask, addr, size) < 0)
+            goto badness;
+    }
+#endif
+
+    if (r->n != (size_t)n_chunks) {
+        fprintf(stderr, "found %zu chunks but the dataset has %llu\n", r->n, (unsigned long long)n_chunks);
+        goto badness;
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/* Works out what to add to the chunk addresses the library reported to get
+ * byte offsets into the file: the user block size or nothing, depending
+ * on the library version. The first chunk is read with H5Dread_chunk()
+ * and compared with the bytes at both candidate offsets.
+ */
+herr_t
+check_base(const char *file_name, hid_t did, const refs_t *r, hsize_t userblock, hsize_t *base)
+{
+    unsigned char *expected = NULL;
+    unsigned char *found    = NULL;
+    FILE          *f        = NULL;
+    const ref_t   *ref;
+    size_t         size;
+    uint32_t       filter_mask;
+    hsize_t        candidates[2];
+    int            matched = 0;
+
+    *base = 0;
+    if (0 == userblock || 0 == r->n)
+        return SUCCEED;
+
+    ref           = &r->refs[0];
+    size          = (size_t)ref->size;
+    candidates[0] = userblock;
+    candidates[1] = 0;
+
+    if (NULL == (expected = malloc(size)) || NULL == (found = malloc(size)))
+        goto badness;
+    if (H5Dread_chunk(did, H5P_DEFAULT, ref->offset, &filter_mask, expected) < 0)
+        goto badness;
+    if (NULL == (f = fopen(file_name, "rb"))) {
+        perror(file_name);
+        goto badness;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (0 == fseeko(f, (off_t)(candidates[i] + ref->addr), SEEK_SET) && fread(found, 1, size, f) == size &&
+            !memcmp(found, expected, size)) {
+            *base = candidates[i];
+            matched = 1;
+            break;
+        }
+    }
+    if (!matched) {
+        fprintf(stderr, "can't find the first chunk's bytes in %s\n", file_name);
+        goto badness;
+    }
+
+    fclose(f);
+    free(expected);
+    free(found);
+
+    return SUCCEED;
+
+badness:
+    if (f)
+        fclose(f);
+    free(expected);
+    free(found);
+
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    refs_t      r;
+    codec_t     codec;
+    const char *dset_name = DEFAULT_DSET_NAME;
+    const char *url;
+    FILE       *f         = NULL;
+    void       *data      = NULL;
+    hid_t       fid       = H5I_INVALID_HID;
+    hid_t       fcpl_id   = H5I_INVALID_HID;
+    hid_t       did       = H5I_INVALID_HID;
+    hid_t       sid       = H5I_INVALID_HID;
+    hid_t       tid       = H5I_INVALID_HID;
+    hid_t       dcpl_id   = H5I_INVALID_HID;
+    hsize_t     dims[H5S_MAX_RANK];
+    hsize_t     chunk_dims[H5S_MAX_RANK];
+    hsize_t     userblock = 0;
+    hsize_t     base      = 0;
+    size_t      elem_size;
+    size_t      chunk_bytes;
+    size_t      n_inline  = 0;
+    char        json[8192];
+    char        key[1024];
+
+    memset(&r, 0, sizeof(r));
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <in.h5> <out.json> [dataset] [url]\n", argv[0]);
+        goto badness;
+    }
+    if (argc > 3)
+        dset_name = argv[3];
+    url = argc > 4 ? argv[4] : argv[1];
+
+    if ((fid = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((fcpl_id = H5Fget_create_plist(fid)) == H5I_INVALID_HID)
+        goto badness;
+    /* Chunk addresses may be relative to the end of the user block */
+    if (H5Pget_userblock(fcpl_id, &userblock) < 0)
+        goto badness;
+
+    if ((did = H5Dopen2(fid, dset_name, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((tid = H5Dget_type(did)) == H5I_INVALID_HID)
+        goto badness;
+    elem_size = H5Tget_size(tid);
+    if ((dcpl_id = H5Dget_create_plist(did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5D_CHUNKED != H5Pget_layout(dcpl_id)) {
+        fprintf(stderr, "%s isn't chunked\n", dset_name);
+        goto badness;
+    }
+    if ((r.rank = H5Pget_chunk(dcpl_id, H5S_MAX_RANK, chunk_dims)) < 0)
+        goto badness;
+    if (codec_from_dcpl(dcpl_id, &codec) < 0)
+        goto badness;
+    chunk_bytes = elem_size;
+    for (int d = 0; d < r.rank; d++)
+        chunk_bytes *= (size_t)chunk_dims[d];
+
+    if ((sid = H5Dget_space(did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sget_simple_extent_dims(sid, dims, NULL) < 0)
+        goto badness;
+
+    if (zarray(json, sizeof(json), r.rank, dims, chunk_dims, tid, dcpl_id, &codec) < 0)
+        goto badness;
+    if (gather_refs(did, sid, &r) < 0)
+        goto badness;
+    if (check_base(argv[1], did, &r, userblock, &base) < 0)
+        goto badness;
+
+    /* Manifest */
+    if (NULL == (f = fopen(argv[2], "w"))) {
+        perror(argv[2]);
+        goto badness;
+    }
+
+    fprintf(f, "{\n    \"version\": 1,\n    \"refs\": {\n");
+    fprintf(f, "        \".zgroup\": \"{\\\"zarr_format\\\":2}\"");
+
+    snprintf(key, sizeof(key), "%s/.zarray", dset_name);
+    fprintf(f, ",\n        ");
+    json_string(f, key);
+    fprintf(f, ": ");
+    json_string(f, json);
+
+    for (size_t i = 0; i < r.n; i++) {
+        ref_t *ref = &r.refs[i];
+        int    len = snprintf(key, sizeof(key), "%s/", dset_name);
+
+        /* Zarr v2 chunk keys are the grid indices joined with "." */
+        for (int d = 0; d < r.rank && len < (int)sizeof(key); d++)
+            len += snprintf(key + len, sizeof(key) - (size_t)len, "%s%llu", d ? "." : "",
+                            (unsigned long long)(ref->offset[d] / chunk_dims[d]));
+        if (len >= (int)sizeof(key)) {
+            fprintf(stderr, "chunk key is too long\n");
+            goto badness;
+        }
+
+        fprintf(f, ",\n        ");
+        json_string(f, key);
+        fprintf(f, ": ");
+
+        if (0 == ref->filter_mask) {
+            fprintf(f, "[");
+            json_string(f, url);
+            fprintf(f, ", %llu, %llu]", (unsigned long long)(base + ref->addr),
+                    (unsigned long long)ref->size);
+        }
+        else {
+            size_t   size = (size_t)ref->size;
+            uint32_t filter_mask;
+
+            if (NULL == (data = malloc(size)))
+                goto badness;
+            if (H5Dread_chunk(did, H5P_DEFAULT, ref->offset, &filter_mask, data) < 0)
+                goto badness;
+            if (codec_complete(&codec, &data, &size, filter_mask, chunk_bytes, elem_size) < 0)
+                goto badness;
+            json_base64(f, data, size);
+            free(data);
+            data = NULL;
+            n_inline++;
+        }
+    }
+
+    fprintf(f, "\n    }\n}\n");
+    if (fclose(f) != 0) {
+        f = NULL;
+        perror(argv[2]);
+        goto badness;
+    }
+    f = NULL;
+
+    printf("%s: %zu CHUNKS (%zu inline) -> %s\n", dset_name, r.n, n_inline, argv[2]);
+
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Tclose(tid) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Pclose(fcpl_id) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    free(r.refs);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    if (f)
+        fclose(f);
+
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Tclose(tid);
+        H5Dclose(did);
+        H5Pclose(fcpl_id);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    free(data);
+    free(r.refs);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,668 @@
+/* direct_chunk_mdc_image.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version leaves a metadata cache image in the file when the writer
+ * is done with it. A file from a long run has a big chunk index, and
+ * opening it normally means pulling that index in piece by piece with
+ * lots of small, scattered reads. A cache image is a single contiguous
+ * block holding the cache's contents at close, which the library reads in
+ * one go the next time the file is opened.
+ *
+ * To build:
+ *      h5cc -O2 -o mdc_image direct_chunk_mdc_image.c -lm -lz
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require HDF5 1.10.1 or later (cache images)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./mdc_image [write|resume|bench] [n_opens]
+ *
+ *      write (the default)
+ *          - Creates the file and writes 1000 small chunks per second in
+ *            SWMR mode
+ *          - ctrl-c stops writing and writes the cache image
+ *
+ *      resume
+ *          - Reopens the file (using the image) and carries on appending
+ *            from the last chunk, NOT in SWMR mode
+ *          - ctrl-c stops writing and writes a new cache image
+ *
+ *      bench
+ *          - Times n_opens (default 5) cold read-only opens of the file,
+ *            each followed by a walk of the whole chunk index and a read
+ *            of the last chunk, with the image and then without it
+ *          - The image is put back afterwards
+ *
+ * Things to know about cache images:
+ *
+ *      - They can't be used with SWMR. The writer runs in SWMR mode as
+ *        usual and, once it has closed the file, opens it again without
+ *        SWMR just to write the image. A SWMR open throws the image
+ *        away, and H5Fstart_swmr_write() refuses to run once an image has
+ *        been loaded, so resume stays out of SWMR mode. If readers need to
+ *        follow a resumed run live, reopen with H5F_ACC_SWMR_WRITE and
+ *        give up the fast open.
+ *
+ *      - The image holds what's in the cache at close time, so before
+ *        writing it we walk the chunk index to bring it all into the
+ *        cache. The cache is sized up first so it fits.
+ *
+ *      - Opening the file read/write reads the image and removes it from
+ *        the file; it has to be written again on close. Read-only opens
+ *        use it and leave it in place, so any number of readers get it.
+ *
+ *      - Older libraries (before 1.10.1) can't open a file that has a
+ *        cache image in it.
+ */
+
+#include <hdf5.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_mdc_image.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+const hsize_t CHUNK_SIZE = 256;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+/* Metadata cache size while the image is being built */
+const size_t IMAGE_CACHE_SIZE = 64 * 1024 * 1024;
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Drops the file from the page cache so opens hit the storage */
+void
+drop_page_cache(void)
+{
+    int fd;
+
+    if ((fd = open(FILE_NAME, O_RDONLY)) < 0)
+        return;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/********/
+/* HDF5 */
+/********/
+
+hid_t
+create_fapl(hbool_t generate_image)
+{
+    hid_t                     fapl_id = H5I_INVALID_HID;
+    H5AC_cache_image_config_t image_config;
+    H5AC_cache_config_t       mdc_config;
+
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    if (generate_image) {
+        /* Big enough to hold the whole chunk index */
+        mdc_config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+        if (H5Pget_mdc_config(fapl_id, &mdc_config) < 0)
+            goto badness;
+        mdc_config.set_initial_size = 1;
+        mdc_config.initial_size     = IMAGE_CACHE_SIZE;
+        mdc_config.max_size         = IMAGE_CACHE_SIZE;
+        mdc_config.incr_mode        = H5C_incr__off;
+        mdc_config.flash_incr_mode  = H5C_flash_incr__off;
+        mdc_config.decr_mode        = H5C_decr__off;
+        if (H5Pset_mdc_config(fapl_id, &mdc_config) < 0)
+            goto badness;
+
+        image_config.version            = H5AC__CURR_CACHE_IMAGE_CONFIG_VERSION;
+        image_config.generate_image     = 1;
+        image_config.save_resize_status = 0;
+        image_config.entry_ageout       = H5AC__CACHE_IMAGE__ENTRY_AGEOUT__NONE;
+        if (H5Pset_mdc_image_config(fapl_id, &image_config) < 0)
+            goto badness;
+    }
+
+    return fapl_id;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+    }
+    H5E_END_TRY;
+
+    return H5I_INVALID_HID;
+}
+
+herr_t
+setup(void)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = create_fapl(0)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+herr_t
+direct_write(hid_t did, hsize_t offset, int *buf, void *buf_out)
+{
+    size_t   buf_size    = CHUNK_SIZE * sizeof(int);
+    uLongf   z_destLen   = compressBound((uLong)buf_size);
+    uint32_t filter_mask = 0;
+
+    /* Synthetic data: a ramp */
+    if (offset / CHUNK_SIZE > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+        buf[i] = (int)((offset + i) % INT_MAX);
+
+    /* Compress the data using zlib */
+    int z_ret = compress2((Bytef *)buf_out, &z_destLen, (const Bytef *)buf, (uLong)buf_size, COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+    if (z_destLen >= buf_size) {
+        /* Incompressible, so store it raw, skipping deflate */
+        memcpy(buf_out, buf, buf_size);
+        z_destLen   = (uLongf)buf_size;
+        filter_mask = 0x1;
+    }
+
+    if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, (size_t)z_destLen, buf_out) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/* Walks the whole chunk index, which brings all of it into the metadata
+ * cache, and reads the last chunk the way a reader catching up would.
+ * Returns the number of chunks written, or -1.
+ *
+ * (H5Dget_num_chunks() visits every chunk in one pass; looking each one
+ * up by coordinate would visit the whole index every time.)
+ */
+int64_t
+walk_index(hid_t did)
+{
+    hid_t    sid      = H5I_INVALID_HID;
+    void    *buf      = NULL;
+    hsize_t  n_chunks = 0;
+    hsize_t  offset[RANK];
+    unsigned mask;
+    haddr_t  addr;
+    hsize_t  size;
+
+    if ((sid = H5Dget_space(did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Dget_num_chunks(did, sid, &n_chunks) < 0)
+        goto badness;
+
+    if (n_chunks > 0) {
+        if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+            goto badness;
+        if (H5Dget_chunk_info(did, sid, n_chunks - 1, offset, &mask, &addr, &size) < 0)
+            goto badness;
+        if (size > CHUNK_SIZE * sizeof(int))
+            goto badness;
+        if (H5Dread_chunk(did, H5P_DEFAULT, offset, &mask, buf) < 0)
+            goto badness;
+    }
+
+    if (H5Sclose(sid) < 0)
+        goto badness;
+
+    free(buf);
+
+    return (int64_t)n_chunks;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+    }
+    H5E_END_TRY;
+
+    free(buf);
+
+    return -1;
+}
+
+/* Reopens the closed file without SWMR, fills the cache and closes it
+ * again, leaving an image behind
+ */
+herr_t
+write_image(void)
+{
+    hid_t   fapl_id = H5I_INVALID_HID;
+    hid_t   fid     = H5I_INVALID_HID;
+    hid_t   did     = H5I_INVALID_HID;
+    haddr_t addr;
+    hsize_t size;
+    double  t0      = now_seconds();
+
+    if ((fapl_id = create_fapl(1)) == H5I_INVALID_HID)
+        goto badness;
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    if (walk_index(did) < 0)
+        goto badness;
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+    fid = H5I_INVALID_HID;
+
+    /* See what we got */
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDONLY, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Fget_mdc_image_info(fid, &addr, &size) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+
+    if (HADDR_UNDEF == addr) {
+        fprintf(stderr, "no cache image was written\n");
+        goto badness;
+    }
+
+    printf("CACHE IMAGE: %llu bytes at %llu (%.3f s)\n", (unsigned long long)size, (unsigned long long)addr,
+           now_seconds() - t0);
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+        H5Pclose(fapl_id);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Removes the image by opening the file read/write without asking for a
+ * new one
+ */
+herr_t
+remove_image(void)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    if ((fapl_id = create_fapl(0)) == H5I_INVALID_HID)
+        goto badness;
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* The image goes on the first metadata access */
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+        H5Pclose(fapl_id);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Opens the file read-only from a cold page cache and walks the index,
+ * the way a reader starting up would
+ */
+herr_t
+time_open(int n_opens, const char *label)
+{
+    hid_t   fid     = H5I_INVALID_HID;
+    hid_t   did     = H5I_INVALID_HID;
+    haddr_t addr;
+    hsize_t size;
+    double  t_open  = 0.0;
+    double  t_walk  = 0.0;
+    int64_t n       = 0;
+
+    for (int i = 0; i < n_opens; i++) {
+        double t0, t1;
+
+        drop_page_cache();
+
+        t0 = now_seconds();
+        if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDONLY, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+        if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+        t1 = now_seconds();
+        if ((n = walk_index(did)) < 0)
+            goto badness;
+        t_open += t1 - t0;
+        t_walk += now_seconds() - t1;
+
+        if (H5Fget_mdc_image_info(fid, &addr, &size) < 0)
+            goto badness;
+
+        if (H5Dclose(did) < 0)
+            goto badness;
+        if (H5Fclose(fid) < 0)
+            goto badness;
+    }
+
+    printf("%-14s image: %9llu bytes  chunks: %9lld  open: %8.3f ms  index walk: %8.3f ms\n", label,
+           (unsigned long long)size, (long long)n, 1000.0 * t_open / n_opens, 1000.0 * t_walk / n_opens);
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+bench(int n_opens)
+{
+    if (time_open(n_opens, "WITH IMAGE") < 0)
+        goto badness;
+    if (remove_image() < 0)
+        goto badness;
+    if (time_open(n_opens, "WITHOUT IMAGE") < 0)
+        goto badness;
+
+    /* Put it back */
+    if (write_image() < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    const char      *mode    = argc > 1 ? argv[1] : "write";
+    int              resume  = 0;
+    hid_t            fapl_id = H5I_INVALID_HID;
+    hid_t            fid     = H5I_INVALID_HID;
+    hid_t            did     = H5I_INVALID_HID;
+    int             *buf     = NULL;
+    void            *buf_out = NULL;
+
+    if (!strcmp(mode, "bench")) {
+        int n_opens = argc > 2 ? atoi(argv[2]) : 5;
+
+        if (n_opens < 1) {
+            fprintf(stderr, "n_opens must be at least 1\n");
+            goto badness;
+        }
+        if (bench(n_opens) < 0)
+            goto badness;
+
+        printf("DONE\n");
+
+        return EXIT_SUCCESS;
+    }
+    else if (!strcmp(mode, "resume"))
+        resume = 1;
+    else if (strcmp(mode, "write")) {
+        fprintf(stderr, "usage: %s [write|resume|bench] [n_opens]\n", argv[0]);
+        goto badness;
+    }
+
+    if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+    if (NULL == (buf_out = malloc((size_t)compressBound((uLong)(CHUNK_SIZE * sizeof(int))))))
+        goto badness;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+
+    if (resume) {
+        hid_t   sid = H5I_INVALID_HID;
+        hsize_t dims[RANK];
+        double  t0  = now_seconds();
+
+        /* Opened without SWMR, which is the only way the image gets used.
+         * The library won't switch to SWMR once an image has been loaded.
+         */
+        if ((fapl_id = create_fapl(0)) == H5I_INVALID_HID)
+            goto badness;
+        if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR, fapl_id)) == H5I_INVALID_HID)
+            goto badness;
+        if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+        if ((sid = H5Dget_space(did)) == H5I_INVALID_HID)
+            goto badness;
+        if (H5Sget_simple_extent_dims(sid, dims, NULL) < 0)
+            goto badness;
+        if (H5Sclose(sid) < 0)
+            goto badness;
+        n_chunks = (dims[0] + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+        printf("FILE REOPENED IN %.3f ms, RESUMING AT CHUNK %llu\n", 1000.0 * (now_seconds() - t0),
+               (unsigned long long)n_chunks);
+
+    }
+    else {
+        /* Set up file and dataset */
+        if (setup() < 0)
+            goto badness;
+
+        printf("FILE CREATION COMPLETE\n");
+
+        if ((fapl_id = create_fapl(0)) == H5I_INVALID_HID)
+            goto badness;
+        if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, fapl_id)) == H5I_INVALID_HID)
+            goto badness;
+        if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+    }
+
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    while (!stop) {
+
+        /* Extend by one chunk and write it
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+        if (extend_dataset(did, (n_chunks + 1) * CHUNK_SIZE) < 0)
+            goto badness;
+        if (direct_write(did, n_chunks * CHUNK_SIZE, buf, buf_out) < 0)
+            goto badness;
+
+        n_chunks += 1;
+
+        usleep(1000);
+    }
+
+    printf("WRITTEN: %llu chunks\n", (unsigned long long)n_chunks);
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+
+    /* Now that SWMR is done with, leave an image for whoever's next */
+    if (write_image() < 0)
+        goto badness;
+
+    free(buf);
+    free(buf_out);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+        H5Pclose(fapl_id);
+    }
+    H5E_END_TRY;
+
+    free(buf);
+    free(buf_out);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
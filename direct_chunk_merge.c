@@ -0,0 +1,429 @@
+/* direct_chunk_merge.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version is an offline tool that joins datasets from several files
+ * (say, the segments of one pulse) end to end into a new file. The chunks
+ * are copied as they're stored, with H5Dread_chunk() / H5Dwrite_chunk()
+ * at their new offsets, so nothing is ever decompressed or recompressed
+ * and the merge goes as fast as the disks do.
+ *
+ * To build:
+ *      h5cc -O2 -o merge direct_chunk_merge.c -lm
+ *
+ * - Does NOT require any particular filter (the chunks are never decoded)
+ * - Does NOT require zlib
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./merge [-d dataset] <out.h5> <in.h5> [in.h5 ...]
+ *
+ *      - Joins dataset (default "data") from each input, in order, along
+ *        the first dimension into out.h5, which is overwritten
+ *      - e.g. ./merge pulse.h5 direct_chunk_vds_0.h5 direct_chunk_vds_1.h5
+ *
+ * What the inputs must have in common:
+ *
+ *      Since the chunks are copied as they are, the inputs have to agree
+ *      on everything that goes into a chunk's bytes: the type, the chunk
+ *      shape, the filters and their settings, and the fill value. All
+ *      dimensions but the first have to match too.
+ *
+ *      Every input but the last also has to end on a chunk boundary in
+ *      the first dimension. A partial last chunk is padded out, and the
+ *      padding would land in the middle of the merged dataset. Rewriting
+ *      it would mean decompressing; direct_chunk_rechunk.c can do that
+ *      if you need it.
+ *
+ * The merged dataset gets the first input's creation properties. Its
+ * first dimension is unlimited if any input's was, and otherwise fixed at
+ * the total. Chunks that were never written in an input aren't written in
+ * the output either, so they still read as the fill value. Chunks are
+ * found and counted the same way as in direct_chunk_recompress.c.
+ */
+
+#include <hdf5.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Some global constants */
+
+const char *DEFAULT_DSET_NAME = "data";
+
+#define MAX_CD_VALUES 32
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* What we need to know about an input */
+typedef struct {
+    const char *file_name;
+    hid_t       fid;
+    hid_t       did;
+    hid_t       tid;
+    hid_t       dcpl_id;
+    int         rank;
+    hsize_t     dims[H5S_MAX_RANK];
+    hsize_t     max_dims[H5S_MAX_RANK];
+    hsize_t     chunk_dims[H5S_MAX_RANK];
+    hsize_t     n_chunks;
+} input_t;
+
+herr_t
+input_open(input_t *in, const char *file_name, const char *dset_name)
+{
+    hid_t sid = H5I_INVALID_HID;
+
+    in->file_name = file_name;
+
+    if ((in->fid = H5Fopen(file_name, H5F_ACC_RDONLY, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((in->did = H5Dopen2(in->fid, dset_name, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((in->tid = H5Dget_type(in->did)) == H5I_INVALID_HID)
+        goto badness;
+    if ((in->dcpl_id = H5Dget_create_plist(in->did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5D_CHUNKED != H5Pget_layout(in->dcpl_id)) {
+        fprintf(stderr, "%s: %s isn't chunked\n", file_name, dset_name);
+        goto badness;
+    }
+    if (H5Pget_chunk(in->dcpl_id, H5S_MAX_RANK, in->chunk_dims) < 0)
+        goto badness;
+
+    if ((sid = H5Dget_space(in->did)) == H5I_INVALID_HID)
+        goto badness;
+    if ((in->rank = H5Sget_simple_extent_dims(sid, in->dims, in->max_dims)) < 0)
+        goto badness;
+    if (H5Dget_num_chunks(in->did, sid, &in->n_chunks) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+void
+input_close(input_t *in)
+{
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(in->dcpl_id);
+        H5Tclose(in->tid);
+        H5Dclose(in->did);
+        H5Fclose(in->fid);
+    }
+    H5E_END_TRY;
+
+    in->fid = in->did = in->tid = in->dcpl_id = H5I_INVALID_HID;
+}
+
+/* Checks that two inputs store their chunks the same way. Returns 1 if
+ * they do, 0 if they don't (saying why), or -1 on error.
+ */
+int
+same_layout(const input_t *a, const input_t *b)
+{
+    int           n_filters;
+    unsigned char fill_a[64];
+    unsigned char fill_b[64];
+    htri_t        equal;
+    size_t        size;
+
+    if ((equal = H5Tequal(a->tid, b->tid)) < 0)
+        return -1;
+    if (!equal) {
+        fprintf(stderr, "%s and %s have different types\n", a->file_name, b->file_name);
+        return 0;
+    }
+
+    if (a->rank != b->rank) {
+        fprintf(stderr, "%s and %s have different ranks\n", a->file_name, b->file_name);
+        return 0;
+    }
+    for (int d = 0; d < a->rank; d++) {
+        if (a->chunk_dims[d] != b->chunk_dims[d]) {
+            fprintf(stderr, "%s and %s have different chunk shapes\n", a->file_name, b->file_name);
+            return 0;
+        }
+        if (d > 0 && a->dims[d] != b->dims[d]) {
+            fprintf(stderr, "%s and %s differ in dimension %d\n", a->file_name, b->file_name, d);
+            return 0;
+        }
+    }
+
+    /* Filters, in order, with the same settings */
+    if ((n_filters = H5Pget_nfilters(a->dcpl_id)) < 0)
+        return -1;
+    if (n_filters != H5Pget_nfilters(b->dcpl_id)) {
+        fprintf(stderr, "%s and %s have different filters\n", a->file_name, b->file_name);
+        return 0;
+    }
+    for (int i = 0; i < n_filters; i++) {
+        unsigned     flags_a, flags_b;
+        size_t       n_a = MAX_CD_VALUES, n_b = MAX_CD_VALUES;
+        unsigned     values_a[MAX_CD_VALUES], values_b[MAX_CD_VALUES];
+        H5Z_filter_t filter_a, filter_b;
+
+        if ((filter_a = H5Pget_filter2(a->dcpl_id, (unsigned)i, &flags_a, &n_a, values_a, 0, NULL, NULL)) < 0)
+            return -1;
+        if ((filter_b = H5Pget_filter2(b->dcpl_id, (unsigned)i, &flags_b, &n_b, values_b, 0, NULL, NULL)) < 0)
+            return -1;
+        if (n_a > MAX_CD_VALUES || n_b > MAX_CD_VALUES) {
+            fprintf(stderr, "filter %d has too many parameters to compare\n", (int)filter_a);
+            return -1;
+        }
+        if (filter_a != filter_b || flags_a != flags_b || n_a != n_b ||
+            memcmp(values_a, values_b, n_a * sizeof(unsigned))) {
+            fprintf(stderr, "%s and %s have different filters\n", a->file_name, b->file_name);
+            return 0;
+        }
+    }
+
+    /* Fill value, in the file's type */
+    size = H5Tget_size(a->tid);
+    if (size > sizeof(fill_a)) {
+        fprintf(stderr, "type is too big to compare fill values\n");
+        return -1;
+    }
+    memset(fill_a, 0, sizeof(fill_a));
+    memset(fill_b, 0, sizeof(fill_b));
+    if (H5Pget_fill_value(a->dcpl_id, a->tid, fill_a) < 0 || H5Pget_fill_value(b->dcpl_id, b->tid, fill_b) < 0)
+        return -1;
+    if (memcmp(fill_a, fill_b, size)) {
+        fprintf(stderr, "%s and %s have different fill values\n", a->file_name, b->file_name);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Copies all of an input's chunks into the output, shifted by base along
+ * the first dimension
+ */
+herr_t
+copy_chunks(const input_t *in, hid_t out_did, hsize_t base, void **buf, size_t *buf_size, uint64_t *n_bytes)
+{
+    hsize_t  offset[H5S_MAX_RANK];
+    hsize_t  out_offset[H5S_MAX_RANK];
+    uint64_t n_copied = 0;
+    int      more     = 1;
+
+    memset(offset, 0, sizeof(offset));
+    for (int d = 0; d < in->rank; d++)
+        if (0 == in->dims[d])
+            more = 0;
+
+    while (more) {
+        hsize_t size = 0;
+        herr_t  found;
+        int     d;
+
+        /* Fails for chunks that were never written */
+        H5E_BEGIN_TRY
+        {
+            found = H5Dget_chunk_storage_size(in->did, offset, &size);
+        }
+        H5E_END_TRY;
+
+        if (found >= 0 && size > 0) {
+            uint32_t filter_mask = 0;
+
+            if (size > *buf_size) {
+                void *tmp;
+
+                if (NULL == (tmp = realloc(*buf, (size_t)size)))
+                    goto badness;
+                *buf      = tmp;
+                *buf_size = (size_t)size;
+            }
+            if (H5Dread_chunk(in->did, H5P_DEFAULT, offset, &filter_mask, *buf) < 0)
+                goto badness;
+
+            memcpy(out_offset, offset, sizeof(hsize_t) * (size_t)in->rank);
+            out_offset[0] += base;
+            if (H5Dwrite_chunk(out_did, H5P_DEFAULT, filter_mask, out_offset, (size_t)size, *buf) < 0)
+                goto badness;
+
+            n_copied++;
+            *n_bytes += size;
+        }
+
+        /* Next chunk in the grid */
+        for (d = in->rank - 1; d >= 0; d--) {
+            offset[d] += in->chunk_dims[d];
+            if (offset[d] < in->dims[d])
+                break;
+            offset[d] = 0;
+        }
+        if (d < 0)
+            more = 0;
+    }
+
+    if (n_copied != in->n_chunks) {
+        fprintf(stderr, "%s: copied %llu chunks but it has %llu\n", in->file_name, (unsigned long long)n_copied,
+                (unsigned long long)in->n_chunks);
+        goto badness;
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *dset_name = DEFAULT_DSET_NAME;
+    const char *out_name;
+    input_t    *inputs    = NULL;
+    int         n_inputs;
+    int         first_arg = 1;
+    hid_t       fapl_id   = H5I_INVALID_HID;
+    hid_t       fid       = H5I_INVALID_HID;
+    hid_t       sid       = H5I_INVALID_HID;
+    hid_t       did       = H5I_INVALID_HID;
+    hsize_t     dims[H5S_MAX_RANK];
+    hsize_t     max_dims[H5S_MAX_RANK];
+    hsize_t     base      = 0;
+    uint64_t    n_chunks  = 0;
+    uint64_t    n_bytes   = 0;
+    void       *buf       = NULL;
+    size_t      buf_size  = 0;
+    double      t_start;
+
+    if (argc > 2 && !strcmp(argv[1], "-d")) {
+        dset_name = argv[2];
+        first_arg = 3;
+    }
+    if (argc - first_arg < 2) {
+        fprintf(stderr, "usage: %s [-d dataset] <out.h5> <in.h5> [in.h5 ...]\n", argv[0]);
+        goto badness;
+    }
+    out_name = argv[first_arg];
+    n_inputs = argc - first_arg - 1;
+
+    if (NULL == (inputs = calloc((size_t)n_inputs, sizeof(input_t))))
+        goto badness;
+    for (int i = 0; i < n_inputs; i++)
+        inputs[i].fid = inputs[i].did = inputs[i].tid = inputs[i].dcpl_id = H5I_INVALID_HID;
+
+    /* Open and check everything before writing anything */
+    for (int i = 0; i < n_inputs; i++) {
+        input_t *in = &inputs[i];
+
+        if (input_open(in, argv[first_arg + 1 + i], dset_name) < 0)
+            goto badness;
+        if (i > 0 && same_layout(&inputs[0], in) != 1)
+            goto badness;
+        if (i < n_inputs - 1 && in->dims[0] % in->chunk_dims[0]) {
+            fprintf(stderr, "%s doesn't end on a chunk boundary (%llu isn't a multiple of %llu)\n", in->file_name,
+                    (unsigned long long)in->dims[0], (unsigned long long)in->chunk_dims[0]);
+            goto badness;
+        }
+    }
+
+    /* The merged extent */
+    memcpy(dims, inputs[0].dims, sizeof(dims));
+    memcpy(max_dims, inputs[0].max_dims, sizeof(max_dims));
+    dims[0] = 0;
+    for (int i = 0; i < n_inputs; i++)
+        dims[0] += inputs[i].dims[0];
+    max_dims[0] = dims[0];
+    for (int i = 0; i < n_inputs; i++)
+        if (H5S_UNLIMITED == inputs[i].max_dims[0])
+            max_dims[0] = H5S_UNLIMITED;
+
+    /* Output */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+    if ((fid = H5Fcreate(out_name, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+    if ((sid = H5Screate_simple(inputs[0].rank, dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dcreate2(fid, dset_name, inputs[0].tid, sid, H5P_DEFAULT, inputs[0].dcpl_id, H5P_DEFAULT)) ==
+        H5I_INVALID_HID)
+        goto badness;
+
+    printf("MERGING %d FILES, %llu ROWS\n", n_inputs, (unsigned long long)dims[0]);
+
+    t_start = now_seconds();
+    for (int i = 0; i < n_inputs; i++) {
+        input_t *in = &inputs[i];
+
+        if (copy_chunks(in, did, base, &buf, &buf_size, &n_bytes) < 0)
+            goto badness;
+        printf("  %s: %llu chunks at row %llu\n", in->file_name, (unsigned long long)in->n_chunks,
+               (unsigned long long)base);
+
+        base += in->dims[0];
+        n_chunks += in->n_chunks;
+        input_close(in);
+    }
+
+    printf("COPIED: %llu chunks, %llu bytes in %.3f s\n", (unsigned long long)n_chunks,
+           (unsigned long long)n_bytes, now_seconds() - t_start);
+
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+
+    free(inputs);
+    free(buf);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    if (inputs)
+        for (int i = 0; i < n_inputs; i++)
+            input_close(&inputs[i]);
+
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+        H5Dclose(did);
+        H5Fclose(fid);
+        H5Pclose(fapl_id);
+    }
+    H5E_END_TRY;
+
+    free(inputs);
+    free(buf);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
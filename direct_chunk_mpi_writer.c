@@ -0,0 +1,428 @@
+/* direct_chunk_mpi_writer.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version uses MPI so that several ranks share the compression work
+ * and their chunks all go into one shared file
+ *
+ * To build:
+ *      HDF5_CC=mpicc HDF5_CLINKER=mpicc h5cc -o mpi_writer direct_chunk_mpi_writer.c -lm -lz
+ *
+ * - DOES require MPI
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require a parallel (MPI) build of HDF5
+ *
+ * To run:
+ *      mpiexec -n 4 ./mpi_writer [n_steps]
+ *
+ *      - Every step, each rank generates and compresses one 10-integer
+ *        chunk, so the dataset grows by n_ranks chunks per second
+ *      - n_steps stops the program after that many steps (0, the default,
+ *        runs until signalled)
+ *      - ctrl-c / SIGTERM to any rank stops every rank at the end of
+ *        the current step (mpiexec usually kills the job on ctrl-c, so
+ *        prefer n_steps under mpiexec)
+ *      - The file is written in SWMR mode, so readers can follow it
+ *
+ * How the work is split:
+ *
+ *      Each rank compresses only its own chunk, and the compressed sizes
+ *      and bytes are gathered on rank 0 with MPI_Gatherv. Rank 0 is the
+ *      only process that opens the file and it writes every chunk.
+ *      Compression is the expensive part and it is what scales with the
+ *      number of ranks. The gather only moves compressed bytes.
+ *
+ *      Why not have every rank write through parallel HDF5? Writing a
+ *      chunk with H5Dwrite_chunk also inserts it into the chunk index.
+ *      That's a metadata change, and in parallel HDF5 every rank has to
+ *      make each metadata change with the same arguments. So every rank
+ *      ends up writing every chunk's bytes, N copies of the same raw I/O
+ *      instead of one. With chunks already compressed, the single writer
+ *      is only moving bytes, and that's rarely the bottleneck. If it is,
+ *      this layout also lets the writer rank sit on the node nearest the
+ *      storage.
+ */
+
+#include <hdf5.h>
+#include <limits.h>
+#include <math.h>
+#include <mpi.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_mpi.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+/* SO SMALL - Don't make chunks this size in real code! */
+const hsize_t CHUNK_SIZE = 10;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+/* The rank that owns the file */
+#define WRITER_RANK 0
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+herr_t
+setup(void)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/* Fills and compresses one chunk on this rank
+ *
+ * On success, *buf_out is a malloc'd buffer holding *out_size bytes of
+ * compressed data.
+ */
+herr_t
+compress_chunk(hsize_t offset, unsigned char **buf_out, size_t *out_size)
+{
+    int    *buf = NULL;
+    size_t  buf_size;
+    size_t  buf_out_size;
+    int     value; /* The data value we're writing to the buffer */
+
+    *buf_out = NULL;
+
+    /* Buffer sizes
+     * The output buffer has to be larger than the input buffer in case
+     * the compression is inefficient. The compress2() docs give a formula
+     * to determine the minimum size.
+     */
+    buf_size     = CHUNK_SIZE * sizeof(int);
+    buf_out_size = (size_t)ceil(buf_size * 1.001) + 12;
+
+    /* For synthetic data, we just fill the chunk with the chunk number.
+     * That should make it easy to spot screwups.
+     */
+    if (offset / CHUNK_SIZE > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+    value = (int)(offset / CHUNK_SIZE);
+    if (NULL == (buf = malloc(buf_size)))
+        goto badness;
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+        buf[i] = value;
+
+    if (NULL == (*buf_out = malloc(buf_out_size)))
+        goto badness;
+
+    /* Compress the data using zlib */
+    uLongf z_destLen = (uLongf)buf_out_size;
+    int    z_ret     = compress2((Bytef *)*buf_out, &z_destLen, (const Bytef *)buf, (uLong)buf_size,
+                                 COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    /* Check to make sure the compressed buffer size isn't bigger than the
+     * chunk size.
+     */
+    if (z_destLen > buf_size) {
+        fprintf(stderr, "can't write chunk data that is larger than the chunk\n");
+        fprintf(stderr, "in: %zu   out: %lu\n", buf_size, (unsigned long)z_destLen);
+        goto badness;
+    }
+
+    *out_size = (size_t)z_destLen;
+
+    free(buf);
+
+    return SUCCEED;
+
+badness:
+    free(buf);
+    free(*buf_out);
+    *buf_out = NULL;
+    return FAIL;
+}
+
+/* Compresses this rank's chunk and gathers every rank's compressed chunk
+ * on the writer rank, which extends the dataset and writes them all
+ *
+ * first_offset is the dataset offset of rank 0's chunk. Rank r's chunk
+ * lives at first_offset + r * CHUNK_SIZE. did is only used on the writer
+ * rank.
+ */
+herr_t
+parallel_direct_write(MPI_Comm comm, hid_t did, hsize_t first_offset)
+{
+    unsigned char *my_buf   = NULL;
+    unsigned char *all_bufs = NULL;
+    int           *sizes    = NULL;
+    int           *displs   = NULL;
+    size_t         my_size  = 0;
+    uint32_t       filter_mask = 0; /* We're not skipping any filters */
+    int            mpi_rank;
+    int            mpi_size;
+    int            my_size_int;
+    int            total = 0;
+
+    MPI_Comm_rank(comm, &mpi_rank);
+    MPI_Comm_size(comm, &mpi_size);
+
+    /* The expensive part - done in parallel */
+    if (compress_chunk(first_offset + (hsize_t)mpi_rank * CHUNK_SIZE, &my_buf, &my_size) < 0)
+        goto badness;
+    if (my_size > INT_MAX)
+        goto badness;
+    my_size_int = (int)my_size;
+
+    /* The writer needs everyone's sizes... */
+    if (WRITER_RANK == mpi_rank) {
+        if (NULL == (sizes = malloc((size_t)mpi_size * sizeof(int))))
+            goto badness;
+        if (NULL == (displs = malloc((size_t)mpi_size * sizeof(int))))
+            goto badness;
+    }
+    if (MPI_SUCCESS != MPI_Gather(&my_size_int, 1, MPI_INT, sizes, 1, MPI_INT, WRITER_RANK, comm))
+        goto badness;
+    if (WRITER_RANK == mpi_rank) {
+        for (int r = 0; r < mpi_size; r++) {
+            if (sizes[r] > INT_MAX - total)
+                goto badness;
+            displs[r] = total;
+            total += sizes[r];
+        }
+        if (NULL == (all_bufs = malloc((size_t)total)))
+            goto badness;
+    }
+
+    /* ...and bytes */
+    if (MPI_SUCCESS !=
+        MPI_Gatherv(my_buf, my_size_int, MPI_BYTE, all_bufs, sizes, displs, MPI_BYTE, WRITER_RANK, comm))
+        goto badness;
+
+    if (WRITER_RANK == mpi_rank) {
+        /* Extend by one chunk per rank
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+        if (extend_dataset(did, first_offset + (hsize_t)mpi_size * CHUNK_SIZE) < 0)
+            goto badness;
+
+        /* Write the compressed data to the chunks */
+        for (int r = 0; r < mpi_size; r++) {
+            hsize_t offset = first_offset + (hsize_t)r * CHUNK_SIZE;
+
+            if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, (size_t)sizes[r], all_bufs + displs[r]) < 0)
+                goto badness;
+        }
+    }
+
+    free(my_buf);
+    free(all_bufs);
+    free(sizes);
+    free(displs);
+
+    return SUCCEED;
+
+badness:
+    free(my_buf);
+    free(all_bufs);
+    free(sizes);
+    free(displs);
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    MPI_Comm         comm     = MPI_COMM_WORLD;
+    int              mpi_rank = 0;
+    int              mpi_size = 1;
+    unsigned long    n_steps  = 0;
+    int              ok       = 1;
+
+    hid_t fid = H5I_INVALID_HID;
+    hid_t did = H5I_INVALID_HID;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(comm, &mpi_rank);
+    MPI_Comm_size(comm, &mpi_size);
+
+    if (argc > 1)
+        n_steps = strtoul(argv[1], NULL, 10);
+
+    /* Catch ctrl-c (every rank's flag counts, see the MPI_MAX below) */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* Set up file and dataset. Only the writer touches the file, but
+     * everyone has to know whether it worked.
+     */
+    if (WRITER_RANK == mpi_rank) {
+        ok = 0;
+        if (setup() >= 0 &&
+            (fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) != H5I_INVALID_HID &&
+            (did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) != H5I_INVALID_HID)
+            ok = 1;
+    }
+    if (MPI_SUCCESS != MPI_Bcast(&ok, 1, MPI_INT, WRITER_RANK, comm) || !ok)
+        goto badness;
+
+    if (WRITER_RANK == mpi_rank) {
+        printf("FILE CREATION COMPLETE\n");
+        printf("%d RANKS COMPRESSING, RANK %d WRITING\n", mpi_size, WRITER_RANK);
+        printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+    }
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+    unsigned long step = 0;
+
+    for (;;) {
+        int local_stop = stop;
+        int global_stop = 0;
+
+        if (n_steps && step >= n_steps)
+            local_stop = 1;
+
+        /* Everyone stops together or the gathers will hang */
+        if (MPI_SUCCESS != MPI_Allreduce(&local_stop, &global_stop, 1, MPI_INT, MPI_MAX, comm))
+            goto badness;
+        if (global_stop)
+            break;
+
+        /* The write offset of rank 0's chunk */
+        hsize_t write_offset = n_chunks * CHUNK_SIZE;
+
+        if (parallel_direct_write(comm, did, write_offset) < 0)
+            goto badness;
+
+        n_chunks += (uint64_t)mpi_size;
+        step++;
+
+        sleep(1);
+    }
+
+    if (WRITER_RANK == mpi_rank) {
+        if (H5Dclose(did) < 0)
+            goto badness;
+        if (H5Fclose(fid) < 0)
+            goto badness;
+
+        printf("DONE (%llu chunks)\n", (unsigned long long)n_chunks);
+    }
+
+    MPI_Finalize();
+
+    return EXIT_SUCCESS;
+
+badness:
+    printf("BADNESS (rank %d)\n", mpi_rank);
+
+    MPI_Abort(comm, EXIT_FAILURE);
+
+    return EXIT_FAILURE;
+}
@@ -152,7 +152,7 @@ direct_write(hid_t did, hsize_t offset)
     }
     if (NULL == (buf = malloc(buf_size * sizeof(char))))
         goto badness;
-    for (int i = 0; i < CHUNK_SIZE; i++)
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
         buf[i] = value;
 
     /* Write the data to the chunk */
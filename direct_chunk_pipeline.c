@@ -0,0 +1,1180 @@
+/* direct_chunk_pipeline.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version runs an asynchronous pipeline: producer threads generate
+ * chunks for several datasets, a pool of worker threads compresses them
+ * and the main thread writes them. All the chunk data in flight is kept
+ * under a memory budget, and chunks from more important datasets jump
+ * the queue.
+ *
+ * To build:
+ *      h5cc -O2 -o pipeline direct_chunk_pipeline.c -lm -lz -lpthread
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library (only the main thread
+ *   makes HDF5 calls)
+ *
+ * To run:
+ *      ./pipeline [budget_MiB] [block|drop|spill] [n_workers]
+ *
+ *      - It writes three datasets, each fed by its own producer thread:
+ *          protection  critical priority, a 4 KiB chunk every 10 ms
+ *          magnetics   normal priority, a 64 KiB chunk every 50 ms
+ *          camera      bulk priority, bursts of 1 MiB chunks faster
+ *                      than they can be compressed, then a pause
+ *      - budget_MiB (default 64) caps the raw + compressed chunk data
+ *        held in the queues at any time
+ *      - What happens when a new chunk doesn't fit in the budget:
+ *          block   the producer waits for memory to be freed (default)
+ *          drop    the oldest waiting chunk of the same or lower
+ *                  priority is thrown away. The dataset has a hole
+ *                  there, which reads as the fill value.
+ *          spill   the raw chunk goes to a temporary file and is read
+ *                  back when a worker is ready for it
+ *      - ctrl-c stops the program and prints the counters
+ *
+ * The budget:
+ *
+ *      A chunk is charged for its raw size plus the worst-case compressed
+ *      size when it's produced, since compressing it needs both buffers.
+ *      After compression the charge drops to the size actually stored.
+ *      Only the producers wait for memory, so a worker can never be stuck
+ *      waiting on memory that only it could free.
+ *
+ *      Lower priorities can only fill part of the budget (see
+ *      BUDGET_SHARE_PERCENT), so a camera burst can't leave the
+ *      protection channel waiting for memory.
+ *
+ *      In spill mode, reading a chunk back needs memory too. One chunk per
+ *      worker is held back from the producers for that, so reloads never
+ *      wait and the total still stays within the budget.
+ *
+ * Priorities:
+ *
+ *      Both queues (producers -> workers and workers -> writer) have one
+ *      lane per priority and always serve the most important non-empty
+ *      lane. A lane that's been passed over STARVATION_LIMIT times in a
+ *      row is served next regardless, so bulk data keeps moving, just
+ *      more slowly.
+ */
+
+#include <hdf5.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_pipeline.h5";
+
+#define RANK 1
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+#define MAX_WORKERS 64
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+/* Priority classes, most important first */
+typedef enum {
+    PRIORITY_CRITICAL,
+    PRIORITY_NORMAL,
+    PRIORITY_BULK,
+    N_PRIORITIES
+} priority_t;
+
+const char *PRIORITY_NAMES[N_PRIORITIES] = {"critical", "normal", "bulk"};
+
+/* How much of the producers' budget each priority may fill */
+const unsigned BUDGET_SHARE_PERCENT[N_PRIORITIES] = {100, 90, 75};
+
+/* A waiting lane is served after being passed over this many times */
+const unsigned STARVATION_LIMIT = 8;
+
+/* One dataset and the producer that feeds it
+ *
+ * The producer makes burst_chunks chunks, interval_us apart, then waits
+ * pause_s before the next burst. burst_chunks == 0 means no bursts, just
+ * a chunk every interval_us.
+ */
+typedef struct {
+    const char *name;
+    priority_t  priority;
+    hsize_t     chunk_size; /* In ints */
+    unsigned    interval_us;
+    unsigned    burst_chunks;
+    unsigned    pause_s;
+} stream_t;
+
+const stream_t STREAMS[] = {
+    {"protection", PRIORITY_CRITICAL, 1024, 10000, 0, 0},
+    {"magnetics", PRIORITY_NORMAL, 16 * 1024, 50000, 0, 0},
+    {"camera", PRIORITY_BULK, 256 * 1024, 1000, 200, 2},
+};
+
+#define N_STREAMS (sizeof(STREAMS) / sizeof(STREAMS[0]))
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**********/
+/* Chunks */
+/**********/
+
+/* One chunk on its way through the pipeline */
+typedef struct chunk_t {
+    struct chunk_t *next;
+    const stream_t *stream;       /* Which dataset it belongs to */
+    uint64_t        index;        /* Chunk number in the dataset */
+    double          t_produced;   /* For measuring queueing delay */
+    int            *raw;          /* Raw data, NULL while spilled or once compressed */
+    off_t           spill_offset; /* Raw data location in the spill file, or -1 */
+    void           *out;          /* Data to write */
+    size_t          out_size;
+    uint32_t        filter_mask;
+    size_t          charge;       /* Bytes charged against the budget */
+} chunk_t;
+
+size_t
+raw_chunk_bytes(const stream_t *stream)
+{
+    return (size_t)stream->chunk_size * sizeof(int);
+}
+
+/* What a chunk is charged before it's compressed */
+size_t
+full_chunk_charge(const stream_t *stream)
+{
+    return raw_chunk_bytes(stream) + (size_t)compressBound((uLong)raw_chunk_bytes(stream));
+}
+
+void
+chunk_free(chunk_t *chunk)
+{
+    if (chunk) {
+        free(chunk->raw);
+        free(chunk->out);
+        free(chunk);
+    }
+}
+
+/**********/
+/* Queues */
+/**********/
+
+/* A FIFO for one priority */
+typedef struct {
+    chunk_t *head;
+    chunk_t *tail;
+    size_t   length;
+    unsigned passed_over; /* Pops that skipped this lane while it had chunks */
+    uint64_t n_promoted;  /* Times it was served because it was starving */
+} lane_t;
+
+/* Queue of chunks with one lane per priority that threads can wait on */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    lane_t          lanes[N_PRIORITIES];
+    size_t          length;
+    int             closed; /* No more pushes; pops drain what's left */
+} queue_t;
+
+void
+queue_init(queue_t *q)
+{
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+void
+queue_destroy(queue_t *q)
+{
+    for (int pri = 0; pri < N_PRIORITIES; pri++)
+        while (q->lanes[pri].head) {
+            chunk_t *chunk = q->lanes[pri].head;
+
+            q->lanes[pri].head = chunk->next;
+            chunk_free(chunk);
+        }
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+}
+
+void
+queue_push(queue_t *q, chunk_t *chunk)
+{
+    lane_t *lane = &q->lanes[chunk->stream->priority];
+
+    chunk->next = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    if (lane->tail)
+        lane->tail->next = chunk;
+    else
+        lane->head = chunk;
+    lane->tail = chunk;
+    lane->length++;
+    q->length++;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* Call with the mutex held */
+static chunk_t *
+lane_pop(queue_t *q, lane_t *lane)
+{
+    chunk_t *chunk = lane->head;
+
+    lane->head = chunk->next;
+    if (NULL == lane->head)
+        lane->tail = NULL;
+    lane->length--;
+    lane->passed_over = 0;
+    q->length--;
+
+    return chunk;
+}
+
+/* Picks the lane to serve next. Call with the mutex held and the queue
+ * not empty.
+ */
+static lane_t *
+queue_next_lane(queue_t *q)
+{
+    lane_t *best = NULL;
+
+    /* A starving lane goes first, lowest priority first since it's the
+     * one most likely to be starved
+     */
+    for (int pri = N_PRIORITIES - 1; pri >= 0; pri--)
+        if (q->lanes[pri].length && q->lanes[pri].passed_over >= STARVATION_LIMIT) {
+            q->lanes[pri].n_promoted++;
+            best = &q->lanes[pri];
+            break;
+        }
+
+    /* Otherwise the most important lane with anything in it */
+    if (NULL == best)
+        for (int pri = 0; pri < N_PRIORITIES; pri++)
+            if (q->lanes[pri].length) {
+                best = &q->lanes[pri];
+                break;
+            }
+
+    /* Everyone else with chunks waiting got passed over */
+    for (int pri = 0; pri < N_PRIORITIES; pri++)
+        if (&q->lanes[pri] != best && q->lanes[pri].length)
+            q->lanes[pri].passed_over++;
+
+    return best;
+}
+
+/* Removes the oldest chunk of priority max_priority or lower, starting
+ * with the least important, without waiting. Returns NULL if there's
+ * nothing that qualifies.
+ */
+chunk_t *
+queue_try_pop_lowest(queue_t *q, priority_t max_priority)
+{
+    chunk_t *chunk = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    for (int pri = N_PRIORITIES - 1; pri >= (int)max_priority; pri--)
+        if (q->lanes[pri].length) {
+            chunk = lane_pop(q, &q->lanes[pri]);
+            break;
+        }
+    pthread_mutex_unlock(&q->mutex);
+
+    return chunk;
+}
+
+/* Removes the next chunk in priority order, waiting for one if need be.
+ * Returns NULL once the queue is closed and empty.
+ */
+chunk_t *
+queue_pop(queue_t *q)
+{
+    chunk_t *chunk = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    while (0 == q->length && !q->closed)
+        pthread_cond_wait(&q->cond, &q->mutex);
+    if (q->length)
+        chunk = lane_pop(q, queue_next_lane(q));
+    pthread_mutex_unlock(&q->mutex);
+
+    return chunk;
+}
+
+void
+queue_close(queue_t *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/**********/
+/* Budget */
+/**********/
+
+/* What to do when a new chunk doesn't fit */
+typedef enum {
+    OVER_BUDGET_BLOCK,
+    OVER_BUDGET_DROP_OLDEST,
+    OVER_BUDGET_SPILL
+} over_budget_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    over_budget_t   policy;
+    size_t          limit;   /* Budget in bytes */
+    size_t          reserve; /* Part of the budget the producers can't use */
+    size_t          in_use;
+    size_t          peak;
+
+    /* Counters, per priority */
+    uint64_t n_blocked[N_PRIORITIES];       /* Times a producer had to wait */
+    double   blocked_seconds[N_PRIORITIES]; /* ...and for how long in total */
+    uint64_t n_dropped[N_PRIORITIES];
+    uint64_t n_spilled[N_PRIORITIES];
+    uint64_t spilled_bytes[N_PRIORITIES];
+} budget_t;
+
+void
+budget_init(budget_t *b, size_t limit, size_t reserve, over_budget_t policy)
+{
+    memset(b, 0, sizeof(*b));
+    pthread_mutex_init(&b->mutex, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    b->limit   = limit;
+    b->reserve = reserve;
+    b->policy  = policy;
+}
+
+void
+budget_destroy(budget_t *b)
+{
+    pthread_mutex_destroy(&b->mutex);
+    pthread_cond_destroy(&b->cond);
+}
+
+/* How far a producer of this priority may fill the budget */
+static size_t
+budget_producer_limit(const budget_t *b, priority_t priority)
+{
+    return (b->limit - b->reserve) / 100 * BUDGET_SHARE_PERCENT[priority];
+}
+
+/* Call with the mutex held */
+static void
+budget_take(budget_t *b, size_t bytes)
+{
+    b->in_use += bytes;
+    if (b->in_use > b->peak)
+        b->peak = b->in_use;
+}
+
+/* Charges bytes if they fit in the producer's share of the budget.
+ * Returns nonzero on success.
+ */
+int
+budget_try_acquire(budget_t *b, size_t bytes, priority_t priority)
+{
+    int ok;
+
+    pthread_mutex_lock(&b->mutex);
+    if ((ok = (b->in_use + bytes <= budget_producer_limit(b, priority))))
+        budget_take(b, bytes);
+    pthread_mutex_unlock(&b->mutex);
+
+    return ok;
+}
+
+/* Charges bytes for a producer, waiting until they fit */
+void
+budget_acquire(budget_t *b, size_t bytes, priority_t priority)
+{
+    size_t limit = budget_producer_limit(b, priority);
+
+    pthread_mutex_lock(&b->mutex);
+    if (b->in_use + bytes > limit) {
+        double start = now_seconds();
+
+        b->n_blocked[priority]++;
+        while (b->in_use + bytes > limit)
+            pthread_cond_wait(&b->cond, &b->mutex);
+        b->blocked_seconds[priority] += now_seconds() - start;
+    }
+    budget_take(b, bytes);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+/* Charges bytes for a spill reload, which may use the reserve */
+void
+budget_acquire_reserved(budget_t *b, size_t bytes)
+{
+    pthread_mutex_lock(&b->mutex);
+    while (b->in_use + bytes > b->limit)
+        pthread_cond_wait(&b->cond, &b->mutex);
+    budget_take(b, bytes);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+void
+budget_release(budget_t *b, size_t bytes)
+{
+    pthread_mutex_lock(&b->mutex);
+    b->in_use -= bytes;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+void
+budget_count(budget_t *b, uint64_t *counter, uint64_t n)
+{
+    pthread_mutex_lock(&b->mutex);
+    *counter += n;
+    pthread_mutex_unlock(&b->mutex);
+}
+
+/**************/
+/* Spill file */
+/**************/
+
+/* Raw chunks that didn't fit in memory
+ *
+ * Only the producers append. The file is truncated whenever everything
+ * in it has been read back.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    FILE           *fp;
+    off_t           end;
+    uint64_t        outstanding; /* Chunks written but not read back */
+} spill_t;
+
+herr_t
+spill_init(spill_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_init(&s->mutex, NULL);
+    if (NULL == (s->fp = tmpfile()))
+        return FAIL;
+
+    return SUCCEED;
+}
+
+void
+spill_destroy(spill_t *s)
+{
+    if (s->fp)
+        fclose(s->fp);
+    pthread_mutex_destroy(&s->mutex);
+}
+
+herr_t
+spill_write(spill_t *s, chunk_t *chunk, const void *buf, size_t size)
+{
+    int fd = fileno(s->fp);
+
+    pthread_mutex_lock(&s->mutex);
+    if (0 == s->outstanding && s->end > 0) {
+        if (ftruncate(fd, 0) < 0) {
+            pthread_mutex_unlock(&s->mutex);
+            return FAIL;
+        }
+        s->end = 0;
+    }
+    chunk->spill_offset = s->end;
+    s->end += (off_t)size;
+    s->outstanding++;
+    pthread_mutex_unlock(&s->mutex);
+
+    if (pwrite(fd, buf, size, chunk->spill_offset) != (ssize_t)size)
+        return FAIL;
+
+    return SUCCEED;
+}
+
+herr_t
+spill_read(spill_t *s, chunk_t *chunk, void *buf, size_t size)
+{
+    herr_t ret = SUCCEED;
+
+    if (pread(fileno(s->fp), buf, size, chunk->spill_offset) != (ssize_t)size)
+        ret = FAIL;
+
+    pthread_mutex_lock(&s->mutex);
+    s->outstanding--;
+    pthread_mutex_unlock(&s->mutex);
+
+    chunk->spill_offset = -1;
+
+    return ret;
+}
+
+/************/
+/* Pipeline */
+/************/
+
+typedef struct {
+    budget_t budget;
+    spill_t  spill;
+    queue_t  raw_queue;   /* Producers -> workers */
+    queue_t  write_queue; /* Workers -> main thread */
+
+    pthread_mutex_t mutex;
+    int             producers_running;
+    int             workers_running;
+    int             failed;
+
+    /* Counters, per priority */
+    uint64_t n_produced[N_PRIORITIES];
+    uint64_t n_written[N_PRIORITIES];
+    uint64_t n_stored_raw[N_PRIORITIES]; /* Didn't compress, stored with deflate skipped */
+    double   delay_sum[N_PRIORITIES];    /* Produced -> written, in seconds */
+    double   delay_max[N_PRIORITIES];
+} pipeline_t;
+
+/* What each producer thread gets */
+typedef struct {
+    pipeline_t     *p;
+    const stream_t *stream;
+} producer_t;
+
+void
+pipeline_fail(pipeline_t *p)
+{
+    pthread_mutex_lock(&p->mutex);
+    p->failed = 1;
+    pthread_mutex_unlock(&p->mutex);
+    stop = 1;
+}
+
+void
+pipeline_count(pipeline_t *p, uint64_t *counter)
+{
+    pthread_mutex_lock(&p->mutex);
+    (*counter)++;
+    pthread_mutex_unlock(&p->mutex);
+}
+
+/* Fills a chunk with synthetic data: the chunk number in the upper bits
+ * so screwups are easy to spot, and a little noise in the low byte so
+ * deflate has some work to do
+ */
+void
+generate(int *buf, hsize_t n, uint64_t index, uint32_t *seed)
+{
+    uint32_t x = *seed;
+
+    for (hsize_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        buf[i] = (int)((index << 8) | (x & 0x3F));
+    }
+
+    *seed = x;
+}
+
+/* Makes room for one chunk according to the policy. Returns nonzero if
+ * the chunk can be held in memory, zero if it should be spilled.
+ */
+int
+make_room(pipeline_t *p, const stream_t *stream, size_t charge)
+{
+    budget_t  *b        = &p->budget;
+    priority_t priority = stream->priority;
+
+    if (budget_try_acquire(b, charge, priority))
+        return 1;
+
+    switch (b->policy) {
+        case OVER_BUDGET_SPILL:
+            return 0;
+
+        case OVER_BUDGET_DROP_OLDEST:
+            /* Throw away waiting chunks, least important and oldest first,
+             * until there's room. Nothing more important than the new
+             * chunk is ever dropped. Chunks that a worker has already
+             * picked up can't be dropped, so if nothing qualifies we have
+             * to wait too.
+             */
+            for (;;) {
+                chunk_t *victim = queue_try_pop_lowest(&p->raw_queue, priority);
+
+                if (NULL == victim)
+                    victim = queue_try_pop_lowest(&p->write_queue, priority);
+                if (NULL == victim)
+                    break;
+
+                budget_release(b, victim->charge);
+                budget_count(b, &b->n_dropped[victim->stream->priority], 1);
+                chunk_free(victim);
+
+                if (budget_try_acquire(b, charge, priority))
+                    return 1;
+            }
+            budget_acquire(b, charge, priority);
+            return 1;
+
+        case OVER_BUDGET_BLOCK:
+        default:
+            budget_acquire(b, charge, priority);
+            return 1;
+    }
+}
+
+void *
+producer_thread(void *_prod)
+{
+    producer_t     *prod    = (producer_t *)_prod;
+    pipeline_t     *p       = prod->p;
+    const stream_t *stream  = prod->stream;
+    int            *scratch = NULL; /* For chunks on their way to the spill file */
+    uint32_t        seed    = 2463534242u;
+    uint64_t        index   = 0;
+    size_t          charge  = full_chunk_charge(stream);
+    size_t          n_bytes = raw_chunk_bytes(stream);
+
+    if (p->budget.policy == OVER_BUDGET_SPILL) {
+        /* The producer's own buffer is charged once, up front */
+        budget_acquire(&p->budget, n_bytes, stream->priority);
+        if (NULL == (scratch = malloc(n_bytes)))
+            goto badness;
+    }
+
+    while (!stop) {
+        unsigned burst = stream->burst_chunks ? stream->burst_chunks : 1;
+
+        for (unsigned n = 0; n < burst && !stop; n++) {
+            chunk_t *chunk;
+
+            if (NULL == (chunk = calloc(1, sizeof(chunk_t))))
+                goto badness;
+            chunk->stream       = stream;
+            chunk->index        = index++;
+            chunk->spill_offset = -1;
+
+            if (make_room(p, stream, charge)) {
+                chunk->charge = charge;
+                if (NULL == (chunk->raw = malloc(n_bytes))) {
+                    budget_release(&p->budget, charge);
+                    chunk_free(chunk);
+                    goto badness;
+                }
+                generate(chunk->raw, stream->chunk_size, chunk->index, &seed);
+            }
+            else {
+                generate(scratch, stream->chunk_size, chunk->index, &seed);
+                if (spill_write(&p->spill, chunk, scratch, n_bytes) < 0) {
+                    fprintf(stderr, "can't write to the spill file\n");
+                    chunk_free(chunk);
+                    goto badness;
+                }
+                budget_count(&p->budget, &p->budget.n_spilled[stream->priority], 1);
+                budget_count(&p->budget, &p->budget.spilled_bytes[stream->priority], n_bytes);
+            }
+
+            chunk->t_produced = now_seconds();
+            queue_push(&p->raw_queue, chunk);
+            pipeline_count(p, &p->n_produced[stream->priority]);
+
+            usleep(stream->interval_us);
+        }
+
+        if (stream->burst_chunks)
+            sleep(stream->pause_s);
+    }
+
+    if (scratch) {
+        free(scratch);
+        budget_release(&p->budget, n_bytes);
+    }
+
+    /* The last producer out tells the workers there's nothing more coming */
+    pthread_mutex_lock(&p->mutex);
+    if (0 == --p->producers_running)
+        queue_close(&p->raw_queue);
+    pthread_mutex_unlock(&p->mutex);
+
+    return NULL;
+
+badness:
+    if (scratch) {
+        free(scratch);
+        budget_release(&p->budget, n_bytes);
+    }
+    pipeline_fail(p);
+
+    pthread_mutex_lock(&p->mutex);
+    if (0 == --p->producers_running)
+        queue_close(&p->raw_queue);
+    pthread_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+/* Compresses a chunk in place. The chunk's charge is cut down to what it
+ * now holds.
+ */
+herr_t
+compress_chunk(pipeline_t *p, chunk_t *chunk)
+{
+    size_t buf_size  = raw_chunk_bytes(chunk->stream);
+    uLongf z_destLen = compressBound((uLong)buf_size);
+    void  *out       = NULL;
+
+    if (NULL == (out = malloc((size_t)z_destLen)))
+        goto badness;
+
+    /* Compress the data using zlib */
+    int z_ret = compress2((Bytef *)out, &z_destLen, (const Bytef *)chunk->raw, (uLong)buf_size,
+                          COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    if (z_destLen < buf_size) {
+        void *tmp;
+
+        /* Give back what deflate didn't use */
+        if (NULL != (tmp = realloc(out, (size_t)z_destLen)))
+            out = tmp;
+
+        chunk->out         = out;
+        chunk->out_size    = (size_t)z_destLen;
+        chunk->filter_mask = 0;
+        free(chunk->raw);
+    }
+    else {
+        /* Incompressible, so store the raw data and tell HDF5 the deflate
+         * filter (the first and only one) was skipped
+         */
+        free(out);
+        chunk->out         = chunk->raw;
+        chunk->out_size    = buf_size;
+        chunk->filter_mask = 0x1;
+        pipeline_count(p, &p->n_stored_raw[chunk->stream->priority]);
+    }
+    chunk->raw = NULL;
+
+    budget_release(&p->budget, chunk->charge - chunk->out_size);
+    chunk->charge = chunk->out_size;
+
+    return SUCCEED;
+
+badness:
+    free(out);
+    return FAIL;
+}
+
+void *
+worker_thread(void *_p)
+{
+    pipeline_t *p = (pipeline_t *)_p;
+    chunk_t    *chunk;
+
+    while (NULL != (chunk = queue_pop(&p->raw_queue))) {
+
+        /* Bring spilled chunks back, using the reserved memory */
+        if (chunk->spill_offset >= 0) {
+            size_t n_bytes = raw_chunk_bytes(chunk->stream);
+
+            chunk->charge = full_chunk_charge(chunk->stream);
+            budget_acquire_reserved(&p->budget, chunk->charge);
+            if (NULL == (chunk->raw = malloc(n_bytes)) || spill_read(&p->spill, chunk, chunk->raw, n_bytes) < 0) {
+                fprintf(stderr, "can't read back spilled chunk %llu of %s\n", (unsigned long long)chunk->index,
+                        chunk->stream->name);
+                budget_release(&p->budget, chunk->charge);
+                chunk_free(chunk);
+                pipeline_fail(p);
+                continue;
+            }
+        }
+
+        if (compress_chunk(p, chunk) < 0) {
+            budget_release(&p->budget, chunk->charge);
+            chunk_free(chunk);
+            pipeline_fail(p);
+            continue;
+        }
+
+        queue_push(&p->write_queue, chunk);
+    }
+
+    /* The last worker out tells the writer there's nothing more coming */
+    pthread_mutex_lock(&p->mutex);
+    if (0 == --p->workers_running)
+        queue_close(&p->write_queue);
+    pthread_mutex_unlock(&p->mutex);
+
+    return NULL;
+}
+
+/**********************/
+/* HDF5 (main thread) */
+/**********************/
+
+herr_t
+setup(void)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for datasets */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* One dataset per stream */
+    for (size_t s = 0; s < N_STREAMS; s++) {
+        hsize_t chunk_dims[RANK] = {STREAMS[s].chunk_size};
+
+        /* dcpl */
+        if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+            goto badness;
+        if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+            goto badness;
+        if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+            goto badness;
+        if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+            goto badness;
+
+        /* Create dataset */
+        if ((did = H5Dcreate2(fid, STREAMS[s].name, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) ==
+            H5I_INVALID_HID)
+            goto badness;
+
+        if (H5Pclose(dcpl_id) < 0)
+            goto badness;
+        dcpl_id = H5I_INVALID_HID;
+        if (H5Dclose(did) < 0)
+            goto badness;
+        did = H5I_INVALID_HID;
+    }
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/* Writes chunks as they come out of the workers, until the workers are
+ * done. Chunks can arrive out of order (and some may never arrive if
+ * they were dropped), so each dataset is extended to cover the furthest
+ * chunk seen so far.
+ */
+herr_t
+write_chunks(pipeline_t *p, const hid_t *dids)
+{
+    chunk_t *chunk;
+    hsize_t  sizes[N_STREAMS] = {0};
+
+    while (NULL != (chunk = queue_pop(&p->write_queue))) {
+        size_t     s        = (size_t)(chunk->stream - STREAMS);
+        priority_t priority = chunk->stream->priority;
+        hsize_t    offset   = chunk->index * chunk->stream->chunk_size;
+        hsize_t    new_size = offset + chunk->stream->chunk_size;
+
+        if (new_size > sizes[s]) {
+            if (extend_dataset(dids[s], new_size) < 0)
+                goto badness;
+            sizes[s] = new_size;
+        }
+
+        if (H5Dwrite_chunk(dids[s], H5P_DEFAULT, chunk->filter_mask, &offset, chunk->out_size, chunk->out) < 0)
+            goto badness;
+
+        double delay = now_seconds() - chunk->t_produced;
+
+        pthread_mutex_lock(&p->mutex);
+        p->n_written[priority]++;
+        p->delay_sum[priority] += delay;
+        if (delay > p->delay_max[priority])
+            p->delay_max[priority] = delay;
+        pthread_mutex_unlock(&p->mutex);
+
+        budget_release(&p->budget, chunk->charge);
+        chunk_free(chunk);
+    }
+
+    return SUCCEED;
+
+badness:
+    budget_release(&p->budget, chunk->charge);
+    chunk_free(chunk);
+    return FAIL;
+}
+
+void
+print_counters(pipeline_t *p)
+{
+    budget_t *b = &p->budget;
+
+    pthread_mutex_lock(&b->mutex);
+    pthread_mutex_lock(&p->mutex);
+
+    printf("budget:      %zu bytes (%zu reserved for reloads)\n", b->limit, b->reserve);
+    printf("peak in use: %zu bytes\n", b->peak);
+
+    for (int pri = 0; pri < N_PRIORITIES; pri++) {
+        double mean = p->n_written[pri] ? p->delay_sum[pri] / (double)p->n_written[pri] : 0.0;
+
+        printf("%s:\n", PRIORITY_NAMES[pri]);
+        printf("    produced:  %llu chunks\n", (unsigned long long)p->n_produced[pri]);
+        printf("    written:   %llu chunks (%llu stored uncompressed)\n", (unsigned long long)p->n_written[pri],
+               (unsigned long long)p->n_stored_raw[pri]);
+        printf("    delay:     %.3f ms mean, %.3f ms max\n", mean * 1e3, p->delay_max[pri] * 1e3);
+        printf("    starving:  served %llu + %llu times (compress + write queues)\n",
+               (unsigned long long)p->raw_queue.lanes[pri].n_promoted,
+               (unsigned long long)p->write_queue.lanes[pri].n_promoted);
+        printf("    blocked:   %llu times, %.3f s total\n", (unsigned long long)b->n_blocked[pri],
+               b->blocked_seconds[pri]);
+        printf("    dropped:   %llu chunks\n", (unsigned long long)b->n_dropped[pri]);
+        printf("    spilled:   %llu chunks, %llu bytes\n", (unsigned long long)b->n_spilled[pri],
+               (unsigned long long)b->spilled_bytes[pri]);
+    }
+
+    pthread_mutex_unlock(&p->mutex);
+    pthread_mutex_unlock(&b->mutex);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    pipeline_t       p;
+    pthread_t        producers[N_STREAMS];
+    producer_t       producer_args[N_STREAMS];
+    pthread_t        workers[MAX_WORKERS];
+    int              n_workers    = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    size_t           budget_mib   = 64;
+    over_budget_t    policy       = OVER_BUDGET_BLOCK;
+    size_t           reserve      = 0;
+    size_t           largest      = 0;
+    size_t           needed       = 0;
+    int              write_failed = 0;
+
+    hid_t fid = H5I_INVALID_HID;
+    hid_t dids[N_STREAMS];
+
+    for (size_t s = 0; s < N_STREAMS; s++)
+        dids[s] = H5I_INVALID_HID;
+
+    if (argc > 1)
+        budget_mib = (size_t)strtoul(argv[1], NULL, 10);
+    if (argc > 2) {
+        if (!strcmp(argv[2], "block"))
+            policy = OVER_BUDGET_BLOCK;
+        else if (!strcmp(argv[2], "drop"))
+            policy = OVER_BUDGET_DROP_OLDEST;
+        else if (!strcmp(argv[2], "spill"))
+            policy = OVER_BUDGET_SPILL;
+        else {
+            fprintf(stderr, "policy must be block, drop or spill\n");
+            goto badness;
+        }
+    }
+    if (argc > 3)
+        n_workers = atoi(argv[3]);
+    if (n_workers < 1)
+        n_workers = 1;
+    if (n_workers > MAX_WORKERS)
+        n_workers = MAX_WORKERS;
+
+    /* Every producer needs room for at least one chunk of its own, plus
+     * (when spilling) its scratch buffer and one reload per worker
+     */
+    for (size_t s = 0; s < N_STREAMS; s++) {
+        if (full_chunk_charge(&STREAMS[s]) > largest)
+            largest = full_chunk_charge(&STREAMS[s]);
+        needed += full_chunk_charge(&STREAMS[s]);
+        if (OVER_BUDGET_SPILL == policy)
+            needed += raw_chunk_bytes(&STREAMS[s]);
+    }
+    if (OVER_BUDGET_SPILL == policy)
+        reserve = (size_t)n_workers * largest;
+    if (budget_mib * 1024 * 1024 < reserve ||
+        (budget_mib * 1024 * 1024 - reserve) / 100 * BUDGET_SHARE_PERCENT[N_PRIORITIES - 1] < needed) {
+        fprintf(stderr, "budget is too small for %d workers\n", n_workers);
+        goto badness;
+    }
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Set up file and datasets */
+    if (setup() < 0)
+        goto badness;
+
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    for (size_t s = 0; s < N_STREAMS; s++)
+        if ((dids[s] = H5Dopen2(fid, STREAMS[s].name, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+
+    /* Set up the pipeline */
+    memset(&p, 0, sizeof(p));
+    pthread_mutex_init(&p.mutex, NULL);
+    budget_init(&p.budget, budget_mib * 1024 * 1024, reserve, policy);
+    queue_init(&p.raw_queue);
+    queue_init(&p.write_queue);
+    if (OVER_BUDGET_SPILL == policy && spill_init(&p.spill) < 0) {
+        fprintf(stderr, "can't create spill file\n");
+        goto badness;
+    }
+
+    p.workers_running = n_workers;
+    for (int i = 0; i < n_workers; i++)
+        if (pthread_create(&workers[i], NULL, worker_thread, &p) != 0) {
+            fprintf(stderr, "can't start workers\n");
+            goto badness;
+        }
+    p.producers_running = (int)N_STREAMS;
+    for (size_t s = 0; s < N_STREAMS; s++) {
+        producer_args[s].p      = &p;
+        producer_args[s].stream = &STREAMS[s];
+        if (pthread_create(&producers[s], NULL, producer_thread, &producer_args[s]) != 0) {
+            fprintf(stderr, "can't start producers\n");
+            goto badness;
+        }
+    }
+
+    printf("FILE CREATION COMPLETE\n");
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    /* The main thread does all the HDF5 calls */
+    if (write_chunks(&p, dids) < 0) {
+        write_failed = 1;
+
+        /* Keep the queues moving so the other threads can finish */
+        stop = 1;
+        chunk_t *chunk;
+        while (NULL != (chunk = queue_pop(&p.write_queue))) {
+            budget_release(&p.budget, chunk->charge);
+            chunk_free(chunk);
+        }
+    }
+
+    for (size_t s = 0; s < N_STREAMS; s++)
+        pthread_join(producers[s], NULL);
+    for (int i = 0; i < n_workers; i++)
+        pthread_join(workers[i], NULL);
+
+    print_counters(&p);
+
+    queue_destroy(&p.raw_queue);
+    queue_destroy(&p.write_queue);
+    if (OVER_BUDGET_SPILL == policy)
+        spill_destroy(&p.spill);
+    budget_destroy(&p.budget);
+    pthread_mutex_destroy(&p.mutex);
+
+    if (write_failed || p.failed)
+        goto badness;
+
+    for (size_t s = 0; s < N_STREAMS; s++)
+        if (H5Dclose(dids[s]) < 0)
+            goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
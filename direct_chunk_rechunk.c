@@ -0,0 +1,1165 @@
+/* direct_chunk_rechunk.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version is an offline tool that copies a chunked dataset into a
+ * new file with a different chunk shape. Files written with tiny chunks
+ * (like the CHUNK_SIZE = 10 of direct_chunk_writer.c) are very slow to
+ * read, and h5repack fixes them one chunk at a time on one core. Here the
+ * main thread reads the old chunks and writes the new ones as raw bytes,
+ * and a pool of threads does all the decompressing, reassembling and
+ * recompressing in between, a window of the dataset at a time so memory
+ * use stays bounded.
+ *
+ * To build:
+ *      h5cc -O2 -o rechunk direct_chunk_rechunk.c -lm -lz -lpthread
+ *
+ * - DOES require the deflate and shuffle filters
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library (only the main thread
+ *   makes HDF5 calls)
+ *
+ * To run:
+ *      ./rechunk <in.h5> <out.h5> <chunk_dims> [codec] [n_threads] [memory_MiB] [dataset]
+ *
+ *      - Copies dataset (default "data") from in.h5 to out.h5, which is
+ *        overwritten, with chunks of chunk_dims (e.g. 65536 or 64x64x16,
+ *        one number per dimension)
+ *      - codec is none, deflate-N or shuffle+deflate-N, or "same" to keep
+ *        the source's (the default)
+ *      - n_threads defaults to the number of cores
+ *      - memory_MiB (default 256) bounds the window plus the chunks in
+ *        flight. The window gets up to half of it, and the number of
+ *        chunks in flight is cut to fit what's left (at least one, so
+ *        huge chunks can still go over).
+ *      - e.g. ./rechunk direct_chunk_writer.h5 fixed.h5 65536
+ *
+ * Windows:
+ *
+ *      The dataset is processed in windows that are a whole number of new
+ *      chunks tall in the first dimension and span all of the others,
+ *      sized to half the memory budget. For each window:
+ *
+ *          1. The window buffer is set to the fill value.
+ *          2. The main thread reads every old chunk that overlaps the
+ *             window and hands it to a worker, which decompresses it and
+ *             copies the overlapping part into the window. The parts
+ *             never overlap, so the workers don't need a lock for it.
+ *          3. Once they're all in, each new chunk that got any data is
+ *             cut out of the window and compressed by a worker, and the
+ *             main thread writes it.
+ *
+ *      An old chunk that straddles two windows is read for each of them.
+ *      New chunks that no old chunk touched aren't written, so holes stay
+ *      holes. If one row of new chunks doesn't fit in half the budget,
+ *      use a smaller first chunk dimension or a bigger budget.
+ *
+ *      Everything else (type, extent, maximum extent, fill value,
+ *      allocation settings) is copied from the old dataset, as is the
+ *      codec unless you pick another. Chunks are found the same way as in
+ *      direct_chunk_recompress.c, and the count is checked the same way.
+ */
+
+#include <hdf5.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *DEFAULT_DSET_NAME = "data";
+
+const size_t DEFAULT_MEMORY_MIB = 256;
+
+/* Chunks in flight, per thread, if the memory budget allows it */
+#define INFLIGHT_PER_THREAD 4
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**********/
+/* Codecs */
+/**********/
+
+/* The filter pipelines we know how to decode and encode */
+typedef struct {
+    int shuffle;
+    int deflate;
+    int level;    /* Deflate level */
+} codec_t;
+
+herr_t
+codec_parse(const char *s, codec_t *codec)
+{
+    char *end = NULL;
+
+    memset(codec, 0, sizeof(*codec));
+
+    if (!strcmp(s, "none"))
+        return SUCCEED;
+
+    if (!strncmp(s, "shuffle+", 8)) {
+        codec->shuffle = 1;
+        s += 8;
+    }
+    if (strncmp(s, "deflate-", 8))
+        goto badness;
+    codec->deflate = 1;
+    codec->level   = (int)strtol(s + 8, &end, 10);
+    if (end == s + 8 || *end || codec->level < 1 || codec->level > 9)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    fprintf(stderr, "codec must be same, none, deflate-N or shuffle+deflate-N with N from 1 to 9\n");
+    return FAIL;
+}
+
+void
+codec_name(const codec_t *codec, char *name, size_t len)
+{
+    if (!codec->deflate)
+        snprintf(name, len, "%s", codec->shuffle ? "shuffle" : "none");
+    else
+        snprintf(name, len, "%sdeflate-%d", codec->shuffle ? "shuffle+" : "", codec->level);
+}
+
+/* Filter mask bit for each filter, which depends on what comes before it */
+uint32_t
+codec_shuffle_bit(const codec_t *codec)
+{
+    (void)codec;
+
+    return 0x1;
+}
+
+uint32_t
+codec_deflate_bit(const codec_t *codec)
+{
+    return codec->shuffle ? 0x2 : 0x1;
+}
+
+/* Works out the codec from a dataset's filters */
+herr_t
+codec_from_dcpl(hid_t dcpl_id, codec_t *codec)
+{
+    int n_filters;
+
+    memset(codec, 0, sizeof(*codec));
+
+    if ((n_filters = H5Pget_nfilters(dcpl_id)) < 0)
+        goto badness;
+
+    for (int i = 0; i < n_filters; i++) {
+        unsigned     flags;
+        size_t       n_values  = 1;
+        unsigned     values[1] = {0};
+        H5Z_filter_t filter;
+
+        if ((filter = H5Pget_filter2(dcpl_id, (unsigned)i, &flags, &n_values, values, 0, NULL, NULL)) < 0)
+            goto badness;
+
+        if (H5Z_FILTER_SHUFFLE == filter && 0 == i)
+            codec->shuffle = 1;
+        else if (H5Z_FILTER_DEFLATE == filter && !codec->deflate) {
+            codec->deflate = 1;
+            codec->level   = (int)values[0];
+        }
+        else {
+            fprintf(stderr, "can't decode filter %d in position %d\n", (int)filter, i);
+            goto badness;
+        }
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+herr_t
+codec_set_dcpl(const codec_t *codec, hid_t dcpl_id)
+{
+    if (H5Premove_filter(dcpl_id, H5Z_FILTER_ALL) < 0)
+        goto badness;
+    if (codec->shuffle && H5Pset_shuffle(dcpl_id) < 0)
+        goto badness;
+    if (codec->deflate && H5Pset_deflate(dcpl_id, (unsigned)codec->level) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+void
+shuffle(const unsigned char *in, unsigned char *out, size_t n_bytes, size_t elem_size)
+{
+    size_t n_elems = n_bytes / elem_size;
+
+    for (size_t b = 0; b < elem_size; b++)
+        for (size_t i = 0; i < n_elems; i++)
+            out[b * n_elems + i] = in[i * elem_size + b];
+
+    /* Like the HDF5 filter, leftover bytes stay where they are */
+    memcpy(out + n_elems * elem_size, in + n_elems * elem_size, n_bytes - n_elems * elem_size);
+}
+
+void
+unshuffle(const unsigned char *in, unsigned char *out, size_t n_bytes, size_t elem_size)
+{
+    size_t n_elems = n_bytes / elem_size;
+
+    for (size_t b = 0; b < elem_size; b++)
+        for (size_t i = 0; i < n_elems; i++)
+            out[i * elem_size + b] = in[b * n_elems + i];
+
+    memcpy(out + n_elems * elem_size, in + n_elems * elem_size, n_bytes - n_elems * elem_size);
+}
+
+/* Stored bytes -> raw chunk of raw_size bytes (which the caller frees) */
+void *
+codec_decode(const codec_t *codec, const void *data, size_t size, uint32_t filter_mask, size_t raw_size,
+             size_t elem_size)
+{
+    unsigned char *raw = NULL;
+    unsigned char *tmp = NULL;
+
+    if (NULL == (raw = malloc(raw_size)) || NULL == (tmp = malloc(raw_size)))
+        goto badness;
+
+    /* Undo the filters in reverse, skipping any the mask says weren't
+     * applied
+     */
+    if (codec->deflate && !(filter_mask & codec_deflate_bit(codec))) {
+        uLongf destLen = (uLongf)raw_size;
+
+        if (Z_OK != uncompress(tmp, &destLen, (const Bytef *)data, (uLong)size) || destLen != raw_size) {
+            fprintf(stderr, "can't inflate chunk\n");
+            goto badness;
+        }
+    }
+    else {
+        if (size != raw_size) {
+            fprintf(stderr, "unfiltered chunk is %zu bytes, expected %zu\n", size, raw_size);
+            goto badness;
+        }
+        memcpy(tmp, data, raw_size);
+    }
+    if (codec->shuffle && !(filter_mask & codec_shuffle_bit(codec)))
+        unshuffle(tmp, raw, raw_size, elem_size);
+    else
+        memcpy(raw, tmp, raw_size);
+
+    free(tmp);
+
+    return raw;
+
+badness:
+    free(raw);
+    free(tmp);
+    return NULL;
+}
+
+/* Raw chunk -> stored bytes (which the caller frees) */
+void *
+codec_encode(const codec_t *codec, const void *raw, size_t raw_size, size_t elem_size, size_t *size,
+             uint32_t *filter_mask)
+{
+    unsigned char *tmp   = NULL;
+    unsigned char *out   = NULL;
+    uLongf         z_len = compressBound((uLong)raw_size);
+
+    *filter_mask = 0;
+
+    if (NULL == (tmp = malloc(raw_size)))
+        goto badness;
+    if (codec->shuffle)
+        shuffle(raw, tmp, raw_size, elem_size);
+    else
+        memcpy(tmp, raw, raw_size);
+
+    if (codec->deflate) {
+        if (NULL == (out = malloc((size_t)z_len)))
+            goto badness;
+        if (Z_OK != compress2((Bytef *)out, &z_len, tmp, (uLong)raw_size, codec->level)) {
+            fprintf(stderr, "can't deflate chunk\n");
+            goto badness;
+        }
+        if (z_len < raw_size) {
+            free(tmp);
+            *size = (size_t)z_len;
+            return out;
+        }
+
+        /* Incompressible, so store it without deflate */
+        free(out);
+        *filter_mask |= codec_deflate_bit(codec);
+    }
+
+    *size = raw_size;
+
+    return tmp;
+
+badness:
+    free(tmp);
+    free(out);
+    return NULL;
+}
+
+/**********/
+/* Boxes */
+/**********/
+
+/* Copies a count-sized box from src (dimensions src_dims) at src_start to
+ * dst (dimensions dst_dims) at dst_start. Everything's in elements.
+ */
+void
+copy_box(int rank, size_t elem_size, unsigned char *dst, const hsize_t *dst_dims, const hsize_t *dst_start,
+         const unsigned char *src, const hsize_t *src_dims, const hsize_t *src_start, const hsize_t *count)
+{
+    hsize_t i[H5S_MAX_RANK];
+    size_t  row = (size_t)count[rank - 1] * elem_size;
+
+    for (int d = 0; d < rank; d++)
+        if (0 == count[d])
+            return;
+
+    memset(i, 0, sizeof(i));
+    do {
+        hsize_t dst_off = 0;
+        hsize_t src_off = 0;
+        int     d;
+
+        for (d = 0; d < rank; d++) {
+            dst_off = dst_off * dst_dims[d] + dst_start[d] + i[d];
+            src_off = src_off * src_dims[d] + src_start[d] + i[d];
+        }
+        memcpy(dst + dst_off * elem_size, src + src_off * elem_size, row);
+
+        /* Next row: count through every dimension but the last */
+        for (d = rank - 2; d >= 0; d--) {
+            if (++i[d] < count[d])
+                break;
+            i[d] = 0;
+        }
+        if (d < 0)
+            break;
+    } while (1);
+}
+
+/* Sets n elements to the fill value */
+void
+fill(unsigned char *buf, size_t n, const unsigned char *fill_value, size_t elem_size)
+{
+    for (size_t i = 0; i < n; i++)
+        memcpy(buf + i * elem_size, fill_value, elem_size);
+}
+
+/**********/
+/* Chunks */
+/**********/
+
+typedef enum {
+    JOB_DECODE, /* Old chunk -> window */
+    JOB_ENCODE  /* Window -> new chunk */
+} job_kind_t;
+
+/* One chunk on its way in or out */
+typedef struct chunk_t {
+    struct chunk_t *next;
+    job_kind_t      kind;
+    hsize_t         offset[H5S_MAX_RANK];
+    void           *data;        /* Stored bytes */
+    size_t          size;
+    uint32_t        filter_mask;
+    int             failed;
+} chunk_t;
+
+void
+chunk_free(chunk_t *chunk)
+{
+    if (chunk) {
+        free(chunk->data);
+        free(chunk);
+    }
+}
+
+/* A FIFO that threads can wait on */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    chunk_t        *head;
+    chunk_t        *tail;
+    int             closed;  /* No more pushes; pops drain what's left */
+} queue_t;
+
+void
+queue_init(queue_t *q)
+{
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+void
+queue_destroy(queue_t *q)
+{
+    while (q->head) {
+        chunk_t *chunk = q->head;
+
+        q->head = chunk->next;
+        chunk_free(chunk);
+    }
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+}
+
+void
+queue_push(queue_t *q, chunk_t *chunk)
+{
+    chunk->next = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->tail)
+        q->tail->next = chunk;
+    else
+        q->head = chunk;
+    q->tail = chunk;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* Removes the oldest chunk, waiting for one. Returns NULL once the queue
+ * is closed and empty.
+ */
+chunk_t *
+queue_pop(queue_t *q)
+{
+    chunk_t *chunk = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    while (NULL == q->head && !q->closed)
+        pthread_cond_wait(&q->cond, &q->mutex);
+    if (q->head) {
+        chunk   = q->head;
+        q->head = chunk->next;
+        if (NULL == q->head)
+            q->tail = NULL;
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return chunk;
+}
+
+void
+queue_close(queue_t *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/**********/
+/* Window */
+/**********/
+
+typedef struct {
+    queue_t todo;  /* Main thread -> workers */
+    queue_t done;  /* Workers -> main thread */
+
+    int     rank;
+    size_t  elem_size;
+    hsize_t dims[H5S_MAX_RANK];
+    hsize_t src_chunk[H5S_MAX_RANK];
+    hsize_t dst_chunk[H5S_MAX_RANK];
+    codec_t src;
+    codec_t dst;
+    unsigned char *fill_value;
+
+    /* The current window: rows [lo, hi) of the first dimension */
+    unsigned char  *window;
+    hsize_t         window_dims[H5S_MAX_RANK];
+    hsize_t         lo;
+    hsize_t         hi;
+    hsize_t         grid[H5S_MAX_RANK];  /* New chunks across the window */
+    unsigned char  *touched;             /* Which new chunks got data */
+    pthread_mutex_t touched_mutex;
+} rechunk_t;
+
+size_t
+chunk_bytes(const rechunk_t *r, const hsize_t *chunk_dims)
+{
+    size_t n = r->elem_size;
+
+    for (int d = 0; d < r->rank; d++)
+        n *= (size_t)chunk_dims[d];
+
+    return n;
+}
+
+/* Copies the part of an old chunk that's in the window into the window
+ * and marks the new chunks it lands in
+ */
+herr_t
+decode_into_window(rechunk_t *r, chunk_t *chunk)
+{
+    unsigned char *raw;
+    hsize_t        window_start[H5S_MAX_RANK] = {0};
+    hsize_t        chunk_start[H5S_MAX_RANK];
+    hsize_t        count[H5S_MAX_RANK];
+    hsize_t        first[H5S_MAX_RANK];
+    hsize_t        last[H5S_MAX_RANK];
+    hsize_t        i[H5S_MAX_RANK];
+    int            rank = r->rank;
+
+    if (NULL == (raw = codec_decode(&r->src, chunk->data, chunk->size, chunk->filter_mask,
+                                    chunk_bytes(r, r->src_chunk), r->elem_size)))
+        goto badness;
+
+    /* The overlap, in dataset coordinates, is [start, end) */
+    for (int d = 0; d < rank; d++) {
+        hsize_t w_lo  = 0 == d ? r->lo : 0;
+        hsize_t w_hi  = 0 == d ? r->hi : r->dims[d];
+        hsize_t start = chunk->offset[d] > w_lo ? chunk->offset[d] : w_lo;
+        hsize_t end   = chunk->offset[d] + r->src_chunk[d];
+
+        if (end > w_hi)
+            end = w_hi;
+
+        chunk_start[d]  = start - chunk->offset[d];
+        window_start[d] = start - w_lo;
+        count[d]        = end > start ? end - start : 0;
+        if (0 == count[d]) {
+            free(raw);
+            return SUCCEED;
+        }
+        first[d] = window_start[d] / r->dst_chunk[d];
+        last[d]  = (window_start[d] + count[d] - 1) / r->dst_chunk[d];
+    }
+
+    copy_box(rank, r->elem_size, r->window, r->window_dims, window_start, raw, r->src_chunk, chunk_start, count);
+    free(raw);
+
+    /* Mark the new chunks */
+    memcpy(i, first, sizeof(hsize_t) * (size_t)rank);
+    pthread_mutex_lock(&r->touched_mutex);
+    do {
+        hsize_t index = 0;
+        int     d;
+
+        for (d = 0; d < rank; d++)
+            index = index * r->grid[d] + i[d];
+        r->touched[index] = 1;
+
+        for (d = rank - 1; d >= 0; d--) {
+            if (++i[d] <= last[d])
+                break;
+            i[d] = first[d];
+        }
+        if (d < 0)
+            break;
+    } while (1);
+    pthread_mutex_unlock(&r->touched_mutex);
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/* Cuts a new chunk out of the window and compresses it */
+herr_t
+encode_from_window(rechunk_t *r, chunk_t *chunk)
+{
+    size_t         n                          = chunk_bytes(r, r->dst_chunk);
+    unsigned char *raw                        = NULL;
+    hsize_t        window_start[H5S_MAX_RANK];
+    hsize_t        chunk_start[H5S_MAX_RANK]  = {0};
+    hsize_t        count[H5S_MAX_RANK];
+
+    if (NULL == (raw = malloc(n)))
+        goto badness;
+
+    /* Edge chunks hang off the end of the dataset; that part gets the fill
+     * value
+     */
+    fill(raw, n / r->elem_size, r->fill_value, r->elem_size);
+
+    for (int d = 0; d < r->rank; d++) {
+        hsize_t end = chunk->offset[d] + r->dst_chunk[d];
+
+        if (end > r->dims[d])
+            end = r->dims[d];
+        window_start[d] = chunk->offset[d] - (0 == d ? r->lo : 0);
+        count[d]        = end - chunk->offset[d];
+    }
+    copy_box(r->rank, r->elem_size, raw, r->dst_chunk, chunk_start, r->window, r->window_dims, window_start, count);
+
+    if (NULL == (chunk->data = codec_encode(&r->dst, raw, n, r->elem_size, &chunk->size, &chunk->filter_mask)))
+        goto badness;
+
+    free(raw);
+
+    return SUCCEED;
+
+badness:
+    free(raw);
+    return FAIL;
+}
+
+void *
+worker_thread(void *_r)
+{
+    rechunk_t *r = (rechunk_t *)_r;
+    chunk_t   *chunk;
+
+    while (NULL != (chunk = queue_pop(&r->todo))) {
+        herr_t ret;
+
+        if (JOB_DECODE == chunk->kind) {
+            ret = decode_into_window(r, chunk);
+
+            /* Don't need the old bytes any more */
+            free(chunk->data);
+            chunk->data = NULL;
+        }
+        else
+            ret = encode_from_window(r, chunk);
+
+        if (ret < 0)
+            chunk->failed = 1;
+        queue_push(&r->done, chunk);
+    }
+
+    return NULL;
+}
+
+/**********************/
+/* HDF5 (main thread) */
+/**********************/
+
+/* Creates the new dataset: the old one with different chunks and maybe
+ * different filters
+ */
+hid_t
+create_copy(rechunk_t *r, hid_t src_did, hid_t dst_fid, const char *name)
+{
+    hid_t tid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    if ((tid = H5Dget_type(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if ((sid = H5Dget_space(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if ((dcpl_id = H5Dget_create_plist(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, r->rank, r->dst_chunk) < 0)
+        goto badness;
+    if (codec_set_dcpl(&r->dst, dcpl_id) < 0)
+        goto badness;
+
+    if ((did = H5Dcreate2(dst_fid, name, tid, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    if (H5Tclose(tid) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+
+    return did;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Tclose(tid);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+    }
+    H5E_END_TRY;
+
+    return H5I_INVALID_HID;
+}
+
+/* Collects one finished job, writing it if it's a new chunk */
+herr_t
+collect(rechunk_t *r, hid_t dst_did, uint64_t *n_written, uint64_t *bytes_out)
+{
+    chunk_t *chunk = queue_pop(&r->done);
+
+    if (NULL == chunk || chunk->failed)
+        goto badness;
+
+    if (JOB_ENCODE == chunk->kind) {
+        if (H5Dwrite_chunk(dst_did, H5P_DEFAULT, chunk->filter_mask, chunk->offset, chunk->size, chunk->data) < 0)
+            goto badness;
+        (*n_written)++;
+        *bytes_out += chunk->size;
+    }
+
+    chunk_free(chunk);
+
+    return SUCCEED;
+
+badness:
+    chunk_free(chunk);
+    return FAIL;
+}
+
+/* Does one window. The counters are added to. */
+herr_t
+do_window(rechunk_t *r, hid_t src_did, hid_t dst_did, uint64_t max_inflight, uint64_t *n_read,
+          uint64_t *n_written, uint64_t *bytes_in, uint64_t *bytes_out)
+{
+    hsize_t  offset[H5S_MAX_RANK];
+    hsize_t  n_new    = 1;
+    uint64_t inflight = 0;
+    int      rank     = r->rank;
+
+    /* 1. Fill */
+    r->window_dims[0] = r->hi - r->lo;
+    for (int d = 1; d < rank; d++)
+        r->window_dims[d] = r->dims[d];
+    fill(r->window, chunk_bytes(r, r->window_dims) / r->elem_size, r->fill_value, r->elem_size);
+
+    for (int d = 0; d < rank; d++) {
+        r->grid[d] = (r->window_dims[d] + r->dst_chunk[d] - 1) / r->dst_chunk[d];
+        n_new *= r->grid[d];
+    }
+    memset(r->touched, 0, (size_t)n_new);
+
+    /* 2. Old chunks in */
+    memset(offset, 0, sizeof(offset));
+    offset[0] = r->lo / r->src_chunk[0] * r->src_chunk[0];
+    while (offset[0] < r->hi && !stop) {
+        hsize_t size = 0;
+        herr_t  found;
+        int     d;
+
+        H5E_BEGIN_TRY
+        {
+            found = H5Dget_chunk_storage_size(src_did, offset, &size);
+        }
+        H5E_END_TRY;
+
+        if (found >= 0 && size > 0) {
+            chunk_t *chunk;
+
+            if (NULL == (chunk = calloc(1, sizeof(chunk_t))) || NULL == (chunk->data = malloc((size_t)size))) {
+                chunk_free(chunk);
+                goto badness;
+            }
+            chunk->kind = JOB_DECODE;
+            chunk->size = (size_t)size;
+            memcpy(chunk->offset, offset, sizeof(hsize_t) * (size_t)rank);
+            if (H5Dread_chunk(src_did, H5P_DEFAULT, offset, &chunk->filter_mask, chunk->data) < 0) {
+                chunk_free(chunk);
+                goto badness;
+            }
+
+            /* Only count chunks the first time we see them */
+            if (offset[0] >= r->lo)
+                (*n_read)++;
+            *bytes_in += size;
+
+            if (inflight == max_inflight) {
+                inflight--;
+                if (collect(r, dst_did, n_written, bytes_out) < 0) {
+                    chunk_free(chunk);
+                    goto badness;
+                }
+            }
+            queue_push(&r->todo, chunk);
+            inflight++;
+        }
+
+        /* Next old chunk */
+        for (d = rank - 1; d > 0; d--) {
+            offset[d] += r->src_chunk[d];
+            if (offset[d] < r->dims[d])
+                break;
+            offset[d] = 0;
+        }
+        if (0 == d)
+            offset[0] += r->src_chunk[0];
+    }
+
+    /* Everything has to be in the window before anything's cut out */
+    while (inflight > 0) {
+        inflight--;
+        if (collect(r, dst_did, n_written, bytes_out) < 0)
+            goto badness;
+    }
+
+    /* 3. New chunks out */
+    for (hsize_t index = 0; index < n_new && !stop; index++) {
+        chunk_t *chunk;
+        hsize_t  rest = index;
+
+        if (!r->touched[index])
+            continue;
+
+        if (NULL == (chunk = calloc(1, sizeof(chunk_t))))
+            goto badness;
+        chunk->kind = JOB_ENCODE;
+        for (int d = rank - 1; d >= 0; d--) {
+            chunk->offset[d] = (rest % r->grid[d]) * r->dst_chunk[d] + (0 == d ? r->lo : 0);
+            rest /= r->grid[d];
+        }
+
+        if (inflight == max_inflight) {
+            inflight--;
+            if (collect(r, dst_did, n_written, bytes_out) < 0) {
+                chunk_free(chunk);
+                goto badness;
+            }
+        }
+        queue_push(&r->todo, chunk);
+        inflight++;
+    }
+
+    while (inflight > 0) {
+        inflight--;
+        if (collect(r, dst_did, n_written, bytes_out) < 0)
+            goto badness;
+    }
+
+    return SUCCEED;
+
+badness:
+    /* The workers may still be using the window */
+    for (; inflight > 0; inflight--) {
+        chunk_t *chunk = queue_pop(&r->done);
+
+        chunk_free(chunk);
+    }
+    return FAIL;
+}
+
+/* Reads "64x64x16" */
+int
+parse_dims(const char *s, hsize_t *dims)
+{
+    int rank = 0;
+
+    while (*s && rank < H5S_MAX_RANK) {
+        char *end = NULL;
+
+        dims[rank] = (hsize_t)strtoull(s, &end, 10);
+        if (end == s || 0 == dims[rank])
+            return -1;
+        rank++;
+        if ('x' == *end)
+            end++;
+        else if (*end)
+            return -1;
+        s = end;
+    }
+
+    return rank;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    rechunk_t        r;
+    const char      *dset_name  = DEFAULT_DSET_NAME;
+    size_t           memory     = DEFAULT_MEMORY_MIB * 1024 * 1024;
+    long             n_threads  = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t       *threads    = NULL;
+    long             n_started  = 0;
+    hid_t            src_fid    = H5I_INVALID_HID;
+    hid_t            src_did    = H5I_INVALID_HID;
+    hid_t            dst_fid    = H5I_INVALID_HID;
+    hid_t            dst_did    = H5I_INVALID_HID;
+    hid_t            fapl_id    = H5I_INVALID_HID;
+    hid_t            sid        = H5I_INVALID_HID;
+    hid_t            tid        = H5I_INVALID_HID;
+    hid_t            dcpl_id    = H5I_INVALID_HID;
+    int              same_codec = 1;
+    int              dst_rank;
+    hsize_t          n_expected = 0;
+    hsize_t          row_bytes;
+    hsize_t          rows;
+    uint64_t         max_inflight;
+    uint64_t         n_read     = 0;
+    uint64_t         n_written  = 0;
+    uint64_t         bytes_in   = 0;
+    uint64_t         bytes_out  = 0;
+    double           t_start;
+    char             src_name[32];
+    char             dst_name[32];
+
+    memset(&r, 0, sizeof(r));
+    queue_init(&r.todo);
+    queue_init(&r.done);
+    pthread_mutex_init(&r.touched_mutex, NULL);
+
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <in.h5> <out.h5> <chunk_dims> [codec] [n_threads] [memory_MiB] [dataset]\n",
+                argv[0]);
+        goto badness;
+    }
+    if ((dst_rank = parse_dims(argv[3], r.dst_chunk)) < 1) {
+        fprintf(stderr, "chunk_dims should look like 65536 or 64x64x16\n");
+        goto badness;
+    }
+    if (argc > 4 && strcmp(argv[4], "same")) {
+        if (codec_parse(argv[4], &r.dst) < 0)
+            goto badness;
+        same_codec = 0;
+    }
+    if (argc > 5)
+        n_threads = atol(argv[5]);
+    if (argc > 6)
+        memory = (size_t)atol(argv[6]) * 1024 * 1024;
+    if (argc > 7)
+        dset_name = argv[7];
+    if (n_threads < 1)
+        n_threads = 1;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Source */
+    if ((src_fid = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((src_did = H5Dopen2(src_fid, dset_name, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((tid = H5Dget_type(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    r.elem_size = H5Tget_size(tid);
+    if ((dcpl_id = H5Dget_create_plist(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5D_CHUNKED != H5Pget_layout(dcpl_id)) {
+        fprintf(stderr, "%s isn't chunked\n", dset_name);
+        goto badness;
+    }
+    if ((r.rank = H5Pget_chunk(dcpl_id, H5S_MAX_RANK, r.src_chunk)) < 0)
+        goto badness;
+    if (dst_rank != r.rank) {
+        fprintf(stderr, "%s has %d dimensions but chunk_dims has %d\n", dset_name, r.rank, dst_rank);
+        goto badness;
+    }
+    if (codec_from_dcpl(dcpl_id, &r.src) < 0)
+        goto badness;
+    if (same_codec)
+        r.dst = r.src;
+
+    /* Fill value, in the file's type since that's what the chunks hold */
+    if (NULL == (r.fill_value = calloc(1, r.elem_size)))
+        goto badness;
+    if (H5Pget_fill_value(dcpl_id, tid, r.fill_value) < 0)
+        goto badness;
+
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    dcpl_id = H5I_INVALID_HID;
+    if (H5Tclose(tid) < 0)
+        goto badness;
+    tid = H5I_INVALID_HID;
+
+    if ((sid = H5Dget_space(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sget_simple_extent_dims(sid, r.dims, NULL) < 0)
+        goto badness;
+    if (H5Dget_num_chunks(src_did, sid, &n_expected) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    sid = H5I_INVALID_HID;
+
+    /* Window size: as many rows of new chunks as fit in half the budget */
+    row_bytes = r.elem_size * r.dst_chunk[0];
+    for (int d = 1; d < r.rank; d++)
+        row_bytes *= r.dims[d];
+    rows = row_bytes > 0 ? (memory / 2) / row_bytes : 1;
+    if (0 == rows) {
+        fprintf(stderr, "one row of new chunks is %llu bytes, more than half the memory budget\n",
+                (unsigned long long)row_bytes);
+        goto badness;
+    }
+    if (rows * r.dst_chunk[0] > r.dims[0])
+        rows = (r.dims[0] + r.dst_chunk[0] - 1) / r.dst_chunk[0];
+    if (rows < 1)
+        rows = 1;
+
+    /* Chunks in flight: what's left of the budget after the window,
+     * divided by what one job can have allocated at once. Decoding holds
+     * the stored bytes plus two copies of the old chunk; encoding holds
+     * two copies of the new chunk plus its stored bytes.
+     */
+    {
+        size_t src_bytes   = chunk_bytes(&r, r.src_chunk);
+        size_t dst_bytes   = chunk_bytes(&r, r.dst_chunk);
+        size_t decode_job  = (size_t)compressBound((uLong)src_bytes) + 2 * src_bytes;
+        size_t encode_job  = 2 * dst_bytes + (size_t)compressBound((uLong)dst_bytes);
+        size_t job_bytes   = decode_job > encode_job ? decode_job : encode_job;
+        size_t window_size = (size_t)(rows * row_bytes);
+        size_t left        = memory > window_size ? memory - window_size : 0;
+
+        max_inflight = (uint64_t)n_threads * INFLIGHT_PER_THREAD;
+        if (job_bytes > 0 && left / job_bytes < max_inflight)
+            max_inflight = left / job_bytes;
+        if (max_inflight < 1)
+            max_inflight = 1;
+    }
+
+    {
+        hsize_t n_new = rows;
+
+        /* (+ 1 so an empty dataset still gets a buffer) */
+        if (NULL == (r.window = malloc((size_t)(rows * row_bytes) + 1)))
+            goto badness;
+        for (int d = 1; d < r.rank; d++)
+            n_new *= (r.dims[d] + r.dst_chunk[d] - 1) / r.dst_chunk[d];
+        if (NULL == (r.touched = malloc((size_t)n_new + 1)))
+            goto badness;
+    }
+
+    /* Destination */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+    if ((dst_fid = H5Fcreate(argv[2], H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+    if ((dst_did = create_copy(&r, src_did, dst_fid, dset_name)) == H5I_INVALID_HID)
+        goto badness;
+
+    codec_name(&r.src, src_name, sizeof(src_name));
+    codec_name(&r.dst, dst_name, sizeof(dst_name));
+    printf("%s: %llu CHUNKS, %s -> %s\n", dset_name, (unsigned long long)n_expected, src_name, dst_name);
+    printf("USING %ld THREADS, %llu ROWS OF NEW CHUNKS (%.1f MiB) PER WINDOW, %llu CHUNKS IN FLIGHT\n",
+           n_threads, (unsigned long long)rows, (double)(rows * row_bytes) / (1024.0 * 1024.0),
+           (unsigned long long)max_inflight);
+
+    /* Workers */
+    if (NULL == (threads = calloc((size_t)n_threads, sizeof(pthread_t))))
+        goto badness;
+    for (; n_started < n_threads; n_started++)
+        if (pthread_create(&threads[n_started], NULL, worker_thread, &r) != 0)
+            goto badness;
+
+    t_start = now_seconds();
+    for (r.lo = 0; r.lo < r.dims[0] && !stop; r.lo = r.hi) {
+        r.hi = r.lo + rows * r.dst_chunk[0];
+        if (r.hi > r.dims[0])
+            r.hi = r.dims[0];
+
+        if (do_window(&r, src_did, dst_did, max_inflight, &n_read, &n_written, &bytes_in, &bytes_out) < 0)
+            goto badness;
+    }
+
+    if (stop) {
+        fprintf(stderr, "interrupted, %s is incomplete\n", argv[2]);
+        goto badness;
+    }
+    if (n_read != n_expected) {
+        fprintf(stderr, "read %llu chunks but the source has %llu\n", (unsigned long long)n_read,
+                (unsigned long long)n_expected);
+        goto badness;
+    }
+
+    printf("REWRITTEN: %llu chunks (%llu bytes) -> %llu chunks (%llu bytes) in %.3f s\n",
+           (unsigned long long)n_read, (unsigned long long)bytes_in, (unsigned long long)n_written,
+           (unsigned long long)bytes_out, now_seconds() - t_start);
+
+    queue_close(&r.todo);
+    for (long i = 0; i < n_started; i++)
+        pthread_join(threads[i], NULL);
+    n_started = 0;
+
+    if (H5Dclose(dst_did) < 0)
+        goto badness;
+    if (H5Fclose(dst_fid) < 0)
+        goto badness;
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Dclose(src_did) < 0)
+        goto badness;
+    if (H5Fclose(src_fid) < 0)
+        goto badness;
+
+    queue_destroy(&r.todo);
+    queue_destroy(&r.done);
+    pthread_mutex_destroy(&r.touched_mutex);
+    free(r.window);
+    free(r.touched);
+    free(r.fill_value);
+    free(threads);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    queue_close(&r.todo);
+    for (long i = 0; i < n_started; i++)
+        pthread_join(threads[i], NULL);
+
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+        H5Tclose(tid);
+        H5Pclose(dcpl_id);
+        H5Pclose(fapl_id);
+        H5Dclose(dst_did);
+        H5Fclose(dst_fid);
+        H5Dclose(src_did);
+        H5Fclose(src_fid);
+    }
+    H5E_END_TRY;
+
+    queue_destroy(&r.todo);
+    queue_destroy(&r.done);
+    pthread_mutex_destroy(&r.touched_mutex);
+    free(r.window);
+    free(r.touched);
+    free(r.fill_value);
+    free(threads);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,798 @@
+/* direct_chunk_recompress.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version is an offline tool rather than a writer. It copies a
+ * chunked dataset into a new file with a different compression setting,
+ * moving the chunks as raw bytes with H5Dread_chunk() / H5Dwrite_chunk()
+ * and doing the decompressing and recompressing on a pool of threads.
+ * Data written with a fast setting during a pulse can then be re-archived
+ * with a strong one overnight using the whole machine, which the library's
+ * own filter pipeline (and so h5repack) can't do.
+ *
+ * To build:
+ *      h5cc -O2 -o recompress direct_chunk_recompress.c -lm -lz -lpthread
+ *
+ * - DOES require the deflate and shuffle filters
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library (only the main thread
+ *   makes HDF5 calls)
+ *
+ * To run:
+ *      ./recompress <in.h5> <out.h5> [codec] [n_threads] [dataset]
+ *
+ *      - Copies dataset (default "data") from in.h5 to out.h5, which is
+ *        overwritten
+ *      - codec is none, deflate-N or shuffle+deflate-N (default
+ *        deflate-9)
+ *      - n_threads defaults to the number of cores
+ *      - e.g. ./recompress direct_chunk_writer.h5 archive.h5 shuffle+deflate-9
+ *
+ * What gets copied:
+ *
+ *      The new dataset gets the old one's type, extent, maximum extent,
+ *      chunk shape, fill value and allocation settings; only the filters
+ *      change. Chunks that were never written stay unwritten, so they
+ *      still read as the fill value. Attributes are not copied.
+ *
+ *      Source chunks can have no filters, deflate, or shuffle then
+ *      deflate, which covers what the writers in this repo produce. If a
+ *      chunk's filter mask says a filter was skipped, that step is skipped
+ *      when decoding it, too.
+ *
+ *      If the source is already in the target codec at the same level,
+ *      the chunks are copied as they are, without being decompressed.
+ *
+ *      A chunk that doesn't get smaller when deflated is stored without
+ *      deflate and the deflate bit set in its filter mask.
+ *
+ * Finding the chunks:
+ *
+ *      We walk the chunk grid and ask for each chunk's size with
+ *      H5Dget_chunk_storage_size(), which fails for chunks that were never
+ *      written; those are skipped. (H5Dget_chunk_info() would also work,
+ *      but in 1.10 each call walks the index from the start.) To make sure
+ *      a real error isn't mistaken for a hole, the number of chunks copied
+ *      is checked against H5Dget_num_chunks() at the end.
+ */
+
+#include <hdf5.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *DEFAULT_DSET_NAME = "data";
+
+const char *DEFAULT_CODEC = "deflate-9";
+
+/* Chunks read but not yet written, per thread */
+#define INFLIGHT_PER_THREAD 4
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**********/
+/* Codecs */
+/**********/
+
+/* The filter pipelines we know how to decode and encode */
+typedef struct {
+    int shuffle;
+    int deflate;
+    int level;    /* Deflate level */
+} codec_t;
+
+herr_t
+codec_parse(const char *s, codec_t *codec)
+{
+    char *end = NULL;
+
+    memset(codec, 0, sizeof(*codec));
+
+    if (!strcmp(s, "none"))
+        return SUCCEED;
+
+    if (!strncmp(s, "shuffle+", 8)) {
+        codec->shuffle = 1;
+        s += 8;
+    }
+    if (strncmp(s, "deflate-", 8))
+        goto badness;
+    codec->deflate = 1;
+    codec->level   = (int)strtol(s + 8, &end, 10);
+    if (end == s + 8 || *end || codec->level < 1 || codec->level > 9)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    fprintf(stderr, "codec must be none, deflate-N or shuffle+deflate-N with N from 1 to 9\n");
+    return FAIL;
+}
+
+void
+codec_name(const codec_t *codec, char *name, size_t len)
+{
+    if (!codec->deflate)
+        snprintf(name, len, "%s", codec->shuffle ? "shuffle" : "none");
+    else
+        snprintf(name, len, "%sdeflate-%d", codec->shuffle ? "shuffle+" : "", codec->level);
+}
+
+/* Filter mask bit for each filter, which depends on what comes before it */
+uint32_t
+codec_shuffle_bit(const codec_t *codec)
+{
+    (void)codec;
+
+    return 0x1;
+}
+
+uint32_t
+codec_deflate_bit(const codec_t *codec)
+{
+    return codec->shuffle ? 0x2 : 0x1;
+}
+
+/* Works out the codec from a dataset's filters */
+herr_t
+codec_from_dcpl(hid_t dcpl_id, codec_t *codec)
+{
+    int n_filters;
+
+    memset(codec, 0, sizeof(*codec));
+
+    if ((n_filters = H5Pget_nfilters(dcpl_id)) < 0)
+        goto badness;
+
+    for (int i = 0; i < n_filters; i++) {
+        unsigned     flags;
+        size_t       n_values  = 1;
+        unsigned     values[1] = {0};
+        H5Z_filter_t filter;
+
+        if ((filter = H5Pget_filter2(dcpl_id, (unsigned)i, &flags, &n_values, values, 0, NULL, NULL)) < 0)
+            goto badness;
+
+        if (H5Z_FILTER_SHUFFLE == filter && 0 == i)
+            codec->shuffle = 1;
+        else if (H5Z_FILTER_DEFLATE == filter && !codec->deflate) {
+            codec->deflate = 1;
+            codec->level   = (int)values[0];
+        }
+        else {
+            fprintf(stderr, "can't decode filter %d in position %d\n", (int)filter, i);
+            goto badness;
+        }
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+herr_t
+codec_set_dcpl(const codec_t *codec, hid_t dcpl_id)
+{
+    if (H5Premove_filter(dcpl_id, H5Z_FILTER_ALL) < 0)
+        goto badness;
+    if (codec->shuffle && H5Pset_shuffle(dcpl_id) < 0)
+        goto badness;
+    if (codec->deflate && H5Pset_deflate(dcpl_id, (unsigned)codec->level) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+void
+shuffle(const unsigned char *in, unsigned char *out, size_t n_bytes, size_t elem_size)
+{
+    size_t n_elems = n_bytes / elem_size;
+
+    for (size_t b = 0; b < elem_size; b++)
+        for (size_t i = 0; i < n_elems; i++)
+            out[b * n_elems + i] = in[i * elem_size + b];
+
+    /* Like the HDF5 filter, leftover bytes stay where they are */
+    memcpy(out + n_elems * elem_size, in + n_elems * elem_size, n_bytes - n_elems * elem_size);
+}
+
+void
+unshuffle(const unsigned char *in, unsigned char *out, size_t n_bytes, size_t elem_size)
+{
+    size_t n_elems = n_bytes / elem_size;
+
+    for (size_t b = 0; b < elem_size; b++)
+        for (size_t i = 0; i < n_elems; i++)
+            out[i * elem_size + b] = in[b * n_elems + i];
+
+    memcpy(out + n_elems * elem_size, in + n_elems * elem_size, n_bytes - n_elems * elem_size);
+}
+
+/**********/
+/* Chunks */
+/**********/
+
+/* One chunk on its way from the old file to the new one */
+typedef struct chunk_t {
+    struct chunk_t *next;
+    hsize_t         offset[H5S_MAX_RANK];
+    void           *data;        /* Stored bytes: old ones, then new ones */
+    size_t          size;
+    uint32_t        filter_mask;
+    int             failed;
+} chunk_t;
+
+void
+chunk_free(chunk_t *chunk)
+{
+    if (chunk) {
+        free(chunk->data);
+        free(chunk);
+    }
+}
+
+/* A FIFO that threads can wait on */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    chunk_t        *head;
+    chunk_t        *tail;
+    int             closed;  /* No more pushes; pops drain what's left */
+} queue_t;
+
+void
+queue_init(queue_t *q)
+{
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+void
+queue_destroy(queue_t *q)
+{
+    while (q->head) {
+        chunk_t *chunk = q->head;
+
+        q->head = chunk->next;
+        chunk_free(chunk);
+    }
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+}
+
+void
+queue_push(queue_t *q, chunk_t *chunk)
+{
+    chunk->next = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->tail)
+        q->tail->next = chunk;
+    else
+        q->head = chunk;
+    q->tail = chunk;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* Removes the oldest chunk. If wait is set, waits for one; returns NULL
+ * if there isn't one (or, when waiting, once the queue is closed and
+ * empty).
+ */
+chunk_t *
+queue_pop(queue_t *q, int wait)
+{
+    chunk_t *chunk = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    while (wait && NULL == q->head && !q->closed)
+        pthread_cond_wait(&q->cond, &q->mutex);
+    if (q->head) {
+        chunk   = q->head;
+        q->head = chunk->next;
+        if (NULL == q->head)
+            q->tail = NULL;
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return chunk;
+}
+
+void
+queue_close(queue_t *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/***********/
+/* Workers */
+/***********/
+
+typedef struct {
+    queue_t todo;      /* Main thread -> workers */
+    queue_t done;      /* Workers -> main thread */
+    codec_t src;
+    codec_t dst;
+    size_t  chunk_bytes; /* Uncompressed */
+    size_t  elem_size;
+} recompress_t;
+
+/* Turns a chunk's stored bytes in the source codec into stored bytes in
+ * the destination codec
+ */
+herr_t
+recompress_chunk(recompress_t *r, chunk_t *chunk)
+{
+    size_t         n     = r->chunk_bytes;
+    unsigned char *raw   = NULL;
+    unsigned char *tmp   = NULL;
+    unsigned char *out   = NULL;
+    uLongf         z_len = compressBound((uLong)n);
+
+    if (NULL == (raw = malloc(n)) || NULL == (tmp = malloc(n)))
+        goto badness;
+
+    /* Decode, undoing the filters in reverse, skipping any the mask says
+     * weren't applied
+     */
+    if (r->src.deflate && !(chunk->filter_mask & codec_deflate_bit(&r->src))) {
+        uLongf destLen = (uLongf)n;
+
+        if (Z_OK != uncompress(tmp, &destLen, (const Bytef *)chunk->data, (uLong)chunk->size) || destLen != n) {
+            fprintf(stderr, "can't inflate chunk\n");
+            goto badness;
+        }
+    }
+    else {
+        if (chunk->size != n) {
+            fprintf(stderr, "unfiltered chunk is %zu bytes, expected %zu\n", chunk->size, n);
+            goto badness;
+        }
+        memcpy(tmp, chunk->data, n);
+    }
+    if (r->src.shuffle && !(chunk->filter_mask & codec_shuffle_bit(&r->src)))
+        unshuffle(tmp, raw, n, r->elem_size);
+    else
+        memcpy(raw, tmp, n);
+
+    /* Encode */
+    chunk->filter_mask = 0;
+    if (r->dst.shuffle)
+        shuffle(raw, tmp, n, r->elem_size);
+    else
+        memcpy(tmp, raw, n);
+
+    free(chunk->data);
+    chunk->data = NULL;
+
+    if (r->dst.deflate) {
+        if (NULL == (out = malloc((size_t)z_len)))
+            goto badness;
+        if (Z_OK != compress2((Bytef *)out, &z_len, tmp, (uLong)n, r->dst.level)) {
+            fprintf(stderr, "can't deflate chunk\n");
+            goto badness;
+        }
+        if (z_len < n) {
+            chunk->data = out;
+            chunk->size = (size_t)z_len;
+            free(raw);
+            free(tmp);
+            return SUCCEED;
+        }
+
+        /* Incompressible, so store it without deflate */
+        free(out);
+        out = NULL;
+        chunk->filter_mask |= codec_deflate_bit(&r->dst);
+    }
+
+    chunk->data = tmp;
+    chunk->size = n;
+    free(raw);
+
+    return SUCCEED;
+
+badness:
+    free(raw);
+    free(tmp);
+    free(out);
+    return FAIL;
+}
+
+void *
+worker_thread(void *_r)
+{
+    recompress_t *r = (recompress_t *)_r;
+    chunk_t      *chunk;
+
+    while (NULL != (chunk = queue_pop(&r->todo, 1))) {
+        if (recompress_chunk(r, chunk) < 0)
+            chunk->failed = 1;
+        queue_push(&r->done, chunk);
+    }
+
+    return NULL;
+}
+
+/**********************/
+/* HDF5 (main thread) */
+/**********************/
+
+/* Creates the new dataset: the old one with different filters */
+hid_t
+create_copy(hid_t src_did, hid_t dst_fid, const char *name, const codec_t *codec)
+{
+    hid_t tid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    if ((tid = H5Dget_type(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if ((sid = H5Dget_space(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if ((dcpl_id = H5Dget_create_plist(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (codec_set_dcpl(codec, dcpl_id) < 0)
+        goto badness;
+
+    if ((did = H5Dcreate2(dst_fid, name, tid, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    if (H5Tclose(tid) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+
+    return did;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Tclose(tid);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+    }
+    H5E_END_TRY;
+
+    return H5I_INVALID_HID;
+}
+
+/* Moves on to the next chunk in the grid. Returns 0 when there are no
+ * more.
+ */
+int
+next_chunk(int rank, const hsize_t *dims, const hsize_t *chunk_dims, hsize_t *offset)
+{
+    for (int d = rank - 1; d >= 0; d--) {
+        offset[d] += chunk_dims[d];
+        if (offset[d] < dims[d])
+            return 1;
+        offset[d] = 0;
+    }
+
+    return 0;
+}
+
+/* Reads the next chunk that exists, starting at offset. Returns NULL with
+ * *more cleared when we're out of chunks.
+ */
+chunk_t *
+read_next_chunk(hid_t did, int rank, const hsize_t *dims, const hsize_t *chunk_dims, hsize_t *offset, int *more,
+                herr_t *ret)
+{
+    chunk_t *chunk = NULL;
+
+    *ret = SUCCEED;
+
+    while (*more) {
+        hsize_t size = 0;
+        herr_t  found;
+
+        H5E_BEGIN_TRY
+        {
+            found = H5Dget_chunk_storage_size(did, offset, &size);
+        }
+        H5E_END_TRY;
+
+        if (found >= 0 && size > 0) {
+            if (NULL == (chunk = calloc(1, sizeof(chunk_t))) || NULL == (chunk->data = malloc((size_t)size)))
+                goto badness;
+            memcpy(chunk->offset, offset, (size_t)rank * sizeof(hsize_t));
+            chunk->size = (size_t)size;
+            if (H5Dread_chunk(did, H5P_DEFAULT, offset, &chunk->filter_mask, chunk->data) < 0)
+                goto badness;
+        }
+
+        *more = next_chunk(rank, dims, chunk_dims, offset);
+
+        if (chunk)
+            return chunk;
+    }
+
+    return NULL;
+
+badness:
+    chunk_free(chunk);
+    *ret = FAIL;
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    recompress_t     r;
+    const char      *dset_name = DEFAULT_DSET_NAME;
+    const char      *codec_str = DEFAULT_CODEC;
+    long             n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t       *threads   = NULL;
+    long             n_started = 0;
+    hid_t            src_fid   = H5I_INVALID_HID;
+    hid_t            src_did   = H5I_INVALID_HID;
+    hid_t            dst_fid   = H5I_INVALID_HID;
+    hid_t            dst_did   = H5I_INVALID_HID;
+    hid_t            fapl_id   = H5I_INVALID_HID;
+    hid_t            sid       = H5I_INVALID_HID;
+    hid_t            tid       = H5I_INVALID_HID;
+    hid_t            dcpl_id   = H5I_INVALID_HID;
+    int              rank;
+    hsize_t          dims[H5S_MAX_RANK];
+    hsize_t          chunk_dims[H5S_MAX_RANK];
+    hsize_t          offset[H5S_MAX_RANK];
+    hsize_t          n_expected = 0;
+    int              more       = 1;
+    int              pass_through;
+    uint64_t         n_inflight = 0;
+    uint64_t         n_chunks   = 0;
+    uint64_t         bytes_in   = 0;
+    uint64_t         bytes_out  = 0;
+    double           t_start;
+    char             src_name[32];
+    char             dst_name[32];
+
+    memset(&r, 0, sizeof(r));
+    queue_init(&r.todo);
+    queue_init(&r.done);
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <in.h5> <out.h5> [codec] [n_threads] [dataset]\n", argv[0]);
+        goto badness;
+    }
+    if (argc > 3)
+        codec_str = argv[3];
+    if (argc > 4)
+        n_threads = atol(argv[4]);
+    if (argc > 5)
+        dset_name = argv[5];
+    if (codec_parse(codec_str, &r.dst) < 0)
+        goto badness;
+    if (n_threads < 1)
+        n_threads = 1;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Source */
+    if ((src_fid = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((src_did = H5Dopen2(src_fid, dset_name, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((dcpl_id = H5Dget_create_plist(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5D_CHUNKED != H5Pget_layout(dcpl_id)) {
+        fprintf(stderr, "%s isn't chunked\n", dset_name);
+        goto badness;
+    }
+    if ((rank = H5Pget_chunk(dcpl_id, H5S_MAX_RANK, chunk_dims)) < 0)
+        goto badness;
+    if (codec_from_dcpl(dcpl_id, &r.src) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    dcpl_id = H5I_INVALID_HID;
+
+    if ((sid = H5Dget_space(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sget_simple_extent_dims(sid, dims, NULL) < 0)
+        goto badness;
+    if (H5Dget_num_chunks(src_did, sid, &n_expected) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    sid = H5I_INVALID_HID;
+
+    if ((tid = H5Dget_type(src_did)) == H5I_INVALID_HID)
+        goto badness;
+    r.elem_size   = H5Tget_size(tid);
+    r.chunk_bytes = r.elem_size;
+    for (int d = 0; d < rank; d++)
+        r.chunk_bytes *= (size_t)chunk_dims[d];
+    if (H5Tclose(tid) < 0)
+        goto badness;
+    tid = H5I_INVALID_HID;
+
+    /* Same filters at the same level, so there's nothing to do but copy */
+    pass_through = r.src.shuffle == r.dst.shuffle && r.src.deflate == r.dst.deflate &&
+                   (!r.dst.deflate || r.src.level == r.dst.level);
+
+    /* Destination */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+    if ((dst_fid = H5Fcreate(argv[2], H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+    if ((dst_did = create_copy(src_did, dst_fid, dset_name, &r.dst)) == H5I_INVALID_HID)
+        goto badness;
+
+    codec_name(&r.src, src_name, sizeof(src_name));
+    codec_name(&r.dst, dst_name, sizeof(dst_name));
+    printf("%s: %llu CHUNKS, %s -> %s%s\n", dset_name, (unsigned long long)n_expected, src_name, dst_name,
+           pass_through ? " (COPYING AS IS)" : "");
+    if (!pass_through)
+        printf("USING %ld THREADS\n", n_threads);
+
+    /* Workers */
+    if (!pass_through) {
+        if (NULL == (threads = calloc((size_t)n_threads, sizeof(pthread_t))))
+            goto badness;
+        for (; n_started < n_threads; n_started++)
+            if (pthread_create(&threads[n_started], NULL, worker_thread, &r) != 0)
+                goto badness;
+    }
+
+    /* Read chunks ahead while there's room, write the ones that come back */
+    t_start = now_seconds();
+    memset(offset, 0, sizeof(offset));
+    for (int d = 0; d < rank; d++)
+        if (0 == dims[d])
+            more = 0;
+
+    while ((more || n_inflight > 0) && !stop) {
+        chunk_t *chunk = NULL;
+        herr_t   ret;
+
+        if (more && n_inflight < (uint64_t)n_threads * INFLIGHT_PER_THREAD) {
+            if (NULL == (chunk = read_next_chunk(src_did, rank, dims, chunk_dims, offset, &more, &ret))) {
+                if (ret < 0)
+                    goto badness;
+                continue;
+            }
+            bytes_in += chunk->size;
+
+            if (!pass_through) {
+                queue_push(&r.todo, chunk);
+                n_inflight++;
+                chunk = queue_pop(&r.done, 0);
+            }
+        }
+        else
+            chunk = queue_pop(&r.done, 1);
+
+        if (NULL == chunk)
+            continue;
+        if (!pass_through)
+            n_inflight--;
+
+        if (chunk->failed) {
+            chunk_free(chunk);
+            goto badness;
+        }
+        if (H5Dwrite_chunk(dst_did, H5P_DEFAULT, chunk->filter_mask, chunk->offset, chunk->size, chunk->data) < 0) {
+            chunk_free(chunk);
+            goto badness;
+        }
+        bytes_out += chunk->size;
+        n_chunks++;
+        chunk_free(chunk);
+    }
+
+    if (stop) {
+        fprintf(stderr, "interrupted, %s is incomplete\n", argv[2]);
+        goto badness;
+    }
+    if (n_chunks != n_expected) {
+        fprintf(stderr, "copied %llu chunks but the source has %llu\n", (unsigned long long)n_chunks,
+                (unsigned long long)n_expected);
+        goto badness;
+    }
+
+    printf("COPIED: %llu chunks, %llu -> %llu bytes in %.3f s\n", (unsigned long long)n_chunks,
+           (unsigned long long)bytes_in, (unsigned long long)bytes_out, now_seconds() - t_start);
+
+    queue_close(&r.todo);
+    for (long i = 0; i < n_started; i++)
+        pthread_join(threads[i], NULL);
+    n_started = 0;
+
+    if (H5Dclose(dst_did) < 0)
+        goto badness;
+    if (H5Fclose(dst_fid) < 0)
+        goto badness;
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Dclose(src_did) < 0)
+        goto badness;
+    if (H5Fclose(src_fid) < 0)
+        goto badness;
+
+    queue_destroy(&r.todo);
+    queue_destroy(&r.done);
+    free(threads);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    queue_close(&r.todo);
+    for (long i = 0; i < n_started; i++)
+        pthread_join(threads[i], NULL);
+
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+        H5Tclose(tid);
+        H5Pclose(dcpl_id);
+        H5Pclose(fapl_id);
+        H5Dclose(dst_did);
+        H5Fclose(dst_fid);
+        H5Dclose(src_did);
+        H5Fclose(src_fid);
+    }
+    H5E_END_TRY;
+
+    queue_destroy(&r.todo);
+    queue_destroy(&r.done);
+    free(threads);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
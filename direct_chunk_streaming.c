@@ -0,0 +1,473 @@
+/* direct_chunk_streaming.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version writes very large chunks (a whole detector frame each)
+ * and compresses them as a stream instead of with one compress2() call.
+ * compress2() needs an output buffer of compressBound() of the chunk up
+ * front, so a writer using it holds two chunks' worth of memory per frame.
+ * Here the frame is deflated a slice at a time as it arrives, into an
+ * output buffer that only grows as far as the compressed data does and
+ * is kept for the next frame. Peak memory is the frame plus its
+ * compressed size, i.e. roughly one chunk.
+ *
+ * To build:
+ *      h5cc -O2 -o streaming direct_chunk_streaming.c -lm -lz
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require POSIX-y things (sorry Windows users)
+ *
+ * To run:
+ *      ./streaming [frame_MiB] [level] [n_frames]
+ *
+ *      - frame_MiB (default 256) is the chunk size, up to 2048
+ *      - level (default 1) is the deflate level. Fast levels are the
+ *        only ones that keep up with frames this size.
+ *      - It will generate frames back to back, every fourth one pure
+ *        noise, and print the size, time and output buffer for each
+ *      - n_frames stops after that many; otherwise ctrl-c stops the
+ *        program
+ *
+ * How a frame is written:
+ *
+ *      The frame is filled SLICE_SIZE bytes at a time (standing in for
+ *      the detector readout) and each slice goes to deflate() while it's
+ *      still in cache. One z_stream is kept for the whole run and reset
+ *      per frame, so zlib's own state isn't reallocated either.
+ *
+ *      When deflate() fills the output buffer, the buffer is doubled, but
+ *      never past the size of the frame. Before growing it we check how
+ *      well the frame is compressing so far; if the output is more than
+ *      RAW_ABOVE of the input (or would outgrow the frame), compressing
+ *      isn't worth it. The rest of the frame is filled without
+ *      compressing it and the frame is written raw, with deflate skipped
+ *      in the filter mask (0x1). Noise is caught within the first couple
+ *      of slices, so it doesn't drag the buffer up to a full frame.
+ *
+ *      The chunk is written with its true compressed size.
+ */
+
+#include <hdf5.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_streaming.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+#define DEFAULT_FRAME_MIB 256
+#define MAX_FRAME_MIB     2048
+
+#define DEFAULT_LEVEL 1
+
+/* How much of the frame is filled and handed to deflate() at once */
+const size_t SLICE_SIZE = 1024 * 1024;
+
+/* Frames compressing worse than this are stored raw */
+const double RAW_ABOVE = 0.9;
+
+const int FILL_VALUE = -1;
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**********/
+/* Source */
+/**********/
+
+/* Fills elements [start, end) of a frame. Frames look like a flat
+ * baseline with a pulse across the middle and a little noise, except
+ * every fourth, which is random 32-bit values.
+ */
+void
+fill_slice(uint64_t frame, hsize_t frame_size, hsize_t start, hsize_t end, int *buf)
+{
+    uint64_t state = (frame * frame_size + start) * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (hsize_t i = start; i < end; i++) {
+        double x = ((double)i / (double)frame_size - 0.5) * 8.0;
+
+        /* xorshift64 */
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        if (3 == frame % 4)
+            buf[i] = (int)(uint32_t)state;
+        else
+            buf[i] = 1000 + (int)(30000.0 * exp(-x * x)) + (int)(state % 16);
+    }
+}
+
+/**********/
+/* Output */
+/**********/
+
+/* Output buffer that grows as needed and is kept between frames */
+typedef struct {
+    uint8_t *buf;
+    size_t   capacity;
+    size_t   limit;    /* Never grows past this */
+} pool_t;
+
+/* Doubles the buffer. Returns FAIL if it's already at the limit or can't
+ * be allocated.
+ */
+herr_t
+pool_grow(pool_t *pool)
+{
+    size_t   new_capacity = pool->capacity ? 2 * pool->capacity : SLICE_SIZE;
+    uint8_t *new_buf;
+
+    if (pool->capacity >= pool->limit)
+        return FAIL;
+    if (new_capacity > pool->limit)
+        new_capacity = pool->limit;
+    if (NULL == (new_buf = realloc(pool->buf, new_capacity)))
+        return FAIL;
+
+    pool->buf      = new_buf;
+    pool->capacity = new_capacity;
+
+    return SUCCEED;
+}
+
+/* Points deflate at the free part of the pool */
+void
+set_output(z_stream *z, pool_t *pool)
+{
+    size_t avail = pool->capacity - (size_t)z->total_out;
+
+    z->next_out  = pool->buf + z->total_out;
+    z->avail_out = avail > UINT_MAX ? UINT_MAX : (uInt)avail;
+}
+
+/* Runs deflate over whatever input it has been given. With Z_FINISH it
+ * goes until the stream is complete. Sets *raw, and stops, if the frame
+ * isn't worth compressing.
+ */
+herr_t
+deflate_slice(z_stream *z, pool_t *pool, int flush, int *raw)
+{
+    for (;;) {
+        int z_ret;
+
+        if ((size_t)z->total_out == pool->capacity) {
+            if (pool->capacity >= pool->limit || (double)z->total_out > RAW_ABOVE * (double)z->total_in) {
+                *raw = 1;
+                return SUCCEED;
+            }
+            if (pool_grow(pool) < 0) {
+                fprintf(stderr, "can't grow output buffer past %zu bytes\n", pool->capacity);
+                return FAIL;
+            }
+        }
+        set_output(z, pool);
+
+        z_ret = deflate(z, flush);
+        if (Z_STREAM_END == z_ret)
+            return SUCCEED;
+        if (Z_OK != z_ret) {
+            fprintf(stderr, "deflate error: %d\n", z_ret);
+            return FAIL;
+        }
+
+        /* Room left over means deflate has taken all the input */
+        if (Z_FINISH != flush && z->avail_out > 0)
+            return SUCCEED;
+    }
+}
+
+/********/
+/* HDF5 */
+/********/
+
+herr_t
+setup(hsize_t frame_size, int level)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {frame_size};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, (unsigned)level) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+herr_t
+direct_write(hid_t did, hsize_t offset, hsize_t frame_size, int *frame, z_stream *z, pool_t *pool)
+{
+    size_t   frame_bytes = (size_t)frame_size * sizeof(int);
+    hsize_t  slice_elems = SLICE_SIZE / sizeof(int);
+    uint64_t n           = offset / frame_size;
+    uint32_t filter_mask = 0;
+    int      raw         = 0;
+    double   t_start     = now_seconds();
+
+    if (offset / frame_size > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+
+    if (deflateReset(z) != Z_OK)
+        goto badness;
+
+    /* Fill and compress a slice at a time */
+    for (hsize_t start = 0; start < frame_size; start += slice_elems) {
+        hsize_t end = start + slice_elems < frame_size ? start + slice_elems : frame_size;
+
+        fill_slice(n, frame_size, start, end, frame);
+
+        if (raw)
+            continue;
+
+        z->next_in  = (Bytef *)(frame + start);
+        z->avail_in = (uInt)((end - start) * sizeof(int));
+        if (deflate_slice(z, pool, end == frame_size ? Z_FINISH : Z_NO_FLUSH, &raw) < 0)
+            goto badness;
+    }
+
+    /* Write the compressed data to the chunk, or the frame itself if
+     * deflate didn't help
+     */
+    if (raw) {
+        filter_mask = 0x1;
+        if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, frame_bytes, frame) < 0)
+            goto badness;
+    }
+    else if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, (size_t)z->total_out, pool->buf) < 0)
+        goto badness;
+
+    printf("frame %llu: %zu MiB -> %.1f MiB%s in %.2f s, output buffer %.1f MiB\n", (unsigned long long)n,
+           frame_bytes >> 20, (raw ? (double)frame_bytes : (double)z->total_out) / (1024.0 * 1024.0),
+           raw ? " (raw)" : "", now_seconds() - t_start, (double)pool->capacity / (1024.0 * 1024.0));
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    z_stream         z;
+    pool_t           pool;
+    long             frame_mib = DEFAULT_FRAME_MIB;
+    int              level     = DEFAULT_LEVEL;
+    uint64_t         max_frames = 0;
+    int              z_ready   = 0;
+    int             *frame     = NULL;
+    hsize_t          frame_size;
+
+    hid_t fid = H5I_INVALID_HID;
+    hid_t did = H5I_INVALID_HID;
+
+    memset(&z, 0, sizeof(z));
+    memset(&pool, 0, sizeof(pool));
+
+    if (argc > 1)
+        frame_mib = atol(argv[1]);
+    if (argc > 2)
+        level = atoi(argv[2]);
+    if (argc > 3)
+        max_frames = (uint64_t)atoll(argv[3]);
+    if (frame_mib < 1 || frame_mib > MAX_FRAME_MIB) {
+        fprintf(stderr, "frame_MiB must be between 1 and %d\n", MAX_FRAME_MIB);
+        goto badness;
+    }
+    if (level < 1 || level > 9) {
+        fprintf(stderr, "level must be between 1 and 9\n");
+        goto badness;
+    }
+    frame_size = (hsize_t)frame_mib * 1024 * 1024 / sizeof(int);
+
+    /* The frame, the stream and the start of the output buffer, set up once */
+    if (NULL == (frame = malloc((size_t)frame_size * sizeof(int))))
+        goto badness;
+    if (deflateInit(&z, level) != Z_OK)
+        goto badness;
+    z_ready    = 1;
+    pool.limit = (size_t)frame_size * sizeof(int);
+    if (pool_grow(&pool) < 0)
+        goto badness;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    /* Set up file and dataset */
+    if (setup(frame_size, level) < 0)
+        goto badness;
+
+    printf("FILE CREATION COMPLETE\n");
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Number of dataset chunks */
+    uint64_t n_chunks = 0;
+
+    while (!stop && (0 == max_frames || n_chunks < max_frames)) {
+
+        /* The write offset where we'll be scribbling our data */
+        hsize_t write_offset = n_chunks * frame_size;
+
+        /* The new size of the dataset after we extend */
+        hsize_t new_size = (n_chunks + 1) * frame_size;
+
+        if (extend_dataset(did, new_size) < 0)
+            goto badness;
+
+        if (direct_write(did, write_offset, frame_size, frame, &z, &pool) < 0)
+            goto badness;
+
+        n_chunks += 1;
+    }
+
+    printf("PEAK OUTPUT BUFFER: %.1f MiB (compressBound() of a frame: %.1f MiB)\n",
+           (double)pool.capacity / (1024.0 * 1024.0),
+           (double)compressBound((uLong)(frame_size * sizeof(int))) / (1024.0 * 1024.0));
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    deflateEnd(&z);
+    free(pool.buf);
+    free(frame);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    if (z_ready)
+        deflateEnd(&z);
+    free(pool.buf);
+    free(frame);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,698 @@
+/* direct_chunk_striped.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version stripes one stream of chunks across several files, one
+ * per directory (which would normally each be on a different disk), and
+ * publishes a virtual dataset (VDS) that stitches the stripes back into
+ * a single dataset. Each stripe has its own writer process, so each disk
+ * gets its own I/O stream.
+ *
+ * To build:
+ *      h5cc -O2 -o striped direct_chunk_striped.c -lm -lz
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require HDF5 1.10 or later (virtual datasets)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./striped [dir,dir,...] [stripe_width] [chunks_per_second]
+ *
+ *      - Writes one stripe file (direct_chunk_stripe.h5) into each
+ *        directory. The default is stripe_0,stripe_1,stripe_2,stripe_3,
+ *        which are created if they don't exist.
+ *      - stripe_width (default 4) consecutive chunks go to one stripe
+ *        before moving on to the next, round-robin
+ *      - chunks_per_second (default 0, meaning as fast as possible)
+ *        paces the synthetic source
+ *      - Read direct_chunk_striped.h5 to see the whole stream
+ *      - ctrl-c stops the program
+ *
+ * How it works:
+ *
+ *      The parent process generates and compresses every chunk, then
+ *      hands it down a pipe to the writer process for its stripe. Each
+ *      writer process owns one file and just does H5Dset_extent() and
+ *      H5Dwrite_chunk() as chunks arrive, so a slow disk only slows the
+ *      parent down once that stripe's pipe is full.
+ *
+ *      As in direct_chunk_vds_writer.c, the writers are processes rather
+ *      than threads because the HDF5 library serializes API calls, and we
+ *      fork before the parent touches HDF5.
+ *
+ *      Chunk c of the stream is chunk
+ *
+ *          (c / (W * N)) * W + c % W
+ *
+ *      of stripe (c / W) % N, for stripe width W and N stripes. The VDS
+ *      maps each stripe's dataset, W chunks at a time, to every N-th
+ *      block of W chunks, and is unlimited so it grows as the stripes do.
+ */
+
+#include <hdf5.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *MASTER_FILE_NAME = "direct_chunk_striped.h5";
+const char *STRIPE_FILE_NAME = "direct_chunk_stripe.h5";
+const char *DSET_NAME        = "data";
+const char *DEFAULT_DIRS     = "stripe_0,stripe_1,stripe_2,stripe_3";
+
+#define RANK 1
+
+#define MAX_STRIPES 64
+
+#define NAME_LEN 4096
+
+/* 256 KiB of ints */
+const hsize_t CHUNK_SIZE = 64 * 1024;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+/* What the parent sends a stripe writer for each chunk, followed by size
+ * bytes of chunk data
+ */
+typedef struct {
+    uint64_t local_chunk; /* Chunk index in the stripe's dataset */
+    uint64_t size;
+    uint32_t filter_mask;
+} chunk_msg_t;
+
+/* One stripe, as the parent sees it */
+typedef struct {
+    char     file_name[NAME_LEN];
+    pid_t    pid;
+    int      fd;          /* Write end of the pipe to the writer */
+    uint64_t n_chunks;
+    uint64_t n_bytes;
+} stripe_t;
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+/* read() and write() that don't give up on short transfers. Returns the
+ * number of bytes transferred, which is only less than len at EOF.
+ */
+ssize_t
+read_all(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+            return -1;
+        if (0 == n)
+            break;
+        done += (size_t)n;
+    }
+
+    return (ssize_t)done;
+}
+
+herr_t
+write_all(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+            return FAIL;
+        done += (size_t)n;
+    }
+
+    return SUCCEED;
+}
+
+/********/
+/* HDF5 */
+/********/
+
+herr_t
+setup(const char *file_name)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(file_name, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Creates the master file with a virtual dataset that interleaves the
+ * stripes' datasets, stripe_width chunks at a time
+ */
+herr_t
+setup_master(const stripe_t *stripes, int n_stripes, hsize_t stripe_width)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t vsid    = H5I_INVALID_HID;
+    hid_t src_sid = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    if ((fid = H5Fcreate(MASTER_FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Virtual and source dataspaces */
+    if ((vsid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+    if ((src_sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    for (int i = 0; i < n_stripes; i++) {
+        hsize_t start[RANK];
+        hsize_t stride[RANK];
+        hsize_t count[RANK] = {H5S_UNLIMITED};
+        hsize_t block[RANK] = {stripe_width * CHUNK_SIZE};
+
+        /* Stripe i owns every n_stripes-th block of stripe_width chunks,
+         * starting at block i
+         */
+        start[0]  = (hsize_t)i * stripe_width * CHUNK_SIZE;
+        stride[0] = (hsize_t)n_stripes * stripe_width * CHUNK_SIZE;
+        if (H5Sselect_hyperslab(vsid, H5S_SELECT_SET, start, stride, count, block) < 0)
+            goto badness;
+
+        /* ...taken a block at a time from the stripe's dataset */
+        start[0]  = 0;
+        stride[0] = stripe_width * CHUNK_SIZE;
+        if (H5Sselect_hyperslab(src_sid, H5S_SELECT_SET, start, stride, count, block) < 0)
+            goto badness;
+
+        if (H5Pset_virtual(dcpl_id, vsid, stripes[i].file_name, DSET_NAME, src_sid) < 0)
+            goto badness;
+    }
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, vsid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(vsid) < 0)
+        goto badness;
+    if (H5Sclose(src_sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(vsid);
+        H5Sclose(src_sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/*****************/
+/* Stripe writer */
+/*****************/
+
+/* The main loop of one stripe writer process: write whatever comes down
+ * the pipe until the parent closes it
+ */
+herr_t
+run_stripe(const char *file_name, int fd)
+{
+    hid_t       fid    = H5I_INVALID_HID;
+    hid_t       did    = H5I_INVALID_HID;
+    void       *buf    = NULL;
+    hsize_t     extent = 0;
+    chunk_msg_t msg;
+    ssize_t     n;
+
+    if (setup(file_name) < 0)
+        goto badness;
+
+    if ((fid = H5Fopen(file_name, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Big enough for an uncompressed chunk */
+    if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+
+    while ((n = read_all(fd, &msg, sizeof(msg))) == sizeof(msg)) {
+        hsize_t offset = msg.local_chunk * CHUNK_SIZE;
+
+        if (msg.size > CHUNK_SIZE * sizeof(int) || read_all(fd, buf, msg.size) != (ssize_t)msg.size) {
+            fprintf(stderr, "%s: bad chunk message\n", file_name);
+            goto badness;
+        }
+
+        /* Chunks arrive in order, so this grows by one chunk at a time
+         *
+         * WARNING: This is wildly inefficient - don't extend by one chunk
+         *          at a time in real code
+         */
+        if (offset + CHUNK_SIZE > extent) {
+            extent = offset + CHUNK_SIZE;
+            if (extend_dataset(did, extent) < 0)
+                goto badness;
+        }
+
+        if (H5Dwrite_chunk(did, H5P_DEFAULT, msg.filter_mask, &offset, (size_t)msg.size, buf) < 0)
+            goto badness;
+    }
+    if (0 != n) {
+        fprintf(stderr, "%s: short read from parent\n", file_name);
+        goto badness;
+    }
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    free(buf);
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    free(buf);
+
+    return FAIL;
+}
+
+/**********/
+/* Parent */
+/**********/
+
+/* Fills the chunk with its chunk number in the whole stream, so reading
+ * the VDS should give 0, 1, 2, ... in chunk order. Compresses it into
+ * out, falling back to raw if that doesn't help.
+ */
+herr_t
+make_chunk(uint64_t chunk, int *buf, void *out, size_t out_cap, size_t *out_size, uint32_t *filter_mask)
+{
+    size_t buf_size  = CHUNK_SIZE * sizeof(int);
+    uLongf z_destLen = (uLongf)out_cap;
+
+    if (chunk > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        return FAIL;
+    }
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+        buf[i] = (int)chunk;
+
+    /* Compress the data using zlib */
+    int z_ret = compress2((Bytef *)out, &z_destLen, (const Bytef *)buf, (uLong)buf_size, COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        return FAIL;
+    }
+
+    if (z_destLen < buf_size) {
+        *out_size    = (size_t)z_destLen;
+        *filter_mask = 0;
+    }
+    else {
+        /* Store raw, skipping the deflate filter */
+        memcpy(out, buf, buf_size);
+        *out_size    = buf_size;
+        *filter_mask = 0x1;
+    }
+
+    return SUCCEED;
+}
+
+/* Sends chunks to the stripes until told to stop */
+herr_t
+run_parent(stripe_t *stripes, int n_stripes, hsize_t stripe_width, double rate)
+{
+    int            *buf     = NULL;
+    void           *out     = NULL;
+    size_t          out_cap = (size_t)compressBound((uLong)(CHUNK_SIZE * sizeof(int)));
+    uint64_t        chunk   = 0;
+    struct timespec start;
+    struct timespec now;
+
+    if (NULL == (buf = malloc(CHUNK_SIZE * sizeof(int))))
+        goto badness;
+    if (NULL == (out = malloc(out_cap)))
+        goto badness;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (!stop) {
+        uint64_t    block  = chunk / stripe_width;
+        stripe_t   *stripe = &stripes[block % (uint64_t)n_stripes];
+        chunk_msg_t msg;
+
+        if (make_chunk(chunk, buf, out, out_cap, &msg.size, &msg.filter_mask) < 0)
+            goto badness;
+
+        msg.local_chunk = (block / (uint64_t)n_stripes) * stripe_width + chunk % stripe_width;
+
+        /* Blocks while this stripe's writer is behind */
+        if (write_all(stripe->fd, &msg, sizeof(msg)) < 0 || write_all(stripe->fd, out, msg.size) < 0) {
+            if (!stop)
+                perror("stripe pipe");
+            goto badness;
+        }
+
+        stripe->n_chunks++;
+        stripe->n_bytes += msg.size;
+        chunk++;
+
+        /* Pace the source */
+        if (rate > 0.0) {
+            double          due = (double)chunk / rate;
+            double          elapsed;
+            struct timespec ts;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            elapsed = (double)(now.tv_sec - start.tv_sec) + (double)(now.tv_nsec - start.tv_nsec) / 1e9;
+            if (due > elapsed) {
+                ts.tv_sec  = (time_t)(due - elapsed);
+                ts.tv_nsec = (long)((due - elapsed - (double)ts.tv_sec) * 1e9);
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    {
+        double elapsed = (double)(now.tv_sec - start.tv_sec) + (double)(now.tv_nsec - start.tv_nsec) / 1e9;
+
+        printf("%llu CHUNKS IN %.2f s (%.1f MiB/s UNCOMPRESSED)\n", (unsigned long long)chunk, elapsed,
+               elapsed > 0.0 ? (double)chunk * (double)(CHUNK_SIZE * sizeof(int)) / elapsed / (1024 * 1024)
+                             : 0.0);
+        for (int i = 0; i < n_stripes; i++)
+            printf("  %s: %llu chunks, %llu bytes\n", stripes[i].file_name,
+                   (unsigned long long)stripes[i].n_chunks, (unsigned long long)stripes[i].n_bytes);
+    }
+
+    free(buf);
+    free(out);
+
+    return SUCCEED;
+
+badness:
+    free(buf);
+    free(out);
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    stripe_t         stripes[MAX_STRIPES];
+    int              n_stripes    = 0;
+    hsize_t          stripe_width = 4;
+    double           rate         = 0.0;
+    int              failed       = 0;
+    char            *dirs         = NULL;
+    char            *save         = NULL;
+
+    if (argc > 2)
+        stripe_width = (hsize_t)strtoull(argv[2], NULL, 10);
+    if (argc > 3)
+        rate = atof(argv[3]);
+    if (stripe_width < 1 || rate < 0.0) {
+        fprintf(stderr, "bad stripe width or rate\n");
+        goto badness;
+    }
+
+    /* One stripe per directory */
+    if (NULL == (dirs = strdup(argc > 1 ? argv[1] : DEFAULT_DIRS)))
+        goto badness;
+    for (char *dir = strtok_r(dirs, ",", &save); dir; dir = strtok_r(NULL, ",", &save)) {
+        if (n_stripes == MAX_STRIPES) {
+            fprintf(stderr, "too many stripes\n");
+            goto badness;
+        }
+        if (mkdir(dir, 0755) < 0 && EEXIST != errno) {
+            perror(dir);
+            goto badness;
+        }
+
+        memset(&stripes[n_stripes], 0, sizeof(stripe_t));
+        snprintf(stripes[n_stripes].file_name, NAME_LEN, "%s/%s", dir, STRIPE_FILE_NAME);
+        stripes[n_stripes].fd = -1;
+        n_stripes++;
+    }
+    free(dirs);
+    dirs = NULL;
+
+    if (0 == n_stripes) {
+        fprintf(stderr, "no stripe directories\n");
+        goto badness;
+    }
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* A writer exiting early means it failed, so stop everything */
+    sigaction(SIGCHLD, &sa, NULL);
+
+    /* ...and we'd rather get EPIPE than die when that happens */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Start the writers before touching HDF5 in this process */
+    for (int i = 0; i < n_stripes; i++) {
+        int   fds[2];
+        pid_t pid;
+
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            stop = failed = 1;
+            break;
+        }
+
+        if ((pid = fork()) < 0) {
+            perror("fork");
+            close(fds[0]);
+            close(fds[1]);
+            stop = failed = 1;
+            break;
+        }
+
+        if (0 == pid) {
+
+            /* The writers stop when the parent closes their pipes, not
+             * on ctrl-c, so nothing already sent is lost
+             */
+            signal(SIGINT, SIG_IGN);
+            signal(SIGTERM, SIG_IGN);
+
+            /* Don't hold other stripes' pipes open */
+            close(fds[1]);
+            for (int j = 0; j < i; j++)
+                close(stripes[j].fd);
+
+            if (run_stripe(stripes[i].file_name, fds[0]) < 0) {
+                fprintf(stderr, "stripe writer %d failed\n", i);
+                _exit(EXIT_FAILURE);
+            }
+            _exit(EXIT_SUCCESS);
+        }
+
+        close(fds[0]);
+        stripes[i].pid = pid;
+        stripes[i].fd  = fds[1];
+    }
+
+    /* The source files don't have to exist yet for the VDS to be created */
+    if (!stop && setup_master(stripes, n_stripes, stripe_width) < 0) {
+        fprintf(stderr, "can't create master file\n");
+        stop = failed = 1;
+    }
+
+    if (!stop) {
+        printf("FILE CREATION COMPLETE (%d stripes, %llu chunks wide)\n", n_stripes,
+               (unsigned long long)stripe_width);
+        printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+        if (run_parent(stripes, n_stripes, stripe_width, rate) < 0)
+            failed = 1;
+    }
+
+    /* Closing the pipes tells the writers to finish up */
+    for (int i = 0; i < n_stripes; i++)
+        if (stripes[i].fd >= 0)
+            close(stripes[i].fd);
+
+    for (int i = 0; i < n_stripes; i++) {
+        int   status;
+        pid_t pid;
+
+        if (0 == stripes[i].pid)
+            continue;
+
+        /* The writers exiting raise SIGCHLD, which can interrupt us */
+        while ((pid = waitpid(stripes[i].pid, &status, 0)) < 0 && EINTR == errno)
+            ;
+        if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = 1;
+    }
+
+    if (failed)
+        goto badness;
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    free(dirs);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
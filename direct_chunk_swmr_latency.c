@@ -0,0 +1,693 @@
+/* direct_chunk_swmr_latency.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version measures how long it takes for a chunk to show up in a
+ * SWMR reader: from the moment the writer generates it to the moment a
+ * reader in another process has seen the new extent, read the chunk and
+ * decompressed it. That's the number the control room cares about, and it
+ * depends a lot on when the writer flushes and how big the chunks are, so
+ * it's measured for a few of each.
+ *
+ * To build:
+ *      h5cc -O2 -o swmr_latency direct_chunk_swmr_latency.c -lm -lz
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require HDF5 1.10 or later (SWMR)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./swmr_latency [chunks_per_run] [chunks_per_second]
+ *
+ *      - For each chunk size in CHUNK_SIZES and each flush policy, writes
+ *        chunks_per_run (default 100) chunks at chunks_per_second (default
+ *        50) to direct_chunk_swmr_latency.h5 while a reader process
+ *        follows along
+ *      - Prints the latency percentiles for each combination
+ *      - ctrl-c stops after the current run
+ *
+ * Flush policies:
+ *
+ *      none        Never flush while writing. Chunks become visible when
+ *                  the library happens to write the metadata out, which
+ *                  may be only when the file is closed.
+ *      dflush/10   H5Dflush() after every 10th chunk
+ *      dflush      H5Dflush() after every chunk
+ *      fflush      H5Fflush() after every chunk
+ *
+ * Chunks the reader only saw after the writer closed the file are counted
+ * as LATE; their latency mostly measures how long the run was.
+ *
+ * How it works:
+ *
+ *      Each chunk starts with the CLOCK_MONOTONIC time it was generated at
+ *      and its own index. The reader polls every READER_POLL_US with
+ *      H5Drefresh(), reads each new chunk with H5Dread() (so it goes
+ *      through the filter pipeline), and takes the time when the index
+ *      in the data matches. A chunk whose extent is visible but whose
+ *      index entry isn't reads back as fill values and is tried again
+ *      later. CLOCK_MONOTONIC is system-wide, so the times can be compared
+ *      across processes.
+ *
+ *      The reader is a separate process, forked before the parent makes
+ *      any HDF5 calls so that no library state is inherited. The parent
+ *      tells it about each run over a pipe and it sends its latencies
+ *      back over another.
+ */
+
+#include <hdf5.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *FILE_NAME = "direct_chunk_swmr_latency.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+/* 4 KiB, 256 KiB and 4 MiB of ints */
+const hsize_t CHUNK_SIZES[] = {1024, 64 * 1024, 1024 * 1024};
+#define N_CHUNK_SIZES (sizeof(CHUNK_SIZES) / sizeof(CHUNK_SIZES[0]))
+
+/* Fast, since latency is the point */
+const unsigned COMPRESSION_LEVEL = 1;
+
+const int FILL_VALUE = -1;
+
+/* How often the reader looks for new data */
+const useconds_t READER_POLL_US = 200;
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+typedef enum {
+    FLUSH_NONE,
+    FLUSH_DSET_EVERY_10,
+    FLUSH_DSET,
+    FLUSH_FILE,
+    N_FLUSH_POLICIES
+} flush_policy_t;
+
+const char *FLUSH_NAMES[N_FLUSH_POLICIES] = {"none", "dflush/10", "dflush", "fflush"};
+
+/* What the parent sends the reader at the start of each run. A single
+ * byte on the same pipe ends the run.
+ */
+typedef struct {
+    uint64_t chunk_size;
+    uint64_t n_chunks;
+} run_msg_t;
+
+/* What the reader sends back at the end of each run, followed by n_seen
+ * latencies (doubles, in seconds)
+ */
+typedef struct {
+    uint64_t n_seen;
+    uint64_t n_late;
+} result_msg_t;
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* read() and write() that don't give up on short transfers. Returns the
+ * number of bytes transferred, which is only less than len at EOF.
+ */
+ssize_t
+read_all(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+            return -1;
+        if (0 == n)
+            break;
+        done += (size_t)n;
+    }
+
+    return (ssize_t)done;
+}
+
+herr_t
+write_all(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+            return FAIL;
+        done += (size_t)n;
+    }
+
+    return SUCCEED;
+}
+
+int
+compare_doubles(const void *_a, const void *_b)
+{
+    double a = *(const double *)_a;
+    double b = *(const double *)_b;
+
+    return (a > b) - (a < b);
+}
+
+/********/
+/* HDF5 */
+/********/
+
+herr_t
+setup(hsize_t chunk_size)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {chunk_size};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+herr_t
+direct_write(hid_t did, hsize_t chunk_size, hsize_t offset, int *buf, void *buf_out)
+{
+    size_t          buf_size    = chunk_size * sizeof(int);
+    uLongf          z_destLen   = compressBound((uLong)buf_size);
+    uint32_t        filter_mask = 0;
+    struct timespec ts;
+
+    /* Synthetic data: when it was made, which chunk it is, then a ramp */
+    if (offset / chunk_size > INT_MAX) {
+        fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+        goto badness;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    buf[0] = (int)ts.tv_sec;
+    buf[1] = (int)ts.tv_nsec;
+    buf[2] = (int)(offset / chunk_size);
+    for (hsize_t i = 3; i < chunk_size; i++)
+        buf[i] = (int)((offset + i) % INT_MAX);
+
+    /* Compress the data using zlib */
+    int z_ret = compress2((Bytef *)buf_out, &z_destLen, (const Bytef *)buf, (uLong)buf_size, COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+    if (z_destLen >= buf_size) {
+        /* Incompressible, so store it raw, skipping deflate */
+        memcpy(buf_out, buf, buf_size);
+        z_destLen   = (uLongf)buf_size;
+        filter_mask = 0x1;
+    }
+
+    if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, (size_t)z_destLen, buf_out) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/**********/
+/* Reader */
+/**********/
+
+/* Follows one run, filling in a latency for each chunk seen */
+herr_t
+read_run(const run_msg_t *run, int cmd_fd, double *latencies, result_msg_t *result)
+{
+    hid_t    fid      = H5I_INVALID_HID;
+    hid_t    did      = H5I_INVALID_HID;
+    hid_t    fsid     = H5I_INVALID_HID;
+    hid_t    msid     = H5I_INVALID_HID;
+    int     *buf      = NULL;
+    hsize_t  cs       = (hsize_t)run->chunk_size;
+    uint64_t next     = 0;
+    int      stopping = 0;
+    char     c        = 'r';
+
+    result->n_seen = 0;
+    result->n_late = 0;
+
+    if (NULL == (buf = malloc(cs * sizeof(int))))
+        goto badness;
+    if ((msid = H5Screate_simple(RANK, &cs, NULL)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* The writer has the file open by now */
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Tell the writer we're ready (on the result pipe, which the parent
+     * reads after sending the run)
+     */
+    if (write_all(STDOUT_FILENO, &c, 1) < 0)
+        goto badness;
+
+    while (next < run->n_chunks) {
+        struct pollfd pfd = {cmd_fd, POLLIN, 0};
+        hsize_t       dims[RANK];
+
+        /* Once the writer has closed the file, one last look and we're
+         * done
+         */
+        if (!stopping && poll(&pfd, 1, 0) > 0) {
+            if (read_all(cmd_fd, &c, 1) != 1)
+                goto badness;
+            stopping = 1;
+        }
+
+        if (H5Drefresh(did) < 0)
+            goto badness;
+        if ((fsid = H5Dget_space(did)) == H5I_INVALID_HID)
+            goto badness;
+        if (H5Sget_simple_extent_dims(fsid, dims, NULL) < 0)
+            goto badness;
+
+        while (next < dims[0] / cs) {
+            hsize_t start = next * cs;
+
+            if (H5Sselect_hyperslab(fsid, H5S_SELECT_SET, &start, NULL, &cs, NULL) < 0)
+                goto badness;
+            if (H5Dread(did, H5T_NATIVE_INT, msid, fsid, H5P_DEFAULT, buf) < 0)
+                goto badness;
+
+            /* Extent's there but the chunk isn't yet */
+            if ((uint64_t)buf[2] != next)
+                break;
+
+            latencies[next] = now_seconds() - ((double)buf[0] + (double)buf[1] / 1e9);
+            if (stopping)
+                result->n_late++;
+            result->n_seen++;
+            next++;
+        }
+
+        if (H5Sclose(fsid) < 0)
+            goto badness;
+        fsid = H5I_INVALID_HID;
+
+        if (stopping)
+            break;
+
+        usleep(READER_POLL_US);
+    }
+
+    /* Wait for the writer to finish if we got everything first */
+    if (!stopping && read_all(cmd_fd, &c, 1) != 1)
+        goto badness;
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+    if (H5Sclose(msid) < 0)
+        goto badness;
+
+    free(buf);
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(fsid);
+        H5Sclose(msid);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    free(buf);
+
+    return FAIL;
+}
+
+/* The reader process. Runs arrive on cmd_fd and results go back on
+ * stdout, which the parent has pointed at a pipe.
+ */
+int
+reader_main(int cmd_fd)
+{
+    run_msg_t run;
+    ssize_t   n;
+
+    while ((n = read_all(cmd_fd, &run, sizeof(run))) == (ssize_t)sizeof(run)) {
+        result_msg_t result;
+        double      *latencies = NULL;
+
+        if (NULL == (latencies = calloc(run.n_chunks, sizeof(double))))
+            return EXIT_FAILURE;
+
+        if (read_run(&run, cmd_fd, latencies, &result) < 0) {
+            free(latencies);
+            return EXIT_FAILURE;
+        }
+
+        if (write_all(STDOUT_FILENO, &result, sizeof(result)) < 0 ||
+            write_all(STDOUT_FILENO, latencies, result.n_seen * sizeof(double)) < 0) {
+            free(latencies);
+            return EXIT_FAILURE;
+        }
+
+        free(latencies);
+    }
+
+    /* The parent closing the pipe is how we're told to go */
+    return 0 == n ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**********/
+/* Writer */
+/**********/
+
+herr_t
+write_run(hsize_t chunk_size, flush_policy_t policy, uint64_t n_chunks, double rate, int cmd_fd, int result_fd)
+{
+    hid_t        fid       = H5I_INVALID_HID;
+    hid_t        did       = H5I_INVALID_HID;
+    int         *buf       = NULL;
+    void        *buf_out   = NULL;
+    double      *latencies = NULL;
+    run_msg_t    run       = {chunk_size, n_chunks};
+    result_msg_t result;
+    char         c;
+    double       t_next;
+
+    if (NULL == (buf = malloc(chunk_size * sizeof(int))))
+        goto badness;
+    if (NULL == (buf_out = malloc((size_t)compressBound((uLong)(chunk_size * sizeof(int))))))
+        goto badness;
+    if (NULL == (latencies = malloc(n_chunks * sizeof(double))))
+        goto badness;
+
+    if (setup(chunk_size) < 0)
+        goto badness;
+    if ((fid = H5Fopen(FILE_NAME, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Start the reader and wait for it to open the file */
+    if (write_all(cmd_fd, &run, sizeof(run)) < 0)
+        goto badness;
+    if (read_all(result_fd, &c, 1) != 1)
+        goto badness;
+
+    t_next = now_seconds();
+    for (uint64_t i = 0; i < n_chunks; i++) {
+        double t;
+
+        /* Keep to the schedule rather than sleeping a fixed time, so a
+         * slow flush doesn't lower the rate
+         */
+        if ((t = t_next - now_seconds()) > 0.0)
+            usleep((useconds_t)(t * 1e6));
+        t_next += 1.0 / rate;
+
+        /* Extend by one chunk and write it
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+        if (extend_dataset(did, (i + 1) * chunk_size) < 0)
+            goto badness;
+        if (direct_write(did, chunk_size, i * chunk_size, buf, buf_out) < 0)
+            goto badness;
+
+        switch (policy) {
+            case FLUSH_DSET_EVERY_10:
+                if (i % 10 == 9 && H5Dflush(did) < 0)
+                    goto badness;
+                break;
+            case FLUSH_DSET:
+                if (H5Dflush(did) < 0)
+                    goto badness;
+                break;
+            case FLUSH_FILE:
+                if (H5Fflush(fid, H5F_SCOPE_GLOBAL) < 0)
+                    goto badness;
+                break;
+            case FLUSH_NONE:
+            default:
+                break;
+        }
+    }
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+    did = fid = H5I_INVALID_HID;
+
+    /* Tell the reader we're done and collect its results */
+    c = 's';
+    if (write_all(cmd_fd, &c, 1) < 0)
+        goto badness;
+    if (read_all(result_fd, &result, sizeof(result)) != (ssize_t)sizeof(result))
+        goto badness;
+    if (result.n_seen > n_chunks)
+        goto badness;
+    if (read_all(result_fd, latencies, result.n_seen * sizeof(double)) != (ssize_t)(result.n_seen * sizeof(double)))
+        goto badness;
+
+    /* Report */
+    printf("%8llu KiB  %-10s %6llu", (unsigned long long)(chunk_size * sizeof(int) / 1024),
+           FLUSH_NAMES[policy], (unsigned long long)result.n_seen);
+    if (result.n_seen > 0) {
+        uint64_t n = result.n_seen;
+
+        qsort(latencies, n, sizeof(double), compare_doubles);
+        printf("  %9.3f  %9.3f  %9.3f  %9.3f", 1000.0 * latencies[n / 2], 1000.0 * latencies[n * 9 / 10],
+               1000.0 * latencies[n * 99 / 100], 1000.0 * latencies[n - 1]);
+    }
+    else
+        printf("  %9s  %9s  %9s  %9s", "-", "-", "-", "-");
+    printf("  %6llu\n", (unsigned long long)result.n_late);
+    fflush(stdout);
+
+    free(buf);
+    free(buf_out);
+    free(latencies);
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    free(buf);
+    free(buf_out);
+    free(latencies);
+
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    uint64_t         n_chunks  = 100;
+    double           rate      = 50.0;
+    int              cmd[2]    = {-1, -1};
+    int              res[2]    = {-1, -1};
+    pid_t            pid       = -1;
+    int              status;
+
+    if (argc > 1)
+        n_chunks = strtoull(argv[1], NULL, 10);
+    if (argc > 2)
+        rate = atof(argv[2]);
+    if (n_chunks < 1 || rate <= 0.0) {
+        fprintf(stderr, "usage: %s [chunks_per_run] [chunks_per_second]\n", argv[0]);
+        goto badness;
+    }
+
+    /* Start the reader before touching HDF5 */
+    if (pipe(cmd) < 0 || pipe(res) < 0) {
+        perror("pipe");
+        goto badness;
+    }
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        goto badness;
+    }
+    if (0 == pid) {
+        /* ctrl-c is the parent's business */
+        signal(SIGINT, SIG_IGN);
+        close(cmd[1]);
+        close(res[0]);
+        if (dup2(res[1], STDOUT_FILENO) < 0)
+            _exit(EXIT_FAILURE);
+        close(res[1]);
+        _exit(reader_main(cmd[0]));
+    }
+    close(cmd[0]);
+    close(res[1]);
+    cmd[0] = res[1] = -1;
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+
+    printf("%d CHUNKS PER RUN AT %.1f CHUNKS/S\n", (int)n_chunks, rate);
+    printf("PRESS CTRL-C TO STOP AFTER THE CURRENT RUN\n");
+    printf("%12s  %-10s %6s  %9s  %9s  %9s  %9s  %6s\n", "CHUNK", "FLUSH", "SEEN", "P50 ms", "P90 ms",
+           "P99 ms", "MAX ms", "LATE");
+
+    for (size_t s = 0; s < N_CHUNK_SIZES && !stop; s++)
+        for (int p = 0; p < N_FLUSH_POLICIES && !stop; p++)
+            if (write_run(CHUNK_SIZES[s], (flush_policy_t)p, n_chunks, rate, cmd[1], res[0]) < 0)
+                goto badness;
+
+    /* Closing the pipe tells the reader to exit */
+    close(cmd[1]);
+    cmd[1] = -1;
+    while (waitpid(pid, &status, 0) < 0)
+        if (EINTR != errno)
+            goto badness;
+    pid = -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        goto badness;
+    close(res[0]);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    if (cmd[1] >= 0)
+        close(cmd[1]);
+    if (res[0] >= 0)
+        close(res[0]);
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,864 @@
+/* direct_chunk_tiered.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version splits the data into segment files and keeps them on two
+ * tiers of storage. The writer lands every segment on a fast device (an
+ * NVMe drive, a RAM disk), so a burst during a pulse only has to keep up
+ * with that. Once a segment is full it's sealed, and a background
+ * migrator process copies it to capacity storage where the campaign
+ * lives. A catalog file holds a virtual dataset (VDS) that maps every
+ * segment, wherever it is at the moment, into one logical dataset.
+ *
+ * To build:
+ *      h5cc -O2 -o tiered direct_chunk_tiered.c -lm -lz
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require HDF5 1.10 or later (virtual datasets)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./tiered <fast_dir> <capacity_dir> [chunks_per_segment] [chunks_per_second]
+ *
+ *      - Both directories must exist
+ *      - Segments are direct_chunk_tiered_<n>.h5, each holding
+ *        chunks_per_segment (default 60) 10-integer chunks. Chunks are
+ *        generated at chunks_per_second (default 1).
+ *      - Read direct_chunk_tiered.h5 in the current directory to see the
+ *        combined data. Chunk k holds the value k.
+ *      - ctrl-c stops the program. The partly filled last segment is
+ *        sealed and migrated like the rest before it exits.
+ *
+ * Who does what:
+ *
+ *      The writer (the main process) creates each segment on the fast
+ *      tier, writes it with SWMR so it can be read while live, and closes
+ *      it when it's full. It tells the migrator about each segment when
+ *      it opens it and when it seals it, over a pipe, and never waits for
+ *      it.
+ *
+ *      The migrator is forked before any HDF5 calls, like the writers in
+ *      direct_chunk_vds_writer.c. It runs at a lower priority and owns
+ *      the catalog. For each sealed segment it:
+ *
+ *          1. copies the file to <capacity_dir>/<name>.tmp with
+ *             copy_file_range(), which lets the kernel (or the storage)
+ *             move the data without it passing through this process,
+ *             falling back to read()/write() where that can't be done
+ *          2. fsync()s the copy, renames it into place and fsync()s the
+ *             directory, so the capacity copy is durable before anything
+ *             points at it
+ *          3. rebuilds the catalog as a new file pointing at the capacity
+ *             copy and rename()s it over the old one. Readers opening the
+ *             catalog see either the old mapping or the new one, never a
+ *             half-written file.
+ *          4. removes the fast copy UNLINK_DELAY seconds later. A VDS
+ *             opens its source files lazily, so a reader that opened the
+ *             old catalog just before the swap may still go looking for
+ *             the fast copy.
+ *
+ *      Source file names in the catalog are the directories as given, so
+ *      use absolute ones if readers run somewhere else.
+ */
+
+#include <hdf5.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *CATALOG_FILE_NAME = "direct_chunk_tiered.h5";
+const char *CATALOG_TMP_NAME  = "direct_chunk_tiered.h5.tmp";
+const char *SEGMENT_FILE_FORMAT = "%s/direct_chunk_tiered_%d.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+#define NAME_LEN 4096
+
+/* SO SMALL - Don't make chunks this size in real code! */
+const hsize_t CHUNK_SIZE = 10;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+/* How long a migrated segment's fast copy outlives the catalog swap */
+const double UNLINK_DELAY = 5.0;
+
+/* Largest piece copied per copy_file_range() or read()/write() */
+const size_t COPY_SLICE = 8 * 1024 * 1024;
+
+/* Migrator priority relative to the writer */
+#define MIGRATOR_NICE 10
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+typedef struct {
+    const char *fast_dir;
+    const char *capacity_dir;
+    hsize_t     chunks_per_segment;
+} config_t;
+
+/* What the writer tells the migrator */
+typedef enum {
+    EVENT_OPENED,  /* Segment created on the fast tier */
+    EVENT_SEALED   /* Segment complete and closed */
+} event_type_t;
+
+typedef struct {
+    event_type_t type;
+    int          segment;
+} event_t;
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+herr_t
+segment_name(const char *dir, int segment, char *name)
+{
+    if (snprintf(name, NAME_LEN, SEGMENT_FILE_FORMAT, dir, segment) >= NAME_LEN) {
+        fprintf(stderr, "segment file name is too long\n");
+        return FAIL;
+    }
+
+    return SUCCEED;
+}
+
+/*********/
+/* Files */
+/*********/
+
+/* fsync()s a file or directory by name */
+herr_t
+fsync_path(const char *name)
+{
+    int fd;
+
+    if ((fd = open(name, O_RDONLY)) < 0) {
+        perror(name);
+        return FAIL;
+    }
+    if (fsync(fd) < 0) {
+        perror(name);
+        close(fd);
+        return FAIL;
+    }
+    close(fd);
+
+    return SUCCEED;
+}
+
+/* Copies len bytes between files with read() and write() */
+herr_t
+copy_by_hand(int in_fd, int out_fd, off_t start, off_t len)
+{
+    char  *buf = NULL;
+    off_t  done;
+
+    if (NULL == (buf = malloc(COPY_SLICE)))
+        goto badness;
+
+    for (done = start; done < len;) {
+        ssize_t n = pread(in_fd, buf, COPY_SLICE, done);
+
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n <= 0)
+            goto badness;
+
+        for (ssize_t written = 0; written < n;) {
+            ssize_t m = pwrite(out_fd, buf + written, (size_t)(n - written), done + written);
+
+            if (m < 0 && EINTR == errno)
+                continue;
+            if (m < 0)
+                goto badness;
+            written += m;
+        }
+        done += n;
+    }
+
+    free(buf);
+
+    return SUCCEED;
+
+badness:
+    free(buf);
+    return FAIL;
+}
+
+/* Copies a whole file, in kernel where possible. glibc only declares
+ * copy_file_range() with _GNU_SOURCE, so go through syscall().
+ */
+herr_t
+copy_file(int in_fd, int out_fd, off_t len)
+{
+    off_t done = 0;
+
+#ifdef SYS_copy_file_range
+    while (done < len) {
+        size_t  want = (size_t)(len - done) < COPY_SLICE ? (size_t)(len - done) : COPY_SLICE;
+        long    n    = syscall(SYS_copy_file_range, in_fd, NULL, out_fd, NULL, want, 0U);
+
+        if (n < 0 && EINTR == errno)
+            continue;
+
+        /* Not supported here (old kernel, different file systems, ...) */
+        if (n < 0 && (ENOSYS == errno || EXDEV == errno || EINVAL == errno || EOPNOTSUPP == errno))
+            break;
+
+        if (n <= 0)
+            return FAIL;
+        done += (off_t)n;
+    }
+#endif
+
+    if (done < len)
+        return copy_by_hand(in_fd, out_fd, done, len);
+
+    return SUCCEED;
+}
+
+/* Copies a segment to the capacity tier and makes the copy durable */
+herr_t
+migrate_segment(const config_t *config, int segment)
+{
+    char        src[NAME_LEN];
+    char        dst[NAME_LEN];
+    char        tmp[NAME_LEN];
+    struct stat st;
+    int         in_fd  = -1;
+    int         out_fd = -1;
+    double      t_start = now_seconds();
+
+    if (segment_name(config->fast_dir, segment, src) < 0)
+        goto badness;
+    if (segment_name(config->capacity_dir, segment, dst) < 0)
+        goto badness;
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", dst) >= (int)sizeof(tmp))
+        goto badness;
+
+    if ((in_fd = open(src, O_RDONLY)) < 0) {
+        perror(src);
+        goto badness;
+    }
+    if (fstat(in_fd, &st) < 0)
+        goto badness;
+    if ((out_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(tmp);
+        goto badness;
+    }
+
+    if (copy_file(in_fd, out_fd, st.st_size) < 0) {
+        fprintf(stderr, "can't copy %s to %s: %s\n", src, tmp, strerror(errno));
+        goto badness;
+    }
+    if (fsync(out_fd) < 0) {
+        perror(tmp);
+        goto badness;
+    }
+    close(out_fd);
+    out_fd = -1;
+    close(in_fd);
+    in_fd = -1;
+
+    if (rename(tmp, dst) < 0) {
+        perror(dst);
+        goto badness;
+    }
+    if (fsync_path(config->capacity_dir) < 0)
+        goto badness;
+
+    printf("segment %d -> %s (%lld bytes in %.3f s)\n", segment, config->capacity_dir, (long long)st.st_size,
+           now_seconds() - t_start);
+
+    return SUCCEED;
+
+badness:
+    if (in_fd >= 0)
+        close(in_fd);
+    if (out_fd >= 0) {
+        close(out_fd);
+        unlink(tmp);
+    }
+    return FAIL;
+}
+
+/********/
+/* HDF5 */
+/********/
+
+/* Creates one segment file on the fast tier */
+herr_t
+setup_segment(const char *file_name, hsize_t chunks_per_segment)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t dims[RANK]       = {chunks_per_segment * CHUNK_SIZE};
+    hsize_t chunk_dims[RANK] = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(file_name, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset - segments have a fixed size */
+    if ((sid = H5Screate_simple(RANK, dims, NULL)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Writes a new catalog mapping segment i from its current tier, then
+ * swaps it in for the old one
+ */
+herr_t
+write_catalog(const config_t *config, const int *on_capacity, int n_segments)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t vsid    = H5I_INVALID_HID;
+    hid_t src_sid = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t segment_size     = config->chunks_per_segment * CHUNK_SIZE;
+    hsize_t current_dims[RANK] = {(hsize_t)n_segments * segment_size};
+    hsize_t src_dims[RANK]     = {segment_size};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    if ((fid = H5Fcreate(CATALOG_TMP_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Virtual and source dataspaces */
+    if ((vsid = H5Screate_simple(RANK, current_dims, NULL)) == H5I_INVALID_HID)
+        goto badness;
+    if ((src_sid = H5Screate_simple(RANK, src_dims, NULL)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Segment i is block i of the whole */
+    for (int i = 0; i < n_segments; i++) {
+        char    file_name[NAME_LEN];
+        hsize_t start[RANK] = {(hsize_t)i * segment_size};
+        hsize_t count[RANK] = {1};
+        hsize_t block[RANK] = {segment_size};
+
+        if (segment_name(on_capacity[i] ? config->capacity_dir : config->fast_dir, i, file_name) < 0)
+            goto badness;
+
+        if (H5Sselect_hyperslab(vsid, H5S_SELECT_SET, start, NULL, count, block) < 0)
+            goto badness;
+        if (H5Pset_virtual(dcpl_id, vsid, file_name, DSET_NAME, src_sid) < 0)
+            goto badness;
+    }
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, vsid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(vsid) < 0)
+        goto badness;
+    if (H5Sclose(src_sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    /* Swap it in */
+    if (fsync_path(CATALOG_TMP_NAME) < 0)
+        goto badness;
+    if (rename(CATALOG_TMP_NAME, CATALOG_FILE_NAME) < 0) {
+        perror(CATALOG_FILE_NAME);
+        goto badness;
+    }
+    if (fsync_path(".") < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(vsid);
+        H5Sclose(src_sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Writes a chunk at offset in a segment, filled with value */
+herr_t
+direct_write(hid_t did, hsize_t offset, int value)
+{
+    int     *buf     = NULL;
+    int     *buf_out = NULL;
+    size_t   buf_size;
+    size_t   buf_out_size;
+    uint32_t filter_mask = 0; /* We're not skipping any filters */
+
+    buf_size     = CHUNK_SIZE * sizeof(int);
+    buf_out_size = (size_t)compressBound((uLong)buf_size);
+
+    if (NULL == (buf = malloc(buf_size)))
+        goto badness;
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+        buf[i] = value;
+
+    if (NULL == (buf_out = malloc(buf_out_size)))
+        goto badness;
+
+    /* Compress the data using zlib */
+    uLongf z_destLen = (uLongf)buf_out_size;
+    int    z_ret     = compress2((Bytef *)buf_out, &z_destLen, (const Bytef *)buf, (uLong)buf_size,
+                                 COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    /* Write the compressed data to the chunk, or the raw data if deflate
+     * didn't help
+     */
+    if (z_destLen < buf_size) {
+        if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, (size_t)z_destLen, buf_out) < 0)
+            goto badness;
+    }
+    else if (H5Dwrite_chunk(did, H5P_DEFAULT, 0x1, &offset, buf_size, buf) < 0)
+        goto badness;
+
+    free(buf);
+    free(buf_out);
+
+    return SUCCEED;
+
+badness:
+    free(buf);
+    free(buf_out);
+    return FAIL;
+}
+
+/************/
+/* Migrator */
+/************/
+
+/* A fast copy waiting to be removed */
+typedef struct {
+    int    segment;
+    double due;
+} unlink_t;
+
+/* The migrator's main loop. Runs until the writer closes its end of the
+ * pipe and everything it sealed has been migrated.
+ */
+herr_t
+run_migrator(const config_t *config, int event_fd)
+{
+    int      *on_capacity = NULL;  /* Per segment */
+    int      *sealed      = NULL;  /* Sealed segments waiting to move, FIFO */
+    unlink_t *unlinks     = NULL;  /* FIFO, in due order */
+    int       n_segments  = 0;
+    int       max_segments = 0;
+    int       n_sealed    = 0;
+    int       n_unlinks   = 0;
+    int       eof         = 0;
+
+    while (!eof || n_sealed > 0 || n_unlinks > 0) {
+        struct pollfd pfd     = {event_fd, POLLIN, 0};
+        int           timeout = -1;
+        double        now     = now_seconds();
+
+        /* Wake up for the next unlink, or right away if there's work */
+        if (n_sealed > 0)
+            timeout = 0;
+        else if (n_unlinks > 0)
+            timeout = unlinks[0].due > now ? (int)ceil((unlinks[0].due - now) * 1000.0) : 0;
+
+        if (!eof && poll(&pfd, 1, timeout) > 0) {
+            event_t event;
+            ssize_t n = read(event_fd, &event, sizeof(event));
+
+            if (n < 0 && EINTR != errno)
+                goto badness;
+            if (0 == n)
+                eof = 1;
+            else if (n > 0 && n != (ssize_t)sizeof(event)) {
+                fprintf(stderr, "short event read\n");
+                goto badness;
+            }
+            else if (n > 0) {
+                /* Room for this segment in both lists */
+                if (event.segment >= max_segments) {
+                    int       new_max = 2 * event.segment + 16;
+                    int      *p;
+                    unlink_t *u;
+
+                    if (NULL == (p = realloc(on_capacity, (size_t)new_max * sizeof(int))))
+                        goto badness;
+                    on_capacity = p;
+                    if (NULL == (p = realloc(sealed, (size_t)new_max * sizeof(int))))
+                        goto badness;
+                    sealed = p;
+                    if (NULL == (u = realloc(unlinks, (size_t)new_max * sizeof(unlink_t))))
+                        goto badness;
+                    unlinks      = u;
+                    max_segments = new_max;
+                }
+
+                if (EVENT_OPENED == event.type) {
+                    on_capacity[event.segment] = 0;
+                    if (event.segment >= n_segments)
+                        n_segments = event.segment + 1;
+                    if (write_catalog(config, on_capacity, n_segments) < 0)
+                        goto badness;
+                }
+                else
+                    sealed[n_sealed++] = event.segment;
+            }
+            continue;
+        }
+
+        /* Once the writer is done there's nothing left to read, but the
+         * last fast copies still get their full UNLINK_DELAY
+         */
+        if (eof && timeout > 0)
+            poll(NULL, 0, timeout);
+
+        /* Move the oldest sealed segment and point the catalog at it */
+        if (n_sealed > 0) {
+            int segment = sealed[0];
+
+            memmove(sealed, sealed + 1, (size_t)(n_sealed - 1) * sizeof(int));
+            n_sealed--;
+
+            if (migrate_segment(config, segment) < 0)
+                goto badness;
+            on_capacity[segment] = 1;
+            if (write_catalog(config, on_capacity, n_segments) < 0)
+                goto badness;
+
+            unlinks[n_unlinks].segment = segment;
+            unlinks[n_unlinks].due     = now_seconds() + UNLINK_DELAY;
+            n_unlinks++;
+        }
+
+        /* Remove fast copies nobody can be reading any more */
+        now = now_seconds();
+        while (n_unlinks > 0 && unlinks[0].due <= now) {
+            char name[NAME_LEN];
+
+            if (segment_name(config->fast_dir, unlinks[0].segment, name) < 0)
+                goto badness;
+            if (unlink(name) < 0)
+                perror(name);
+
+            memmove(unlinks, unlinks + 1, (size_t)(n_unlinks - 1) * sizeof(unlink_t));
+            n_unlinks--;
+        }
+    }
+
+    printf("MIGRATED: %d segments\n", n_segments);
+
+    free(on_capacity);
+    free(sealed);
+    free(unlinks);
+
+    return SUCCEED;
+
+badness:
+    free(on_capacity);
+    free(sealed);
+    free(unlinks);
+
+    return FAIL;
+}
+
+/**********/
+/* Writer */
+/**********/
+
+herr_t
+send_event(int event_fd, event_type_t type, int segment)
+{
+    event_t event;
+
+    memset(&event, 0, sizeof(event));
+    event.type    = type;
+    event.segment = segment;
+
+    /* Smaller than PIPE_BUF, so it's written whole or not at all */
+    while (write(event_fd, &event, sizeof(event)) < 0)
+        if (EINTR != errno) {
+            fprintf(stderr, "migrator has gone away\n");
+            return FAIL;
+        }
+
+    return SUCCEED;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    config_t         config;
+    long             chunks_per_second = 1;
+    int              fds[2]            = {-1, -1};
+    pid_t            pid               = -1;
+    int              segment           = 0;
+    int              status;
+
+    hid_t fid = H5I_INVALID_HID;
+    hid_t did = H5I_INVALID_HID;
+
+    config.chunks_per_segment = 60;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <fast_dir> <capacity_dir> [chunks_per_segment] [chunks_per_second]\n",
+                argv[0]);
+        goto badness;
+    }
+    config.fast_dir     = argv[1];
+    config.capacity_dir = argv[2];
+    if (argc > 3)
+        config.chunks_per_segment = (hsize_t)strtoull(argv[3], NULL, 10);
+    if (argc > 4)
+        chunks_per_second = atol(argv[4]);
+    if (config.chunks_per_segment < 1 || chunks_per_second < 1 || chunks_per_second > 1000000) {
+        fprintf(stderr, "bad chunks per segment or chunks per second\n");
+        goto badness;
+    }
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* A migrator that died shows up as a failed write, not a signal */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Start the migrator before touching HDF5 in this process */
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        goto badness;
+    }
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        goto badness;
+    }
+    if (0 == pid) {
+        /* The writer decides when to stop. We finish what it sealed. */
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTERM, SIG_IGN);
+        close(fds[1]);
+
+        if (nice(MIGRATOR_NICE) < 0 && errno)
+            perror("nice");
+
+        if (run_migrator(&config, fds[0]) < 0) {
+            fprintf(stderr, "migrator failed\n");
+            fflush(stdout);
+            _exit(EXIT_FAILURE);
+        }
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[0]);
+    fds[0] = -1;
+
+    printf("WRITING SEGMENTS TO %s, MIGRATING TO %s\n", config.fast_dir, config.capacity_dir);
+    printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+
+    /* Number of chunks written, over all segments */
+    uint64_t n_chunks = 0;
+
+    while (!stop) {
+        char    file_name[NAME_LEN];
+        hsize_t chunk;
+
+        if (segment_name(config.fast_dir, segment, file_name) < 0)
+            goto badness;
+        if (setup_segment(file_name, config.chunks_per_segment) < 0)
+            goto badness;
+        if ((fid = H5Fopen(file_name, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+        if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+            goto badness;
+        if (send_event(fds[1], EVENT_OPENED, segment) < 0)
+            goto badness;
+
+        for (chunk = 0; chunk < config.chunks_per_segment && !stop; chunk++) {
+            if (n_chunks > INT_MAX) {
+                fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+                goto badness;
+            }
+
+            if (direct_write(did, chunk * CHUNK_SIZE, (int)n_chunks) < 0)
+                goto badness;
+
+            n_chunks += 1;
+
+            usleep((useconds_t)(1000000 / chunks_per_second));
+        }
+
+        /* Seal it. A partly filled segment reads as fill values at the end. */
+        if (H5Dclose(did) < 0)
+            goto badness;
+        did = H5I_INVALID_HID;
+        if (H5Fclose(fid) < 0)
+            goto badness;
+        fid = H5I_INVALID_HID;
+        if (send_event(fds[1], EVENT_SEALED, segment) < 0)
+            goto badness;
+
+        printf("segment %d sealed (%llu chunks so far)\n", segment, (unsigned long long)n_chunks);
+
+        segment++;
+        if (segment == INT_MAX)
+            break;
+    }
+
+    /* Let the migrator finish up and wait for it */
+    close(fds[1]);
+    fds[1] = -1;
+    while (waitpid(pid, &status, 0) < 0)
+        if (EINTR != errno)
+            goto badness;
+    pid = -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+        goto badness;
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    /* The migrator still finishes what was sealed */
+    if (fds[0] >= 0)
+        close(fds[0]);
+    if (fds[1] >= 0)
+        close(fds[1]);
+    if (pid > 0)
+        while (waitpid(pid, NULL, 0) < 0 && EINTR == errno)
+            ;
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
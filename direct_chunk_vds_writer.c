@@ -0,0 +1,581 @@
+/* direct_chunk_vds_writer.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version runs several writer processes, each writing its own
+ * HDF5 file, and ties them together with a virtual dataset (VDS) in a
+ * master file so readers see one logical dataset
+ *
+ * To build:
+ *      h5cc -o vds_writer direct_chunk_vds_writer.c -lm -lz
+ *
+ * - DOES require the deflate filter
+ * - DOES require zlib (we're going to directly compress chunks)
+ * - DOES require HDF5 1.10 or later (virtual datasets)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library
+ *
+ * To run:
+ *      ./vds_writer [n_writers] [interleave|concat] [chunks_per_writer]
+ *
+ *      - Starts n_writers (default 4) writer processes
+ *      - Each one generates one 10-integer chunk per second into its own
+ *        file (direct_chunk_vds_<n>.h5)
+ *      - interleave (the default) maps the writers' chunks round-robin
+ *        into the master dataset, so chunk k of writer i is chunk
+ *        k * n_writers + i of the whole. The master dataset is unlimited.
+ *      - concat gives each writer a block of chunks_per_writer chunks
+ *        (default 60), one block after another. The writers stop
+ *        generating data once their block is full.
+ *      - Read direct_chunk_vds.h5 to see the combined data
+ *      - ctrl-c stops the program
+ *
+ * Why processes and not threads?
+ *
+ *      The HDF5 library has global state and the thread-safe build
+ *      serializes every API call behind one lock. Separate processes each
+ *      get their own copy of the library, so nothing is shared and the
+ *      writers never wait on each other. We fork before the parent makes
+ *      any HDF5 calls so that no library state is inherited, either.
+ */
+
+#include <hdf5.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+volatile sig_atomic_t stop;
+
+const char *MASTER_FILE_NAME = "direct_chunk_vds.h5";
+const char *WRITER_FILE_FORMAT = "direct_chunk_vds_%d.h5";
+const char *DSET_NAME = "data";
+
+#define RANK 1
+
+#define MAX_WRITERS 64
+
+#define NAME_LEN 64
+
+/* SO SMALL - Don't make chunks this size in real code! */
+const hsize_t CHUNK_SIZE = 10;
+
+const unsigned COMPRESSION_LEVEL = 5;
+
+const int FILL_VALUE = -1;
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+/* How the writers' chunks are laid out in the master dataset */
+typedef enum {
+    LAYOUT_INTERLEAVE,
+    LAYOUT_CONCAT
+} layout_t;
+
+/* What one writer process needs to know */
+typedef struct {
+    int      index;             /* This writer's number (0..n_writers-1) */
+    int      n_writers;
+    layout_t layout;
+    hsize_t  chunks_per_writer; /* Only used in LAYOUT_CONCAT */
+    char     file_name[NAME_LEN];
+} writer_t;
+
+void
+ctrl_c_handler(int signum)
+{
+    (void)signum;
+
+    stop = 1;
+}
+
+herr_t
+setup(const char *file_name)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t sid     = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t chunk_dims[RANK]   = {CHUNK_SIZE};
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    /* Create file */
+    if ((fid = H5Fcreate(file_name, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Dataspace for dataset */
+    if ((sid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_chunk(dcpl_id, RANK, chunk_dims) < 0)
+        goto badness;
+    if (H5Pset_deflate(dcpl_id, COMPRESSION_LEVEL) < 0)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, sid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+/* Creates the master file with a virtual dataset that maps every
+ * writer's dataset into one
+ */
+herr_t
+setup_master(int n_writers, layout_t layout, hsize_t chunks_per_writer)
+{
+    hid_t fapl_id = H5I_INVALID_HID;
+    hid_t fid     = H5I_INVALID_HID;
+    hid_t vsid    = H5I_INVALID_HID;
+    hid_t src_sid = H5I_INVALID_HID;
+    hid_t dcpl_id = H5I_INVALID_HID;
+    hid_t did     = H5I_INVALID_HID;
+
+    hsize_t current_dims[RANK] = {0};
+    hsize_t max_dims[RANK]     = {H5S_UNLIMITED};
+    hsize_t src_dims[RANK]     = {0};
+
+    /* In concat mode the master dataset has a fixed size */
+    if (LAYOUT_CONCAT == layout) {
+        current_dims[0] = (hsize_t)n_writers * chunks_per_writer * CHUNK_SIZE;
+        max_dims[0]     = current_dims[0];
+    }
+
+    /* fapl */
+    if ((fapl_id = H5Pcreate(H5P_FILE_ACCESS)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_libver_bounds(fapl_id, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST))
+        goto badness;
+
+    if ((fid = H5Fcreate(MASTER_FILE_NAME, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Virtual and source dataspaces */
+    if ((vsid = H5Screate_simple(RANK, current_dims, max_dims)) == H5I_INVALID_HID)
+        goto badness;
+    {
+        hsize_t src_max_dims[RANK] = {H5S_UNLIMITED};
+
+        if ((src_sid = H5Screate_simple(RANK, src_dims, src_max_dims)) == H5I_INVALID_HID)
+            goto badness;
+    }
+
+    /* dcpl */
+    if ((dcpl_id = H5Pcreate(H5P_DATASET_CREATE)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Pset_fill_value(dcpl_id, H5T_NATIVE_INT, &FILL_VALUE) < 0)
+        goto badness;
+
+    for (int i = 0; i < n_writers; i++) {
+        char    file_name[NAME_LEN];
+        hsize_t start[RANK];
+        hsize_t stride[RANK];
+        hsize_t count[RANK];
+        hsize_t block[RANK];
+
+        snprintf(file_name, sizeof(file_name), WRITER_FILE_FORMAT, i);
+
+        if (LAYOUT_INTERLEAVE == layout) {
+            /* Writer i owns every n_writers-th chunk, starting at chunk i */
+            start[0]  = (hsize_t)i * CHUNK_SIZE;
+            stride[0] = (hsize_t)n_writers * CHUNK_SIZE;
+            count[0]  = H5S_UNLIMITED;
+            block[0]  = CHUNK_SIZE;
+            if (H5Sselect_hyperslab(vsid, H5S_SELECT_SET, start, stride, count, block) < 0)
+                goto badness;
+
+            /* ...taken one chunk at a time from the writer's dataset */
+            start[0]  = 0;
+            stride[0] = CHUNK_SIZE;
+            if (H5Sselect_hyperslab(src_sid, H5S_SELECT_SET, start, stride, count, block) < 0)
+                goto badness;
+        }
+        else {
+            /* Writer i owns one contiguous block */
+            start[0] = (hsize_t)i * chunks_per_writer * CHUNK_SIZE;
+            count[0] = 1;
+            block[0] = chunks_per_writer * CHUNK_SIZE;
+            if (H5Sselect_hyperslab(vsid, H5S_SELECT_SET, start, NULL, count, block) < 0)
+                goto badness;
+
+            /* ...which is the start of the writer's dataset */
+            start[0] = 0;
+            if (H5Sselect_hyperslab(src_sid, H5S_SELECT_SET, start, NULL, count, block) < 0)
+                goto badness;
+        }
+
+        if (H5Pset_virtual(dcpl_id, vsid, file_name, DSET_NAME, src_sid) < 0)
+            goto badness;
+    }
+
+    /* Create dataset */
+    if ((did = H5Dcreate2(fid, DSET_NAME, H5T_NATIVE_INT, vsid, H5P_DEFAULT, dcpl_id, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Shutdown */
+    if (H5Pclose(fapl_id) < 0)
+        goto badness;
+    if (H5Sclose(vsid) < 0)
+        goto badness;
+    if (H5Sclose(src_sid) < 0)
+        goto badness;
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    H5E_BEGIN_TRY
+    {
+        H5Pclose(fapl_id);
+        H5Sclose(vsid);
+        H5Sclose(src_sid);
+        H5Pclose(dcpl_id);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+herr_t
+extend_dataset(hid_t did, hsize_t size)
+{
+    hsize_t new_dims[RANK] = {size};
+
+    if (H5Dset_extent(did, new_dims) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+
+    return FAIL;
+}
+
+/* Writes a chunk at offset in this writer's dataset, filled with value */
+herr_t
+direct_write(hid_t did, hsize_t offset, int value)
+{
+    int     *buf     = NULL;
+    int     *buf_out = NULL;
+    size_t   buf_size;
+    size_t   buf_out_size;
+    uint32_t filter_mask = 0; /* We're not skipping any filters */
+
+    /* Buffer sizes
+     * The output buffer has to be larger than the input buffer in case
+     * the compression is inefficient. The compress2() docs give a formula
+     * to determine the minimum size.
+     */
+    buf_size     = CHUNK_SIZE * sizeof(int);
+    buf_out_size = (size_t)ceil(buf_size * 1.001) + 12;
+
+    if (NULL == (buf = malloc(buf_size)))
+        goto badness;
+    for (hsize_t i = 0; i < CHUNK_SIZE; i++)
+        buf[i] = value;
+
+    if (NULL == (buf_out = calloc(buf_out_size, sizeof(char))))
+        goto badness;
+
+    /* Compress the data using zlib */
+    uLongf z_destLen = (uLongf)buf_out_size;
+    int    z_ret     = compress2((Bytef *)buf_out, &z_destLen, (const Bytef *)buf, (uLong)buf_size,
+                                 COMPRESSION_LEVEL);
+    if (Z_OK != z_ret) {
+        fprintf(stderr, "deflate error: %d\n", z_ret);
+        goto badness;
+    }
+
+    /* Check to make sure the compressed buffer size isn't bigger than the
+     * chunk size.
+     */
+    if (z_destLen > buf_size) {
+        fprintf(stderr, "can't write chunk data that is larger than the chunk\n");
+        fprintf(stderr, "in: %zu   out: %lu\n", buf_size, (unsigned long)z_destLen);
+        goto badness;
+    }
+
+    /* Write the compressed data to the chunk */
+    if (H5Dwrite_chunk(did, H5P_DEFAULT, filter_mask, &offset, (size_t)z_destLen, (void *)buf_out) < 0)
+        goto badness;
+
+    free(buf);
+    free(buf_out);
+
+    return SUCCEED;
+
+badness:
+    free(buf);
+    free(buf_out);
+    return FAIL;
+}
+
+/* The main loop of one writer process */
+herr_t
+run_writer(const writer_t *w)
+{
+    hid_t fid = H5I_INVALID_HID;
+    hid_t did = H5I_INVALID_HID;
+
+    if (setup(w->file_name) < 0)
+        goto badness;
+
+    if ((fid = H5Fopen(w->file_name, H5F_ACC_RDWR | H5F_ACC_SWMR_WRITE, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, DSET_NAME, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+
+    /* Number of chunks in this writer's dataset */
+    uint64_t n_chunks = 0;
+
+    while (!stop) {
+
+        /* A full block in concat mode means we're done. Wait for the
+         * parent to say stop, the same way main() does: with the signals
+         * blocked while stop is checked, so one that arrives just before
+         * sigsuspend() isn't lost.
+         */
+        if (LAYOUT_CONCAT == w->layout && n_chunks >= w->chunks_per_writer) {
+            sigset_t wait_set;
+            sigset_t old_set;
+
+            sigemptyset(&wait_set);
+            sigaddset(&wait_set, SIGINT);
+            sigaddset(&wait_set, SIGTERM);
+            sigprocmask(SIG_BLOCK, &wait_set, &old_set);
+            while (!stop)
+                sigsuspend(&old_set);
+            sigprocmask(SIG_SETMASK, &old_set, NULL);
+            break;
+        }
+
+        /* Position of this chunk in the master dataset, which we use as
+         * the synthetic data value. Reading the master dataset should
+         * then give 0, 1, 2, ... in chunk order.
+         */
+        uint64_t global_chunk;
+
+        if (LAYOUT_INTERLEAVE == w->layout)
+            global_chunk = n_chunks * (uint64_t)w->n_writers + (uint64_t)w->index;
+        else
+            global_chunk = (uint64_t)w->index * w->chunks_per_writer + n_chunks;
+
+        if (global_chunk > INT_MAX) {
+            fprintf(stderr, "can't have more than INT_MAX chunks in this example\n");
+            goto badness;
+        }
+
+        /* Extend by one chunk
+         *
+         * WARNING: This is wildly inefficient - don't extend by one small
+         *          chunk at a time
+         */
+        hsize_t write_offset = n_chunks * CHUNK_SIZE;
+        hsize_t new_size     = (n_chunks + 1) * CHUNK_SIZE;
+
+        if (extend_dataset(did, new_size) < 0)
+            goto badness;
+
+        if (direct_write(did, write_offset, (int)global_chunk) < 0)
+            goto badness;
+
+        n_chunks += 1;
+
+        sleep(1);
+    }
+
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    H5E_BEGIN_TRY
+    {
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    return FAIL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    sigset_t         wait_set;
+    sigset_t         old_set;
+    pid_t            pids[MAX_WRITERS];
+    int              n_writers         = 4;
+    layout_t         layout            = LAYOUT_INTERLEAVE;
+    hsize_t          chunks_per_writer = 60;
+    int              n_started         = 0;
+    int              failed            = 0;
+
+    if (argc > 1)
+        n_writers = atoi(argv[1]);
+    if (argc > 2) {
+        if (!strcmp(argv[2], "concat"))
+            layout = LAYOUT_CONCAT;
+        else if (strcmp(argv[2], "interleave")) {
+            fprintf(stderr, "layout must be interleave or concat\n");
+            goto badness;
+        }
+    }
+    if (argc > 3)
+        chunks_per_writer = (hsize_t)strtoull(argv[3], NULL, 10);
+
+    if (n_writers < 1 || n_writers > MAX_WRITERS || chunks_per_writer < 1) {
+        fprintf(stderr, "bad number of writers or chunks per writer\n");
+        goto badness;
+    }
+
+    /* Catch ctrl-c */
+    sa.sa_handler = ctrl_c_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* A writer exiting on its own means it failed, so stop everything */
+    sigaction(SIGCHLD, &sa, NULL);
+
+    /* Start the writers before touching HDF5 in this process */
+    for (int i = 0; i < n_writers; i++) {
+        pid_t pid = fork();
+
+        if (pid < 0) {
+            perror("fork");
+            stop = 1;
+            break;
+        }
+        if (0 == pid) {
+            writer_t w;
+
+            w.index             = i;
+            w.n_writers         = n_writers;
+            w.layout            = layout;
+            w.chunks_per_writer = chunks_per_writer;
+            snprintf(w.file_name, sizeof(w.file_name), WRITER_FILE_FORMAT, i);
+
+            if (run_writer(&w) < 0) {
+                fprintf(stderr, "writer %d failed\n", i);
+                _exit(EXIT_FAILURE);
+            }
+            _exit(EXIT_SUCCESS);
+        }
+
+        pids[n_started++] = pid;
+    }
+
+    /* The source files don't have to exist yet for the VDS to be created */
+    if (!stop && setup_master(n_writers, layout, chunks_per_writer) < 0) {
+        fprintf(stderr, "can't create master file\n");
+        stop = 1;
+        failed = 1;
+    }
+
+    if (!stop) {
+        printf("FILE CREATION COMPLETE (%d writers, %s)\n", n_writers,
+               LAYOUT_INTERLEAVE == layout ? "interleaved" : "concatenated");
+        printf("PRESS CTRL-C TO HALT DATA GENERATION\n");
+    }
+
+    /* Wait for a signal, then pass it on. The signals are blocked while
+     * stop is checked and sigsuspend() unblocks them atomically, so one
+     * that arrives between the check and the wait isn't lost. (They're
+     * blocked only now because the writers inherit the signal mask.)
+     */
+    sigemptyset(&wait_set);
+    sigaddset(&wait_set, SIGINT);
+    sigaddset(&wait_set, SIGTERM);
+    sigaddset(&wait_set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &wait_set, &old_set);
+    while (!stop)
+        sigsuspend(&old_set);
+    sigprocmask(SIG_SETMASK, &old_set, NULL);
+
+    for (int i = 0; i < n_started; i++)
+        kill(pids[i], SIGINT);
+
+    for (int i = 0; i < n_started; i++) {
+        int status;
+
+        if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = 1;
+    }
+
+    if (failed)
+        goto badness;
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}
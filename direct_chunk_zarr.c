@@ -0,0 +1,832 @@
+/* direct_chunk_zarr.c
+ *
+ * Sample program for ITER demonstrating direct chunk operations
+ *
+ * This version is an offline tool that exports a dataset as a Zarr (v2)
+ * array. A deflate-compressed HDF5 chunk is a zlib stream, which is
+ * exactly what Zarr's "zlib" compressor stores, and HDF5's shuffle filter
+ * does the same thing as Zarr's "shuffle" filter. So the chunks can be
+ * copied straight across: the main thread reads them with H5Dread_chunk()
+ * and a pool of threads writes them out as one file per chunk. Nothing is
+ * recompressed, so the export runs at the speed of the storage.
+ *
+ * To build:
+ *      h5cc -O2 -o zarr direct_chunk_zarr.c -lm -lz -lpthread
+ *
+ * - DOES require zlib (for the odd chunk that has to be re-encoded)
+ * - DOES require POSIX-y things (sorry Windows users)
+ * - Does NOT require the thread-safe library (only the main thread
+ *   makes HDF5 calls)
+ *
+ * To run:
+ *      ./zarr <in.h5> <out.zarr> [n_threads] [dataset]
+ *
+ *      - Writes dataset (default "data") as the array <out.zarr>/<dataset>
+ *        in a new Zarr group, which must not exist yet
+ *      - n_threads (default 4) is the number of threads writing chunks
+ *      - e.g. ./zarr direct_chunk_writer.h5 direct_chunk_writer.zarr
+ *        then, in Python: zarr.open("direct_chunk_writer.zarr")["data"]
+ *
+ * What can be exported:
+ *
+ *      - Integer and floating-point types of either byte order
+ *      - No filters, deflate, or shuffle then deflate (the pipelines the
+ *        writers in this repo use). Each becomes the matching Zarr
+ *        filters and compressor.
+ *
+ *      Zarr has no per-chunk filter mask, so a chunk stored with a filter
+ *      skipped (usually deflate, because the chunk didn't compress) is
+ *      decoded and encoded again with the full pipeline. That's the only
+ *      time any compression happens.
+ *
+ *      Chunks that were never written aren't exported either, and read as
+ *      the fill value in Zarr as they do in HDF5. Edge chunks are padded
+ *      out to full size in both formats, so they copy as is. Attributes
+ *      aren't exported.
+ *
+ *      Chunks are found and counted the same way as in
+ *      direct_chunk_recompress.c.
+ *
+ * Why Zarr v2 and not v3:
+ *
+ *      The point of this tool is copying chunk bytes unchanged, and that
+ *      needs a zlib codec and a byte shuffle codec. Zarr v2 has both as
+ *      standard ("zlib" and "shuffle"). The core Zarr v3 codecs don't:
+ *      "gzip" wants a gzip header and trailer around the deflate data,
+ *      not HDF5's zlib framing, and v3 has no shuffle codec other than
+ *      the one inside "blosc". A v3 zarr.json could only name the
+ *      "numcodecs.zlib" and "numcodecs.shuffle" extensions, which
+ *      zarr-python understands but other v3 implementations needn't.
+ *      Otherwise every chunk would have to be recompressed. zarr-python 3
+ *      still reads v2 stores, so v2 is the one that works everywhere
+ *      without touching the data.
+ */
+
+#include <hdf5.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* Some global constants */
+
+const char *DEFAULT_DSET_NAME = "data";
+
+const long DEFAULT_THREADS = 4;
+
+/* Chunks read but not yet written, per thread */
+#define INFLIGHT_PER_THREAD 8
+
+#define NAME_LEN 4096
+
+#define SUCCEED   0
+#define FAIL    (-1)
+
+double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* write() that doesn't give up on short transfers */
+herr_t
+write_all(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+
+        if (n < 0 && EINTR == errno)
+            continue;
+        if (n < 0)
+            return FAIL;
+        done += (size_t)n;
+    }
+
+    return SUCCEED;
+}
+
+/* Writes a whole file */
+herr_t
+write_file(const char *name, const void *buf, size_t len)
+{
+    int fd;
+
+    if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(name);
+        return FAIL;
+    }
+    if (write_all(fd, buf, len) < 0) {
+        perror(name);
+        close(fd);
+        return FAIL;
+    }
+    if (close(fd) < 0) {
+        perror(name);
+        return FAIL;
+    }
+
+    return SUCCEED;
+}
+
+/**********/
+/* Codecs */
+/**********/
+
+/* The filter pipelines we know how to export */
+typedef struct {
+    int shuffle;
+    int deflate;
+    int level;    /* Deflate level */
+} codec_t;
+
+/* Filter mask bit for each filter, which depends on what comes before it */
+uint32_t
+codec_shuffle_bit(const codec_t *codec)
+{
+    (void)codec;
+
+    return 0x1;
+}
+
+uint32_t
+codec_deflate_bit(const codec_t *codec)
+{
+    return codec->shuffle ? 0x2 : 0x1;
+}
+
+/* Works out the codec from a dataset's filters */
+herr_t
+codec_from_dcpl(hid_t dcpl_id, codec_t *codec)
+{
+    int n_filters;
+
+    memset(codec, 0, sizeof(*codec));
+
+    if ((n_filters = H5Pget_nfilters(dcpl_id)) < 0)
+        goto badness;
+
+    for (int i = 0; i < n_filters; i++) {
+        unsigned     flags;
+        size_t       n_values  = 1;
+        unsigned     values[1] = {0};
+        H5Z_filter_t filter;
+
+        if ((filter = H5Pget_filter2(dcpl_id, (unsigned)i, &flags, &n_values, values, 0, NULL, NULL)) < 0)
+            goto badness;
+
+        if (H5Z_FILTER_SHUFFLE == filter && 0 == i)
+            codec->shuffle = 1;
+        else if (H5Z_FILTER_DEFLATE == filter && !codec->deflate) {
+            codec->deflate = 1;
+            codec->level   = (int)values[0];
+        }
+        else {
+            fprintf(stderr, "Zarr export can't handle filter %d in position %d\n", (int)filter, i);
+            goto badness;
+        }
+    }
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+void
+shuffle(const unsigned char *in, unsigned char *out, size_t n_bytes, size_t elem_size)
+{
+    size_t n_elems = n_bytes / elem_size;
+
+    for (size_t b = 0; b < elem_size; b++)
+        for (size_t i = 0; i < n_elems; i++)
+            out[b * n_elems + i] = in[i * elem_size + b];
+
+    /* Like the HDF5 filter, leftover bytes stay where they are */
+    memcpy(out + n_elems * elem_size, in + n_elems * elem_size, n_bytes - n_elems * elem_size);
+}
+
+void
+unshuffle(const unsigned char *in, unsigned char *out, size_t n_bytes, size_t elem_size)
+{
+    size_t n_elems = n_bytes / elem_size;
+
+    for (size_t b = 0; b < elem_size; b++)
+        for (size_t i = 0; i < n_elems; i++)
+            out[i * elem_size + b] = in[b * n_elems + i];
+
+    memcpy(out + n_elems * elem_size, in + n_elems * elem_size, n_bytes - n_elems * elem_size);
+}
+
+/* Re-encodes a chunk that had filters skipped so it has them all. On
+ * success the chunk's data is replaced.
+ */
+herr_t
+codec_complete(const codec_t *codec, void **data, size_t *size, uint32_t filter_mask, size_t raw_size,
+               size_t elem_size)
+{
+    unsigned char *a     = NULL;
+    unsigned char *b     = NULL;
+    uLongf         z_len = compressBound((uLong)raw_size);
+
+    if (NULL == (a = malloc(raw_size)) || NULL == (b = malloc((size_t)z_len)))
+        goto badness;
+
+    /* Back to raw, undoing only what was applied */
+    if (codec->deflate && !(filter_mask & codec_deflate_bit(codec))) {
+        uLongf destLen = (uLongf)raw_size;
+
+        if (Z_OK != uncompress(a, &destLen, (const Bytef *)*data, (uLong)*size) || destLen != raw_size) {
+            fprintf(stderr, "can't inflate chunk\n");
+            goto badness;
+        }
+    }
+    else {
+        if (*size != raw_size) {
+            fprintf(stderr, "unfiltered chunk is %zu bytes, expected %zu\n", *size, raw_size);
+            goto badness;
+        }
+        memcpy(a, *data, raw_size);
+    }
+    if (codec->shuffle && !(filter_mask & codec_shuffle_bit(codec))) {
+        unshuffle(a, b, raw_size, elem_size);
+        memcpy(a, b, raw_size);
+    }
+
+    /* And forward again through everything */
+    if (codec->shuffle) {
+        shuffle(a, b, raw_size, elem_size);
+        memcpy(a, b, raw_size);
+    }
+    if (codec->deflate) {
+        if (Z_OK != compress2((Bytef *)b, &z_len, a, (uLong)raw_size, codec->level)) {
+            fprintf(stderr, "can't deflate chunk\n");
+            goto badness;
+        }
+        free(a);
+        free(*data);
+        *data = b;
+        *size = (size_t)z_len;
+    }
+    else {
+        free(b);
+        free(*data);
+        *data = a;
+        *size = raw_size;
+    }
+
+    return SUCCEED;
+
+badness:
+    free(a);
+    free(b);
+    return FAIL;
+}
+
+/**********/
+/* Chunks */
+/**********/
+
+/* One chunk on its way to its file */
+typedef struct chunk_t {
+    struct chunk_t *next;
+    hsize_t         index[H5S_MAX_RANK]; /* Position in the chunk grid */
+    void           *data;
+    size_t          size;
+    uint32_t        filter_mask;
+    int             failed;
+} chunk_t;
+
+void
+chunk_free(chunk_t *chunk)
+{
+    if (chunk) {
+        free(chunk->data);
+        free(chunk);
+    }
+}
+
+/* A FIFO that threads can wait on */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    chunk_t        *head;
+    chunk_t        *tail;
+    int             closed;  /* No more pushes; pops drain what's left */
+} queue_t;
+
+void
+queue_init(queue_t *q)
+{
+    memset(q, 0, sizeof(*q));
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+void
+queue_destroy(queue_t *q)
+{
+    while (q->head) {
+        chunk_t *chunk = q->head;
+
+        q->head = chunk->next;
+        chunk_free(chunk);
+    }
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+}
+
+void
+queue_push(queue_t *q, chunk_t *chunk)
+{
+    chunk->next = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->tail)
+        q->tail->next = chunk;
+    else
+        q->head = chunk;
+    q->tail = chunk;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* Removes the oldest chunk, waiting for one. Returns NULL once the queue
+ * is closed and empty.
+ */
+chunk_t *
+queue_pop(queue_t *q)
+{
+    chunk_t *chunk = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    while (NULL == q->head && !q->closed)
+        pthread_cond_wait(&q->cond, &q->mutex);
+    if (q->head) {
+        chunk   = q->head;
+        q->head = chunk->next;
+        if (NULL == q->head)
+            q->tail = NULL;
+    }
+    pthread_mutex_unlock(&q->mutex);
+
+    return chunk;
+}
+
+void
+queue_close(queue_t *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/***********/
+/* Writers */
+/***********/
+
+typedef struct {
+    queue_t todo;  /* Main thread -> writers */
+    queue_t done;  /* Writers -> main thread, so it can bound what's in flight */
+
+    char    array_dir[NAME_LEN];
+    int     rank;
+    codec_t codec;
+    size_t  chunk_bytes; /* Uncompressed */
+    size_t  elem_size;
+} export_t;
+
+herr_t
+write_chunk_file(export_t *e, chunk_t *chunk)
+{
+    char name[NAME_LEN];
+    int  len;
+
+    if (chunk->filter_mask && codec_complete(&e->codec, &chunk->data, &chunk->size, chunk->filter_mask,
+                                             e->chunk_bytes, e->elem_size) < 0)
+        goto badness;
+
+    /* Zarr v2 chunk keys are the grid indices joined with "." */
+    len = snprintf(name, sizeof(name), "%s/", e->array_dir);
+    for (int d = 0; d < e->rank && len < (int)sizeof(name); d++)
+        len += snprintf(name + len, sizeof(name) - (size_t)len, "%s%llu", d ? "." : "",
+                        (unsigned long long)chunk->index[d]);
+    if (len >= (int)sizeof(name)) {
+        fprintf(stderr, "chunk file name is too long\n");
+        goto badness;
+    }
+
+    if (write_file(name, chunk->data, chunk->size) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+void *
+writer_thread(void *_e)
+{
+    export_t *e = (export_t *)_e;
+    chunk_t  *chunk;
+
+    while (NULL != (chunk = queue_pop(&e->todo))) {
+        if (write_chunk_file(e, chunk) < 0)
+            chunk->failed = 1;
+
+        /* Only the outcome goes back */
+        free(chunk->data);
+        chunk->data = NULL;
+        queue_push(&e->done, chunk);
+    }
+
+    return NULL;
+}
+
+/************/
+/* Metadata */
+/************/
+
+/* numpy-style type string, e.g. "<i4" */
+herr_t
+zarr_dtype(hid_t tid, char *dtype, size_t len)
+{
+    H5T_class_t cls   = H5Tget_class(tid);
+    H5T_order_t order = H5Tget_order(tid);
+    size_t      size  = H5Tget_size(tid);
+    char        kind;
+
+    if (H5T_INTEGER == cls)
+        kind = H5T_SGN_NONE == H5Tget_sign(tid) ? 'u' : 'i';
+    else if (H5T_FLOAT == cls)
+        kind = 'f';
+    else {
+        fprintf(stderr, "Zarr export only handles integer and floating-point types\n");
+        return FAIL;
+    }
+
+    snprintf(dtype, len, "%c%c%zu", 1 == size ? '|' : (H5T_ORDER_BE == order ? '>' : '<'), kind, size);
+
+    return SUCCEED;
+}
+
+/* The fill value as JSON */
+herr_t
+zarr_fill_value(hid_t dcpl_id, hid_t tid, char *fill, size_t len)
+{
+    H5D_fill_value_t status;
+
+    if (H5Pfill_value_defined(dcpl_id, &status) < 0)
+        return FAIL;
+
+    if (H5D_FILL_VALUE_UNDEFINED == status)
+        snprintf(fill, len, "null");
+    else if (H5T_FLOAT == H5Tget_class(tid)) {
+        double value;
+
+        if (H5Pget_fill_value(dcpl_id, H5T_NATIVE_DOUBLE, &value) < 0)
+            return FAIL;
+        if (isnan(value))
+            snprintf(fill, len, "\"NaN\"");
+        else if (isinf(value))
+            snprintf(fill, len, value > 0 ? "\"Infinity\"" : "\"-Infinity\"");
+        else
+            snprintf(fill, len, "%.17g", value);
+    }
+    else if (H5T_SGN_NONE == H5Tget_sign(tid)) {
+        unsigned long long value;
+
+        if (H5Pget_fill_value(dcpl_id, H5T_NATIVE_ULLONG, &value) < 0)
+            return FAIL;
+        snprintf(fill, len, "%llu", value);
+    }
+    else {
+        long long value;
+
+        if (H5Pget_fill_value(dcpl_id, H5T_NATIVE_LLONG, &value) < 0)
+            return FAIL;
+        snprintf(fill, len, "%lld", value);
+    }
+
+    return SUCCEED;
+}
+
+/* Writes the group and array metadata */
+herr_t
+write_metadata(const char *store, export_t *e, const hsize_t *dims, const hsize_t *chunk_dims, hid_t tid,
+               hid_t dcpl_id)
+{
+    const char *zgroup = "{\n    \"zarr_format\": 2\n}\n";
+    char        name[NAME_LEN];
+    char        json[8192];
+    char        dtype[16];
+    char        fill[64];
+    int         len = 0;
+
+    if (zarr_dtype(tid, dtype, sizeof(dtype)) < 0)
+        goto badness;
+    if (zarr_fill_value(dcpl_id, tid, fill, sizeof(fill)) < 0)
+        goto badness;
+
+    if (snprintf(name, sizeof(name), "%s/.zgroup", store) >= (int)sizeof(name)) {
+        fprintf(stderr, "store name is too long\n");
+        goto badness;
+    }
+    if (write_file(name, zgroup, strlen(zgroup)) < 0)
+        goto badness;
+
+    len += snprintf(json + len, sizeof(json) - (size_t)len, "{\n    \"zarr_format\": 2,\n    \"shape\": [");
+    for (int d = 0; d < e->rank; d++)
+        len += snprintf(json + len, sizeof(json) - (size_t)len, "%s%llu", d ? ", " : "",
+                        (unsigned long long)dims[d]);
+    len += snprintf(json + len, sizeof(json) - (size_t)len, "],\n    \"chunks\": [");
+    for (int d = 0; d < e->rank; d++)
+        len += snprintf(json + len, sizeof(json) - (size_t)len, "%s%llu", d ? ", " : "",
+                        (unsigned long long)chunk_dims[d]);
+    len += snprintf(json + len, sizeof(json) - (size_t)len, "],\n    \"dtype\": \"%s\",\n", dtype);
+    if (e->codec.deflate)
+        len += snprintf(json + len, sizeof(json) - (size_t)len,
+                        "    \"compressor\": {\"id\": \"zlib\", \"level\": %d},\n", e->codec.level);
+    else
+        len += snprintf(json + len, sizeof(json) - (size_t)len, "    \"compressor\": null,\n");
+    if (e->codec.shuffle)
+        len += snprintf(json + len, sizeof(json) - (size_t)len,
+                        "    \"filters\": [{\"id\": \"shuffle\", \"elementsize\": %zu}],\n", e->elem_size);
+    else
+        len += snprintf(json + len, sizeof(json) - (size_t)len, "    \"filters\": null,\n");
+    len += snprintf(json + len, sizeof(json) - (size_t)len,
+                    "    \"fill_value\": %s,\n    \"order\": \"C\",\n    \"dimension_separator\": \".\"\n}\n",
+                    fill);
+    if (len >= (int)sizeof(json)) {
+        fprintf(stderr, ".zarray is too long\n");
+        goto badness;
+    }
+
+    if (snprintf(name, sizeof(name), "%s/.zarray", e->array_dir) >= (int)sizeof(name)) {
+        fprintf(stderr, "store name is too long\n");
+        goto badness;
+    }
+    if (write_file(name, json, (size_t)len) < 0)
+        goto badness;
+
+    return SUCCEED;
+
+badness:
+    return FAIL;
+}
+
+/**********************/
+/* HDF5 (main thread) */
+/**********************/
+
+/* Collects one finished chunk */
+herr_t
+collect(export_t *e)
+{
+    chunk_t *chunk = queue_pop(&e->done);
+    int      failed;
+
+    if (NULL == chunk)
+        return FAIL;
+
+    failed = chunk->failed;
+    chunk_free(chunk);
+
+    return failed ? FAIL : SUCCEED;
+}
+
+int
+main(int argc, char *argv[])
+{
+    export_t    e;
+    const char *dset_name  = DEFAULT_DSET_NAME;
+    const char *store;
+    long        n_threads  = DEFAULT_THREADS;
+    pthread_t  *threads    = NULL;
+    long        n_started  = 0;
+    hid_t       fid        = H5I_INVALID_HID;
+    hid_t       did        = H5I_INVALID_HID;
+    hid_t       sid        = H5I_INVALID_HID;
+    hid_t       tid        = H5I_INVALID_HID;
+    hid_t       dcpl_id    = H5I_INVALID_HID;
+    hsize_t     dims[H5S_MAX_RANK];
+    hsize_t     chunk_dims[H5S_MAX_RANK];
+    hsize_t     offset[H5S_MAX_RANK];
+    hsize_t     n_expected = 0;
+    uint64_t    inflight   = 0;
+    uint64_t    n_chunks   = 0;
+    uint64_t    n_redone   = 0;
+    uint64_t    n_bytes    = 0;
+    int         more       = 1;
+    double      t_start;
+
+    memset(&e, 0, sizeof(e));
+    queue_init(&e.todo);
+    queue_init(&e.done);
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <in.h5> <out.zarr> [n_threads] [dataset]\n", argv[0]);
+        goto badness;
+    }
+    store = argv[2];
+    if (argc > 3)
+        n_threads = atol(argv[3]);
+    if (argc > 4)
+        dset_name = argv[4];
+    if (n_threads < 1)
+        n_threads = 1;
+
+    /* Source */
+    if ((fid = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((did = H5Dopen2(fid, dset_name, H5P_DEFAULT)) == H5I_INVALID_HID)
+        goto badness;
+    if ((tid = H5Dget_type(did)) == H5I_INVALID_HID)
+        goto badness;
+    e.elem_size = H5Tget_size(tid);
+    if ((dcpl_id = H5Dget_create_plist(did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5D_CHUNKED != H5Pget_layout(dcpl_id)) {
+        fprintf(stderr, "%s isn't chunked\n", dset_name);
+        goto badness;
+    }
+    if ((e.rank = H5Pget_chunk(dcpl_id, H5S_MAX_RANK, chunk_dims)) < 0)
+        goto badness;
+    if (codec_from_dcpl(dcpl_id, &e.codec) < 0)
+        goto badness;
+    e.chunk_bytes = e.elem_size;
+    for (int d = 0; d < e.rank; d++)
+        e.chunk_bytes *= (size_t)chunk_dims[d];
+
+    if ((sid = H5Dget_space(did)) == H5I_INVALID_HID)
+        goto badness;
+    if (H5Sget_simple_extent_dims(sid, dims, NULL) < 0)
+        goto badness;
+    if (H5Dget_num_chunks(did, sid, &n_expected) < 0)
+        goto badness;
+    if (H5Sclose(sid) < 0)
+        goto badness;
+    sid = H5I_INVALID_HID;
+
+    /* The store: a group with the array in it */
+    if (snprintf(e.array_dir, sizeof(e.array_dir), "%s/%s", store, dset_name) >= (int)sizeof(e.array_dir)) {
+        fprintf(stderr, "store name is too long\n");
+        goto badness;
+    }
+    if (mkdir(store, 0755) < 0) {
+        perror(store);
+        goto badness;
+    }
+    if (mkdir(e.array_dir, 0755) < 0) {
+        perror(e.array_dir);
+        goto badness;
+    }
+    if (write_metadata(store, &e, dims, chunk_dims, tid, dcpl_id) < 0)
+        goto badness;
+
+    printf("%s: %llu CHUNKS -> %s\n", dset_name, (unsigned long long)n_expected, e.array_dir);
+
+    /* Writers */
+    if (NULL == (threads = calloc((size_t)n_threads, sizeof(pthread_t))))
+        goto badness;
+    for (; n_started < n_threads; n_started++)
+        if (pthread_create(&threads[n_started], NULL, writer_thread, &e) != 0)
+            goto badness;
+
+    /* Walk the chunk grid, handing each chunk that exists to the writers */
+    t_start = now_seconds();
+    memset(offset, 0, sizeof(offset));
+    for (int d = 0; d < e.rank; d++)
+        if (0 == dims[d])
+            more = 0;
+
+    while (more) {
+        hsize_t size = 0;
+        herr_t  found;
+        int     d;
+
+        /* Fails for chunks that were never written */
+        H5E_BEGIN_TRY
+        {
+            found = H5Dget_chunk_storage_size(did, offset, &size);
+        }
+        H5E_END_TRY;
+
+        if (found >= 0 && size > 0) {
+            chunk_t *chunk;
+
+            if (NULL == (chunk = calloc(1, sizeof(chunk_t))) || NULL == (chunk->data = malloc((size_t)size))) {
+                chunk_free(chunk);
+                goto badness;
+            }
+            chunk->size = (size_t)size;
+            for (d = 0; d < e.rank; d++)
+                chunk->index[d] = offset[d] / chunk_dims[d];
+            if (H5Dread_chunk(did, H5P_DEFAULT, offset, &chunk->filter_mask, chunk->data) < 0) {
+                chunk_free(chunk);
+                goto badness;
+            }
+
+            n_chunks++;
+            n_bytes += size;
+            if (chunk->filter_mask)
+                n_redone++;
+
+            if (inflight == (uint64_t)n_threads * INFLIGHT_PER_THREAD) {
+                inflight--;
+                if (collect(&e) < 0) {
+                    chunk_free(chunk);
+                    goto badness;
+                }
+            }
+            queue_push(&e.todo, chunk);
+            inflight++;
+        }
+
+        /* Next chunk in the grid */
+        for (d = e.rank - 1; d >= 0; d--) {
+            offset[d] += chunk_dims[d];
+            if (offset[d] < dims[d])
+                break;
+            offset[d] = 0;
+        }
+        if (d < 0)
+            more = 0;
+    }
+
+    while (inflight > 0) {
+        inflight--;
+        if (collect(&e) < 0)
+            goto badness;
+    }
+
+    if (n_chunks != n_expected) {
+        fprintf(stderr, "exported %llu chunks but the source has %llu\n", (unsigned long long)n_chunks,
+                (unsigned long long)n_expected);
+        goto badness;
+    }
+
+    printf("EXPORTED: %llu chunks, %llu bytes (%llu re-encoded) in %.3f s\n", (unsigned long long)n_chunks,
+           (unsigned long long)n_bytes, (unsigned long long)n_redone, now_seconds() - t_start);
+
+    queue_close(&e.todo);
+    for (long i = 0; i < n_started; i++)
+        pthread_join(threads[i], NULL);
+    n_started = 0;
+
+    if (H5Pclose(dcpl_id) < 0)
+        goto badness;
+    if (H5Tclose(tid) < 0)
+        goto badness;
+    if (H5Dclose(did) < 0)
+        goto badness;
+    if (H5Fclose(fid) < 0)
+        goto badness;
+
+    queue_destroy(&e.todo);
+    queue_destroy(&e.done);
+    free(threads);
+
+    printf("DONE\n");
+
+    return EXIT_SUCCESS;
+
+badness:
+    queue_close(&e.todo);
+    for (long i = 0; i < n_started; i++)
+        pthread_join(threads[i], NULL);
+
+    H5E_BEGIN_TRY
+    {
+        H5Sclose(sid);
+        H5Pclose(dcpl_id);
+        H5Tclose(tid);
+        H5Dclose(did);
+        H5Fclose(fid);
+    }
+    H5E_END_TRY;
+
+    queue_destroy(&e.todo);
+    queue_destroy(&e.done);
+    free(threads);
+
+    printf("BADNESS\n");
+
+    return EXIT_FAILURE;
+}